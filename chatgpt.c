@@ -1,12 +1,39 @@
+#define _GNU_SOURCE /* SO_PEERCRED / struct ucred */
 #include <curl/curl.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 #define DEFAULT_MODEL "gpt-4o-mini"
+#define API_URL "https://api.openai.com/v1/chat/completions"
 
 /* Renkler */
 #define COLOR_RESET "\033[0m"
@@ -17,15 +44,51 @@
 #define COLOR_CMD "\033[1;35m"
 
 /* Konuşma geçmişi */
-#define MAX_TURNS 100
+#define MAX_TURNS 100 /* varsayılan tur sınırı (CHATGPT_MAX_TURNS ile değişir) */
+
+typedef struct ArenaBlock {
+  struct ArenaBlock *prev;
+  struct ArenaBlock *next;
+  size_t used;
+  size_t cap;
+  size_t refs; /* bu bloktaki canlı tur sayısı */
+  char data[];
+} ArenaBlock;
 
 typedef struct {
-  char *user;
-  char *assistant;
+  ArenaBlock *head; /* en eski blok */
+  ArenaBlock *tail; /* yazılan blok */
+  ArenaBlock *spare;
+} Arena;
+
+typedef struct {
+  const char *user;
+  const char *assistant;
+  size_t user_len;
+  size_t assistant_len;
+  /* İstek gövdesine aynen eklenen, önceden kaçırılmış JSON parçası:
+     {"role":"user",...},{"role":"assistant",...}, */
+  const char *frag;
+  size_t frag_len;
+  size_t tokens;     /* turun (iki mesaj) token sayısı */
+  ArenaBlock *block; /* metnin durduğu arena bloğu */
+  uint64_t id;       /* süreç içinde tekil tur kimliği */
 } Turn;
 
-static Turn TURNS[MAX_TURNS];
-static int TURN_COUNT = 0;
+typedef struct {
+  Turn *ring;
+  size_t cap;
+  size_t head; /* en eski turun indeksi */
+  size_t count;
+  size_t max_turns; /* 0 = sınırsız */
+  Arena arena;
+  /* /load ile açılan günlüğün eşlemi; yüklenen turlar buraya işaret eder */
+  void *map;
+  size_t map_len;
+  uint64_t next_id;
+} History;
+
+static History HIST;
 
 /* Komut listesi */
 #define MAX_CMDS 16
@@ -34,19 +97,32 @@ static int LAST_CMD_COUNT = 0;
 
 /* Log kontrolü */
 static int QUIET_MODE = 0;
+static int STATS_MODE = 0; /* --stats: istek başına token/gecikme dökümü */
+static volatile sig_atomic_t STOP_REQUESTED = 0; /* SIGINT/SIGTERM (daemon) */
+
+/* Tek seferlik mod boruya/dosyaya yazarken: renk, başlık ve markdown yok;
+   her delta bir kez ve ağdan geldiği anda yazılır. PLAIN_NO_COPY'de cevap
+   metni hiç biriktirilmez (geçmiş ya da önbellek istemiyorsa). */
+enum { PLAIN_OFF = 0, PLAIN_ON, PLAIN_NO_COPY };
+static int PLAIN_OUTPUT = PLAIN_OFF;
+
+/* --output=ndjson: cevap yerine satır başına bir JSON olayı (tek seferlik) */
+enum { OUTPUT_TEXT = 0, OUTPUT_NDJSON };
+static int OUTPUT_MODE = OUTPUT_TEXT;
+
+static int output_mode_parse(const char *v) {
+  if (strcmp(v, "text") == 0)
+    return OUTPUT_TEXT;
+  if (strcmp(v, "ndjson") == 0)
+    return OUTPUT_NDJSON;
+  return -1;
+}
 
 /* Dil ayarı */
 static char *CURRENT_LANG = NULL;
 
-/* Dosya okuma bufferı (Son okunan dosya içeriği) */
-static char *PENDING_FILE_CONTENT = NULL;
 static char *LAST_RESPONSE = NULL; /* /copy komutu için son cevabı tut */
-
-/* curl için bellek */
-struct Memory {
-  char *data;
-  size_t size;
-};
+static char REPLY_LAST = 0; /* son cevabın son baytı (boru modunda satır sonu) */
 
 /* ===== Yardımcılar ===== */
 
@@ -56,6 +132,12 @@ static void log_msg(const char *msg) {
   }
 }
 
+static double mono_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
 static char *my_strdup(const char *s) {
   if (!s)
     return NULL;
@@ -66,7 +148,9 @@ static char *my_strdup(const char *s) {
   return p;
 }
 
-static char *read_file(const char *path) {
+/* Dosyanın tamamını okur; len verilirse okunan bayt sayısı yazılır (içerik
+   NUL bayt taşıyabilir, sonuna yine '\0' eklenir) */
+static char *read_file_len(const char *path, size_t *out_len) {
   FILE *f = fopen(path, "r");
   if (!f)
     return NULL;
@@ -96,9 +180,13 @@ static char *read_file(const char *path) {
 
   buf[len] = '\0';
   fclose(f);
+  if (out_len)
+    *out_len = len;
   return buf;
 }
 
+static char *read_file(const char *path) { return read_file_len(path, NULL); }
+
 static int write_file(const char *path, const char *data) {
   FILE *f = fopen(path, "w");
   if (!f)
@@ -122,51 +210,276 @@ static void trim(char *s) {
   }
 }
 
-/* JSON escape: sadece ", \, \n, \r, \t için basit kaçış */
-static char *json_escape(const char *src) {
-  size_t len = strlen(src);
-  size_t max_len = len * 2 + 16;
-  char *out = malloc(max_len);
-  if (!out)
-    return NULL;
+/* Dinamik String Buffer */
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} StrBuf;
 
-  size_t j = 0;
-  for (size_t i = 0; i < len; i++) {
-    unsigned char c = (unsigned char)src[i];
-    if (c == '\"' || c == '\\') {
-      out[j++] = '\\';
-      out[j++] = c;
-    } else if (c == '\n') {
-      out[j++] = '\\';
-      out[j++] = 'n';
-    } else if (c == '\r') {
-      out[j++] = '\\';
-      out[j++] = 'r';
-    } else if (c == '\t') {
-      out[j++] = '\\';
-      out[j++] = 't';
-    } else {
-      out[j++] = (char)c;
-    }
-    if (j + 2 >= max_len) {
-      max_len *= 2;
-      char *tmp = realloc(out, max_len);
-      if (!tmp) {
-        free(out);
-        return NULL;
-      }
-      out = tmp;
-    }
+static void sb_init(StrBuf *sb) {
+  sb->cap = 4096;
+  sb->len = 0;
+  sb->data = malloc(sb->cap);
+  if (sb->data)
+    sb->data[0] = '\0';
+}
+
+/* En az `extra` byte (+ '\0') için yer açar */
+static int sb_reserve(StrBuf *sb, size_t extra) {
+  if (!sb->data)
+    return -1;
+  if (sb->len + extra + 1 <= sb->cap)
+    return 0;
+  size_t cap = sb->cap;
+  while (sb->len + extra + 1 > cap)
+    cap *= 2;
+  char *tmp = realloc(sb->data, cap);
+  if (!tmp)
+    return -1;
+  sb->data = tmp;
+  sb->cap = cap;
+  return 0;
+}
+
+static void sb_append_n(StrBuf *sb, const char *s, size_t l) {
+  if (!s || sb_reserve(sb, l) != 0)
+    return;
+  memcpy(sb->data + sb->len, s, l);
+  sb->len += l;
+  sb->data[sb->len] = '\0';
+}
+
+static void sb_append(StrBuf *sb, const char *s) {
+  if (!s)
+    return;
+  sb_append_n(sb, s, strlen(s));
+}
+
+static void sb_putc(StrBuf *sb, char c) {
+  if (sb_reserve(sb, 1) != 0)
+    return;
+  sb->data[sb->len++] = c;
+  sb->data[sb->len] = '\0';
+}
+
+static void sb_free(StrBuf *sb) {
+  if (sb->data)
+    free(sb->data);
+}
+
+/* ===== JSON string çekirdekleri =====
+   Kaçış / çözme döngüleri, özel byte'ları (", \ ve 0x20 altı kontrol
+   karakterleri) bir tarama fonksiyonuyla toplu halde arar; aradaki düz metin
+   tek memcpy ile kopyalanır. Tarayıcı çalışma zamanında seçilir: AVX2 (32
+   byte), SSE2 (16 byte) ya da 8 byte'lık SWAR skaler yedek. */
+
+typedef size_t (*json_scan_fn)(const char *p, size_t n);
+
+/* Skaler yedek: 8 byte'ı tek kelimede kontrol eder (SWAR). Bayrak kalkarsa
+   kesin konum byte byte bulunur. */
+static int json_is_special(unsigned char c) {
+  return c == '"' || c == '\\' || c < 0x20;
+}
+
+static size_t json_scan_scalar(const char *p, size_t n) {
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t highs = 0x8080808080808080ULL;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t x;
+    memcpy(&x, p + i, 8);
+    uint64_t q = x ^ (ones * '"');
+    uint64_t b = x ^ (ones * '\\');
+    uint64_t t = ((q - ones) & ~q) | ((b - ones) & ~b) | ((x - ones * 0x20) & ~x);
+    if (t & highs)
+      break;
   }
-  out[j] = '\0';
-  return out;
+  for (; i < n; i++) {
+    if (json_is_special((unsigned char)p[i]))
+      return i;
+  }
+  return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2"))) static size_t json_scan_sse2(const char *p,
+                                                             size_t n) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i bslash = _mm_set1_epi8('\\');
+  const __m128i ctl = _mm_set1_epi8(0x1F);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, bslash));
+    /* x <= 0x1F  <=>  min(x, 0x1F) == x (işaretsiz) */
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(x, ctl), x));
+    int mask = _mm_movemask_epi8(m);
+    if (mask)
+      return i + (size_t)__builtin_ctz((unsigned)mask);
+  }
+  return i + json_scan_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2"))) static size_t json_scan_avx2(const char *p,
+                                                             size_t n) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i bslash = _mm256_set1_epi8('\\');
+  const __m256i ctl = _mm256_set1_epi8(0x1F);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(x, quote),
+                                _mm256_cmpeq_epi8(x, bslash));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(x, ctl), x));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+    if (mask)
+      return i + (size_t)__builtin_ctz(mask);
+  }
+  return i + json_scan_sse2(p + i, n - i);
+}
+#endif
+
+static size_t json_scan_resolve(const char *p, size_t n);
+static json_scan_fn json_scan = json_scan_resolve;
+
+/* İlk çağrıda CPU'ya uygun tarayıcıyı seçer */
+static size_t json_scan_resolve(const char *p, size_t n) {
+  json_scan = json_scan_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    json_scan = json_scan_avx2;
+  else if (__builtin_cpu_supports("sse2"))
+    json_scan = json_scan_sse2;
+#endif
+  return json_scan(p, n);
+}
+
+/* Özel byte'ın kaçırılmış halini esc'e yazar, uzunluğunu döner */
+static size_t json_escape_char(unsigned char c, char *esc) {
+  static const char hex[] = "0123456789abcdef";
+  esc[0] = '\\';
+  switch (c) {
+  case '"':
+    esc[1] = '"';
+    return 2;
+  case '\\':
+    esc[1] = '\\';
+    return 2;
+  case '\n':
+    esc[1] = 'n';
+    return 2;
+  case '\r':
+    esc[1] = 'r';
+    return 2;
+  case '\t':
+    esc[1] = 't';
+    return 2;
+  case '\b':
+    esc[1] = 'b';
+    return 2;
+  case '\f':
+    esc[1] = 'f';
+    return 2;
+  default:
+    esc[1] = 'u';
+    esc[2] = '0';
+    esc[3] = '0';
+    esc[4] = hex[c >> 4];
+    esc[5] = hex[c & 0xF];
+    return 6;
+  }
+}
+
+/* Kaçırılmış çıktının tam uzunluğu (yer önceden tam ayrılabilsin diye) */
+static size_t json_escaped_len(const char *src, size_t len) {
+  const char *p = src;
+  const char *end = src + len;
+  size_t extra = 0;
+  while (p < end) {
+    p += json_scan(p, (size_t)(end - p));
+    if (p >= end)
+      break;
+    unsigned char c = (unsigned char)*p++;
+    extra += (c == '"' || c == '\\' || c == '\n' || c == '\r' || c == '\t' ||
+              c == '\b' || c == '\f')
+                 ? 1
+                 : 5;
+  }
+  return len + extra;
+}
+
+/* JSON escape: ", \ ve tüm kontrol karakterleri (< 0x20) kaçırılır.
+   dst en az json_escaped_len() kadar yer göstermeli. */
+static size_t json_escape_to(char *dst, const char *src, size_t len) {
+  const char *p = src;
+  const char *end = src + len;
+  char *out = dst;
+  while (p < end) {
+    size_t run = json_scan(p, (size_t)(end - p));
+    memcpy(out, p, run);
+    out += run;
+    p += run;
+    if (p >= end)
+      break;
+    out += json_escape_char((unsigned char)*p++, out);
+  }
+  return (size_t)(out - dst);
+}
+
+static void json_escape_append(StrBuf *sb, const char *src, size_t len) {
+  size_t n = json_escaped_len(src, len);
+  if (sb_reserve(sb, n) != 0)
+    return;
+  sb->len += json_escape_to(sb->data + sb->len, src, len);
+  sb->data[sb->len] = '\0';
+}
+
+static int hex4(const char *p, const char *end, unsigned int *out) {
+  if (end - p < 4)
+    return 0;
+  unsigned int v = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = p[i];
+    v <<= 4;
+    if (c >= '0' && c <= '9')
+      v |= (unsigned)(c - '0');
+    else if (c >= 'a' && c <= 'f')
+      v |= (unsigned)(c - 'a' + 10);
+    else if (c >= 'A' && c <= 'F')
+      v |= (unsigned)(c - 'A' + 10);
+    else
+      return 0;
+  }
+  *out = v;
+  return 1;
 }
 
-/* Basit Unicode \uXXXX decode (UTF-8'e çevirir) */
-static int decode_unicode(const char *p, char *out) {
+/* Unicode \uXXXX decode (UTF-8'e çevirir). p, "\u" sonrasını gösterir;
+   vekil çiftler (😀) tek kod noktasına birleştirilir, eşsiz vekil
+   U+FFFD olur. Tüketilen kaynak byte sayısını *consumed'a yazar. */
+static int decode_unicode(const char *p, const char *end, char *out,
+                          size_t *consumed) {
   unsigned int code;
-  if (sscanf(p, "%4x", &code) != 1)
+  if (!hex4(p, end, &code)) {
+    *consumed = 0;
     return 0;
+  }
+  *consumed = 4;
+
+  if (code >= 0xD800 && code <= 0xDBFF) {
+    unsigned int low;
+    if (end - p >= 10 && p[4] == '\\' && p[5] == 'u' &&
+        hex4(p + 6, end, &low) && low >= 0xDC00 && low <= 0xDFFF) {
+      code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+      *consumed = 10;
+    } else {
+      code = 0xFFFD;
+    }
+  } else if (code >= 0xDC00 && code <= 0xDFFF) {
+    code = 0xFFFD;
+  }
 
   if (code < 0x80) {
     out[0] = (char)code;
@@ -175,807 +488,7811 @@ static int decode_unicode(const char *p, char *out) {
     out[0] = (char)(0xC0 | (code >> 6));
     out[1] = (char)(0x80 | (code & 0x3F));
     return 2;
-  } else {
+  } else if (code < 0x10000) {
     out[0] = (char)(0xE0 | (code >> 12));
     out[1] = (char)(0x80 | ((code >> 6) & 0x3F));
     out[2] = (char)(0x80 | (code & 0x3F));
     return 3;
+  } else {
+    out[0] = (char)(0xF0 | (code >> 18));
+    out[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (code & 0x3F));
+    return 4;
   }
 }
 
-/* Streaming Callback */
-typedef struct {
-  char *full_response; /* Tüm cevabı burada biriktireceğiz */
-  size_t size;
-  size_t processed; /* İşlenen (ekrana basılan) byte sayısı */
-} StreamBuffer;
-
-static size_t stream_callback(void *contents, size_t size, size_t nmemb,
-                              void *userp) {
-  size_t realsize = size * nmemb;
-  StreamBuffer *mem = (StreamBuffer *)userp;
-
-  char *ptr = realloc(mem->full_response, mem->size + realsize + 1);
-  if (!ptr)
-    return 0;
-
-  mem->full_response = ptr;
-  memcpy(&(mem->full_response[mem->size]), contents, realsize);
-  mem->size += realsize;
-  mem->full_response[mem->size] = 0;
-
-  /* full_response üzerinde, kaldigimiz yerden (\n arayarak) devam edelim */
-  char *p_start = mem->full_response + mem->processed;
-  char *p_end = mem->full_response + mem->size;
-  char *p = p_start;
-
-  while (p < p_end) {
-    if (*p == '\n') {
-      /* Tam bir satır bulundu: p_start -> p */
-      size_t line_len = p - p_start;
-
-      /* Gecici olarak null-terminate yapmayalim, strncmp kullanalim */
-
-      /* "data: " kontrolü */
-      if (line_len > 6 && strncmp(p_start, "data: ", 6) == 0) {
-        char *json_part = p_start + 6;
-        size_t json_len = line_len - 6;
-
-        // [DONE] kontrolü
-        if (json_len >= 6 && strncmp(json_part, "[DONE]", 6) == 0) {
-          // Bitti
-        } else {
-          // JSON Parse (Sadece delta content)
-          /* p_start'tan p'ye kadar olan bolge benim satirım.
-             json_part bu satirin icinde.
-             strstr kullanmak icin gecici buffer sart degil ama
-             guvenlik icin line'i kopyalayip null-terminate yapmak en temizi. */
-
-          char *line_buf = malloc(line_len + 1);
-          if (line_buf) {
-            memcpy(line_buf, p_start, line_len);
-            line_buf[line_len] = '\0';
-
-            char *safe_json = line_buf + 6; // "data: " sonrasi
-
-            const char *d_cont = strstr(safe_json, "\"content\":");
-            if (d_cont) {
-              d_cont += 10;
-              while (*d_cont == ' ' || *d_cont == ':' || *d_cont == '\t')
-                d_cont++;
-
-              if (*d_cont == '"') {
-                d_cont++;
-                char temp_buf[4096];
-                int t_idx = 0;
-                int escaped = 0;
-
-                for (const char *c = d_cont; *c; c++) {
-                  if (escaped) {
-                    if (*c == 'n')
-                      temp_buf[t_idx++] = '\n';
-                    else if (*c == 't')
-                      temp_buf[t_idx++] = '\t';
-                    else if (*c == '"')
-                      temp_buf[t_idx++] = '"';
-                    else if (*c == '\\')
-                      temp_buf[t_idx++] = '\\';
-                    else
-                      temp_buf[t_idx++] = *c;
-                    escaped = 0;
-                  } else {
-                    if (*c == '\\') {
-                      escaped = 1;
-                    } else if (*c == '"') {
-                      break;
-                    } else {
-                      temp_buf[t_idx++] = *c;
-                    }
-                  }
-                }
-                temp_buf[t_idx] = '\0';
-                printf("%s", temp_buf);
-                fflush(stdout);
-              }
-            }
-
-            // Usage stats
-            const char *u_cont = strstr(safe_json, "\"usage\":");
-            if (u_cont) {
-              const char *t_tok = strstr(u_cont, "\"total_tokens\":");
-              if (t_tok) {
-                t_tok += 15;
-                int total = atoi(t_tok);
-                printf("\n%s[Usage: %d tokens]%s", COLOR_INFO, total,
-                       COLOR_RESET);
-              }
-            }
-            free(line_buf);
-          }
-        }
+/* JSON string içeriğini (tırnaklar hariç) çözerek sb'ye ekler */
+static void json_unescape_append(StrBuf *sb, const char *s, const char *end) {
+  while (s < end) {
+    size_t run = json_scan(s, (size_t)(end - s));
+    sb_append_n(sb, s, run);
+    s += run;
+    if (s >= end)
+      break;
+    if (*s != '\\') {
+      /* Geçerli JSON'da string içinde ham " ya da kontrol karakteri olmaz;
+         yine de gelirse olduğu gibi geçir */
+      sb_putc(sb, *s++);
+      continue;
+    }
+    if (s + 1 >= end)
+      break;
+    switch (s[1]) {
+    case 'n':
+      sb_putc(sb, '\n');
+      break;
+    case 't':
+      sb_putc(sb, '\t');
+      break;
+    case 'r':
+      sb_putc(sb, '\r');
+      break;
+    case 'b':
+      sb_putc(sb, '\b');
+      break;
+    case 'f':
+      sb_putc(sb, '\f');
+      break;
+    case 'u': {
+      char utf8[4];
+      size_t used;
+      int n = decode_unicode(s + 2, end, utf8, &used);
+      if (n > 0) {
+        sb_append_n(sb, utf8, (size_t)n);
+        s += 2 + used;
+        continue;
       }
-
-      /* Bir sonraki satir icin start noktasini guncelle */
-      mem->processed = (p - mem->full_response) + 1; /* \n'den sonrasi */
-      p_start = mem->full_response + mem->processed;
+      sb_putc(sb, 'u');
+      break;
     }
-    p++;
+    default:
+      sb_putc(sb, s[1]);
+      break;
+    }
+    s += 2;
   }
-
-  return realsize;
-}
-
-/* Config yolu */
-static char *get_config_path(void) {
-  const char *home = getenv("HOME");
-  if (!home)
-    home = ".";
-  size_t len = strlen(home) + strlen("/.config/chatgpt-cli-c/config") + 1;
-  char *path = malloc(len);
-  if (!path)
-    return NULL;
-  snprintf(path, len, "%s/.config/chatgpt-cli-c/config", home);
-  return path;
 }
 
-/* API key yükleme */
-static char *load_api_key(void) {
-  const char *env_key = getenv("OPENAI_API_KEY");
-  if (env_key && env_key[0] != '\0') {
-    log_msg("API anahtarı OPENAI_API_KEY ortam değişkeninden yüklendi.");
-    return my_strdup(env_key);
-  }
+/* ===== Minimal JSON okuyucu =====
+   Sadece ihtiyaç duyduğumuz alanlara (choices[0].delta.content, usage, ...)
+   tek geçişte ulaşmak için küçük yardımcılar. Tam bir DOM kurulmaz. */
 
-  char *config_path = get_config_path();
-  if (!config_path) {
-    log_msg("Config yolu oluşturulamadı.");
-    return NULL;
-  }
+static const char *json_ws(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+    p++;
+  return p;
+}
 
-  char *content = read_file(config_path);
-  if (content) {
-    trim(content);
-    if (content[0] != '\0') {
-      log_msg("API anahtarı config dosyasından yüklendi.");
-      free(config_path);
-      return content;
+/* p: açılış tırnağı. Kapanış tırnağından sonrasını döner. */
+static const char *json_skip_string(const char *p, const char *end) {
+  p++;
+  while (p < end) {
+    if (*p == '\\') {
+      p += 2;
+      continue;
     }
-    free(content);
+    if (*p == '"')
+      return p + 1;
+    p++;
   }
+  return NULL;
+}
 
-  log_msg("Config dosyası yok veya boş. İlk kurulum.");
-  printf("OpenAI API anahtarını gir (sadece ilk sefer): ");
-  fflush(stdout);
-
-  char buf[512];
-  if (!fgets(buf, sizeof(buf), stdin)) {
-    log_msg("API anahtarı okunamadı.");
-    free(config_path);
+static const char *json_skip_value(const char *p, const char *end) {
+  p = json_ws(p, end);
+  if (p >= end)
     return NULL;
-  }
-  trim(buf);
-  if (buf[0] == '\0') {
-    log_msg("Boş API anahtarı girildi.");
-    free(config_path);
+  if (*p == '"')
+    return json_skip_string(p, end);
+  if (*p == '{' || *p == '[') {
+    int depth = 0;
+    while (p < end) {
+      if (*p == '"') {
+        p = json_skip_string(p, end);
+        if (!p)
+          return NULL;
+        continue;
+      }
+      if (*p == '{' || *p == '[')
+        depth++;
+      else if (*p == '}' || *p == ']') {
+        depth--;
+        if (depth == 0)
+          return p + 1;
+      }
+      p++;
+    }
     return NULL;
   }
+  /* sayı, true, false, null */
+  while (p < end && *p != ',' && *p != '}' && *p != ']' && *p != ' ' &&
+         *p != '\n' && *p != '\r' && *p != '\t')
+    p++;
+  return p;
+}
 
-  const char *home = getenv("HOME");
-  if (!home)
-    home = ".";
-  char dirpath[1024];
-  snprintf(dirpath, sizeof(dirpath), "%s/.config/chatgpt-cli-c", home);
-  if (mkdir(dirpath, 0700) != 0 && errno != EEXIST) {
-    perror("mkdir");
-    log_msg("Config dizini oluşturulamadı.");
-    free(config_path);
-    return NULL;
+/* obj: '{' ile başlayan nesne. Anahtarın değerinin başlangıcını *vp'ye yazar */
+static int json_obj_get(const char *obj, const char *end, const char *key,
+                        const char **vp) {
+  const char *p = json_ws(obj, end);
+  if (p >= end || *p != '{')
+    return 0;
+  size_t klen = strlen(key);
+  p++;
+  while (1) {
+    p = json_ws(p, end);
+    if (p >= end || *p != '"')
+      return 0;
+    const char *kstart = p + 1;
+    const char *kend = json_skip_string(p, end);
+    if (!kend)
+      return 0;
+    int match = (size_t)(kend - 1 - kstart) == klen &&
+                memcmp(kstart, key, klen) == 0;
+    p = json_ws(kend, end);
+    if (p >= end || *p != ':')
+      return 0;
+    p = json_ws(p + 1, end);
+    if (match) {
+      *vp = p;
+      return 1;
+    }
+    p = json_skip_value(p, end);
+    if (!p)
+      return 0;
+    p = json_ws(p, end);
+    if (p >= end || *p != ',')
+      return 0;
+    p++;
   }
+}
 
-  if (write_file(config_path, buf) != 0) {
-    log_msg("Config dosyasına yazılamadı.");
-    free(config_path);
+/* arr: '[' ile başlayan dizi. İlk elemanın başlangıcını döner. */
+static const char *json_arr_first(const char *arr, const char *end) {
+  const char *p = json_ws(arr, end);
+  if (p >= end || *p != '[')
     return NULL;
-  }
+  p = json_ws(p + 1, end);
+  if (p >= end || *p == ']')
+    return NULL;
+  return p;
+}
 
-  chmod(config_path, 0600);
-  log_msg("API anahtarı config dosyasına kaydedildi "
-          "(~/.config/chatgpt-cli-c/config).");
-  free(config_path);
-  return my_strdup(buf);
+static long json_get_long(const char *obj, const char *end, const char *key) {
+  const char *v;
+  if (!json_obj_get(obj, end, key, &v) || v >= end)
+    return 0;
+  return strtol(v, NULL, 10);
 }
 
-/* Config'ten varsayılan model okuma / yazma */
-static char *get_model_from_config(void) {
-  const char *home = getenv("HOME");
-  if (!home)
-    return NULL;
+/* v: string değerinin açılış tırnağı. İçeriği [*s, *e) olarak verir. */
+static int json_string_span(const char *v, const char *end, const char **s,
+                            const char **e) {
+  if (v >= end || *v != '"')
+    return 0;
+  const char *after = json_skip_string(v, end);
+  if (!after)
+    return 0;
+  *s = v + 1;
+  *e = after - 1;
+  return 1;
+}
 
-  char path[1024];
-  snprintf(path, sizeof(path), "%s/.config/chatgpt-cli-c/model", home);
+/* ===== Gecikme ölçümü =====
+   Her istek için evreler (DNS, bağlantı, TLS, ilk bayt) curl'ün
+   CURLINFO_*_TIME_T sayaçlarından, ilk içerik token'ı ve token arası
+   boşluklar ise ayrıştırıcının aldığı monoton zaman damgalarından gelir.
+   Değerler mikrosaniye cinsinden log-doğrusal (HDR benzeri) histogramlarda
+   model başına tutulur: her ikinin kuvveti aralığı 16 alt kovaya bölünür,
+   yani göreli hata ~%6 ve bellek sabittir. Histogramlar "kayan" pencereli:
+   örnek sayısı HDR_WINDOW'un iki katına ulaşınca sayılar yarılanır, eski
+   ölçümlerin ağırlığı azalır. İstenirse her istek bir JSONL izleme
+   dosyasına (--trace / CHATGPT_TRACE) tek satır olarak eklenir. */
+
+#define HDR_SUB_BITS 4
+#define HDR_SUB (1 << HDR_SUB_BITS)
+#define HDR_BUCKETS (40 * HDR_SUB) /* 2^40 µs ≈ 12 gün */
+#define HDR_WINDOW 1024
 
-  char *content = read_file(path);
-  if (!content)
-    return NULL;
+typedef struct {
+  uint32_t counts[HDR_BUCKETS];
+  uint64_t total;
+} Hdr;
+
+static int hdr_index(uint64_t v) {
+  if (v < HDR_SUB)
+    return (int)v;
+  int e = 63 - __builtin_clzll(v);
+  int idx = (e - HDR_SUB_BITS + 1) * HDR_SUB +
+            (int)((v >> (e - HDR_SUB_BITS)) & (HDR_SUB - 1));
+  return idx < HDR_BUCKETS ? idx : HDR_BUCKETS - 1;
+}
 
-  trim(content);
-  return content;
+/* Kovanın temsil değeri: aralığın ortası */
+static uint64_t hdr_value(int idx) {
+  if (idx < HDR_SUB)
+    return (uint64_t)idx;
+  int e = idx / HDR_SUB + HDR_SUB_BITS - 1;
+  uint64_t width = 1ULL << (e - HDR_SUB_BITS);
+  return (uint64_t)(HDR_SUB + idx % HDR_SUB) * width + width / 2;
 }
 
-static int write_model_to_config(const char *model) {
-  const char *home = getenv("HOME");
-  if (!home)
-    return -1;
+static void hdr_decay(Hdr *h) {
+  h->total = 0;
+  for (int i = 0; i < HDR_BUCKETS; i++) {
+    h->counts[i] >>= 1;
+    h->total += h->counts[i];
+  }
+}
 
-  char dir[1024];
-  snprintf(dir, sizeof(dir), "%s/.config/chatgpt-cli-c", home);
-  mkdir(dir, 0700);
+static void hdr_record(Hdr *h, int64_t us) {
+  h->counts[hdr_index(us > 0 ? (uint64_t)us : 0)]++;
+  if (++h->total >= 2 * HDR_WINDOW)
+    hdr_decay(h);
+}
 
-  char path[1024];
-  snprintf(path, sizeof(path), "%s/model", dir);
+static void hdr_merge(Hdr *dst, const Hdr *src) {
+  if (src->total == 0)
+    return;
+  for (int i = 0; i < HDR_BUCKETS; i++)
+    dst->counts[i] += src->counts[i];
+  dst->total += src->total;
+  while (dst->total >= 2 * HDR_WINDOW)
+    hdr_decay(dst);
+}
 
-  if (write_file(path, model) != 0) {
+/* q: 0..1; boş histogramda -1 */
+static int64_t hdr_percentile(const Hdr *h, double q) {
+  if (h->total == 0)
     return -1;
+  uint64_t want = (uint64_t)(q * (double)h->total + 0.999999);
+  if (want == 0)
+    want = 1;
+  uint64_t seen = 0;
+  int last = 0;
+  for (int i = 0; i < HDR_BUCKETS; i++) {
+    if (!h->counts[i])
+      continue;
+    seen += h->counts[i];
+    last = i;
+    if (seen >= want)
+      return (int64_t)hdr_value(i);
   }
-  chmod(path, 0600);
-  return 0;
+  return (int64_t)hdr_value(last);
 }
 
-/* Dil ayarları okuma / yazma */
-static char *get_lang_path(void) {
-  const char *home = getenv("HOME");
-  if (!home)
-    home = ".";
-  size_t len = strlen(home) + strlen("/.config/chatgpt-cli-c/lang") + 1;
-  char *path = malloc(len);
-  if (!path)
+/* Bir isteğin ölçümleri (µs; -1 = ölçülmedi) */
+typedef struct {
+  int64_t dns, connect, tls, ttfb, ttft, total;
+  int64_t gap_p50, gap_p99, gap_max;
+  double tokens_per_sec;
+  int reused;
+} Timing;
+
+typedef struct {
+  char *model;
+  uint64_t requests;
+  double tokens;   /* üretilen token toplamı */
+  double gen_secs; /* ilk ve son içerik token'ı arası toplam süre */
+  Hdr ttft, gap, total;
+} ModelStats;
+
+static ModelStats *LAT_MODELS = NULL;
+static size_t LAT_MODEL_COUNT = 0;
+static const char *TRACE_PATH = NULL; /* --trace / CHATGPT_TRACE */
+
+static ModelStats *lat_model(const char *model) {
+  for (size_t i = 0; i < LAT_MODEL_COUNT; i++)
+    if (strcmp(LAT_MODELS[i].model, model) == 0)
+      return &LAT_MODELS[i];
+  ModelStats *tmp =
+      realloc(LAT_MODELS, (LAT_MODEL_COUNT + 1) * sizeof(ModelStats));
+  if (!tmp)
     return NULL;
-  snprintf(path, len, "%s/.config/chatgpt-cli-c/lang", home);
-  return path;
+  LAT_MODELS = tmp;
+  ModelStats *m = &LAT_MODELS[LAT_MODEL_COUNT];
+  memset(m, 0, sizeof(*m));
+  m->model = my_strdup(model);
+  if (!m->model)
+    return NULL;
+  LAT_MODEL_COUNT++;
+  return m;
 }
 
-static char *get_lang_from_config(void) {
-  char *path = get_lang_path();
-  if (!path)
-    return NULL;
-  char *content = read_file(path);
-  free(path);
-  if (content) {
-    trim(content);
-    if (content[0] == '\0') {
-      free(content);
-      return NULL;
-    }
-  }
-  return content;
+static void lat_free(void) {
+  for (size_t i = 0; i < LAT_MODEL_COUNT; i++)
+    free(LAT_MODELS[i].model);
+  free(LAT_MODELS);
+  LAT_MODELS = NULL;
+  LAT_MODEL_COUNT = 0;
 }
 
-static int write_lang_to_config(const char *lang) {
-  char *path = get_lang_path();
-  if (!path)
-    return -1;
+/* curl sayaçları istek başından itibaren birikimlidir; evre sürelerine
+   çevrilir. Havuzdan gelen bağlantıda DNS/bağlantı/TLS 0 çıkar. */
+static void timing_from_curl(CURL *h, Timing *t) {
+  curl_off_t dns = 0, conn = 0, app = 0, start = 0, total = 0;
+  long new_conns = 0;
+  curl_easy_getinfo(h, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+  curl_easy_getinfo(h, CURLINFO_CONNECT_TIME_T, &conn);
+  curl_easy_getinfo(h, CURLINFO_APPCONNECT_TIME_T, &app);
+  curl_easy_getinfo(h, CURLINFO_STARTTRANSFER_TIME_T, &start);
+  curl_easy_getinfo(h, CURLINFO_TOTAL_TIME_T, &total);
+  curl_easy_getinfo(h, CURLINFO_NUM_CONNECTS, &new_conns);
+  t->dns = dns;
+  t->connect = conn > dns ? conn - dns : 0;
+  t->tls = app > conn ? app - conn : 0;
+  t->ttfb = start;
+  t->total = total;
+  t->reused = new_conns == 0;
+}
 
-  const char *home = getenv("HOME");
-  char dir[1024];
-  snprintf(dir, sizeof(dir), "%s/.config/chatgpt-cli-c", home ? home : ".");
-  mkdir(dir, 0700);
+static void trace_write(const char *model, long status, const Timing *t,
+                        long prompt_tokens, long completion_tokens) {
+  if (!TRACE_PATH)
+    return;
+  StrBuf line;
+  sb_init(&line);
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  char num[512];
+  snprintf(num, sizeof(num), "{\"ts\":%lld.%03ld,\"model\":\"",
+           (long long)ts.tv_sec, ts.tv_nsec / 1000000);
+  sb_append(&line, num);
+  json_escape_append(&line, model, strlen(model));
+  snprintf(num, sizeof(num),
+           "\",\"status\":%ld,\"reused\":%s,\"dns_us\":%lld,"
+           "\"connect_us\":%lld,\"tls_us\":%lld,\"ttfb_us\":%lld,"
+           "\"ttft_us\":%lld,\"gap_p50_us\":%lld,\"gap_p99_us\":%lld,"
+           "\"gap_max_us\":%lld,\"total_us\":%lld,\"prompt_tokens\":%ld,"
+           "\"completion_tokens\":%ld,\"tokens_per_sec\":%.1f}\n",
+           status, t->reused ? "true" : "false", (long long)t->dns,
+           (long long)t->connect, (long long)t->tls, (long long)t->ttfb,
+           (long long)t->ttft, (long long)t->gap_p50, (long long)t->gap_p99,
+           (long long)t->gap_max, (long long)t->total, prompt_tokens,
+           completion_tokens, t->tokens_per_sec);
+  sb_append(&line, num);
+  /* O_APPEND + tek write: eşzamanlı süreçlerin satırları karışmaz */
+  int fd = open(TRACE_PATH, O_WRONLY | O_APPEND | O_CREAT, 0600);
+  if (fd >= 0 && line.data) {
+    if (write(fd, line.data, line.len) != (ssize_t)line.len)
+      log_msg("İzleme dosyasına yazılamadı.");
+  }
+  if (fd >= 0)
+    close(fd);
+  sb_free(&line);
+}
 
-  int res = write_file(path, lang);
-  if (res == 0)
-    chmod(path, 0600);
-  free(path);
-  return res;
+/* µs değerini okunur biçimde yazar */
+static const char *fmt_us(char *buf, size_t n, int64_t us) {
+  if (us < 0)
+    snprintf(buf, n, "-");
+  else if (us < 10000)
+    snprintf(buf, n, "%.1fms", (double)us / 1000);
+  else if (us < 10000000)
+    snprintf(buf, n, "%lldms", (long long)(us / 1000));
+  else
+    snprintf(buf, n, "%.1fs", (double)us / 1e6);
+  return buf;
 }
 
-/* System Prompt okuma */
-static char *get_system_prompt_path(void) {
-  const char *home = getenv("HOME");
-  if (!home)
-    home = ".";
-  size_t len =
-      strlen(home) + strlen("/.config/chatgpt-cli-c/system_prompt") + 1;
-  char *path = malloc(len);
-  if (!path)
-    return NULL;
-  snprintf(path, len, "%s/.config/chatgpt-cli-c/system_prompt", home);
-  return path;
+static void print_timing(const Timing *t) {
+  char a[16], b[16], c[16], d[16], e[16], f[16], g[16];
+  fprintf(stderr,
+          "%s[Gecikme: DNS %s, bağlantı %s, TLS %s, ilk bayt %s, ilk token %s, "
+          "aralık p50 %s, toplam %s, %.1f token/sn%s]%s\n",
+          COLOR_INFO, fmt_us(a, sizeof(a), t->dns),
+          fmt_us(b, sizeof(b), t->connect), fmt_us(c, sizeof(c), t->tls),
+          fmt_us(d, sizeof(d), t->ttfb), fmt_us(e, sizeof(e), t->ttft),
+          fmt_us(f, sizeof(f), t->gap_p50), fmt_us(g, sizeof(g), t->total),
+          t->tokens_per_sec, t->reused ? ", bağlantı havuzdan" : "",
+          COLOR_RESET);
 }
 
-static char *get_system_prompt_from_config(void) {
-  char *path = get_system_prompt_path();
-  if (!path)
-    return NULL;
-  char *content = read_file(path);
-  free(path);
-  if (content) {
-    trim(content);
-    if (content[0] == '\0') {
-      free(content);
-      return NULL;
+static void print_hdr_row(const char *label, const Hdr *h) {
+  static const double qs[] = {0.5, 0.9, 0.99, 1.0};
+  char buf[16];
+  printf("  %-8s", label);
+  for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); i++)
+    printf(" %9s", fmt_us(buf, sizeof(buf), hdr_percentile(h, qs[i])));
+  printf("  (n=%llu)\n", (unsigned long long)h->total);
+}
+
+/* /stats: model başına yüzdelik tablosu */
+static void print_latency_stats(void) {
+  if (LAT_MODEL_COUNT == 0) {
+    printf("%s(henüz ölçüm yok)%s\n", COLOR_INFO, COLOR_RESET);
+    return;
+  }
+  for (size_t i = 0; i < LAT_MODEL_COUNT; i++) {
+    const ModelStats *m = &LAT_MODELS[i];
+    printf("%s%s%s: %llu istek, %.1f token/sn\n", COLOR_ASSIST, m->model,
+           COLOR_RESET, (unsigned long long)m->requests,
+           m->gen_secs > 0 ? m->tokens / m->gen_secs : 0.0);
+    printf("  %-8s %9s %9s %9s %9s\n", "", "p50", "p90", "p99", "max");
+    print_hdr_row("TTFT", &m->ttft);
+    print_hdr_row("ITL", &m->gap);
+    print_hdr_row("Toplam", &m->total);
+  }
+}
+
+/* ===== Terminal çıktısı =====
+   Akan cevap parçaları her token için ayrı write(2) yapmak yerine bir
+   tamponda biriktirilir. Tampon şu durumlarda boşaltılır:
+   - TTY'de bir kare süresi (CHATGPT_FRAME_MS, varsayılan 12 ms) dolunca,
+   - satır sonu gelince,
+   - akış bitince.
+   Kare süresi, parça gelmese de dolabilir. Bu yüzden istek döngüsü
+   curl_multi_poll'un zaman aşımını out_timeout_ms()'ten alır. Çıktı bir
+   boru ya da dosyaya gidiyorsa zamanlayıcı kullanılmaz; tampon sadece
+   dolunca ya da akış bitince yazılır. Yazımlar writev ile yapılır, büyük
+   parçalar tampona kopyalanmaz. stdio ile sıralama bozulmasın diye önce
+   stdout boşaltılır. */
+
+#define OUT_BUF_SIZE 16384
+#define OUT_FRAME_MS 12
+
+typedef struct {
+  char buf[OUT_BUF_SIZE];
+  size_t len;
+  double last_flush; /* monoton sn */
+  double frame;      /* sn; 0 = zamanlayıcı yok */
+  int tty;
+  int eager; /* PLAIN_OUTPUT: her ağ okumasından sonra boşalt */
+  int init;
+} OutBuf;
+
+static OutBuf OUT;
+
+static void out_init(void) {
+  if (OUT.init)
+    return;
+  OUT.init = 1;
+  long ms = OUT_FRAME_MS;
+  const char *env = getenv("CHATGPT_FRAME_MS");
+  if (env && env[0])
+    ms = strtol(env, NULL, 10);
+  OUT.tty = isatty(STDOUT_FILENO);
+  OUT.frame = OUT.tty ? (double)(ms > 0 ? ms : 0) / 1000 : 0;
+  OUT.eager = PLAIN_OUTPUT != PLAIN_OFF;
+}
+
+/* Tampondakini (ve varsa ek parçayı) tek writev ile yazar */
+static void out_write(const char *extra, size_t extra_len) {
+  struct iovec iov[2];
+  int n = 0;
+  if (OUT.len)
+    iov[n++] = (struct iovec){OUT.buf, OUT.len};
+  if (extra_len)
+    iov[n++] = (struct iovec){(void *)extra, extra_len};
+  if (n == 0)
+    return;
+  fflush(stdout);
+  while (n > 0) {
+    ssize_t w = writev(STDOUT_FILENO, iov, n);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      break; /* kapalı boru vb.: çıktıyı bırak */
+    }
+    /* Kısmi yazım: kalan kısmı ilerlet */
+    while (n > 0 && (size_t)w >= iov[0].iov_len) {
+      w -= (ssize_t)iov[0].iov_len;
+      iov[0] = iov[1];
+      n--;
+    }
+    if (n > 0) {
+      iov[0].iov_base = (char *)iov[0].iov_base + w;
+      iov[0].iov_len -= (size_t)w;
     }
   }
-  return content;
+  OUT.len = 0;
+  OUT.last_flush = mono_now();
 }
 
-/* Komut listesi yönetimi */
-static void clear_last_cmds(void) {
-  for (int i = 0; i < LAST_CMD_COUNT; i++) {
-    free(LAST_CMDS[i]);
-    LAST_CMDS[i] = NULL;
+static void out_flush(void) { out_write(NULL, 0); }
+
+static void out_append(const char *text, size_t len) {
+  out_init();
+  if (OUT.len + len > OUT_BUF_SIZE) {
+    out_write(text, len);
+    return;
   }
-  LAST_CMD_COUNT = 0;
+  memcpy(OUT.buf + OUT.len, text, len);
+  OUT.len += len;
+  if (OUT.frame > 0 &&
+      (memchr(text, '\n', len) || mono_now() - OUT.last_flush >= OUT.frame))
+    out_flush();
 }
 
-static void extract_commands_from_answer(const char *answer) {
-  clear_last_cmds();
-  if (!answer)
+/* Bekleyen çıktı için kalan kare süresi (ms); bekleyen yoksa -1 */
+static int out_timeout_ms(void) {
+  if (OUT.len && OUT.eager)
+    return 0;
+  if (OUT.len == 0 || OUT.frame == 0)
+    return -1;
+  double left = OUT.frame - (mono_now() - OUT.last_flush);
+  return left <= 0 ? 0 : (int)(left * 1000) + 1;
+}
+
+/* Kare süresi dolduysa boşaltır (poll döngüsünden çağrılır) */
+static void out_tick(void) {
+  if (out_timeout_ms() == 0)
+    out_flush();
+}
+
+/* ===== Markdown görüntüleyici =====
+   Cevap parçaları geldikçe tek geçişte işlenir. Daha önce basılan metin
+   yeniden taranmaz. Satır başları (başlık, liste, alıntı, "$ " komutu,
+   ``` çiti) karar verilebilene kadar küçük bir tamponda bekletilir.
+   Satır içinde `kod` ve **kalın** işaretleri stile çevrilir. Çitli kod
+   bloklarında dile göre tablo tabanlı renklendirme yapılır: anahtar
+   kelime, string, yorum ve sayı. Renklendirme sadece terminalde yapılır.
+   TTY değilse, ya da CHATGPT_MARKDOWN=0 ise, metin aynen geçer. Her iki
+   durumda da kod bloklarının ve "$ " komut satırlarının ham metindeki
+   konumları kaydedilir. /run, /save N ve /blocks bunları kullanır, cevabı
+   yeniden ayrıştırmaz. */
+
+#define MD_HEAD_MAX 64
+#define MD_WORD_MAX 64
+
+#define MD_STYLE_HEADING "\033[1;36m"
+#define MD_STYLE_BOLD "\033[1m"
+#define MD_STYLE_ICODE "\033[33m"
+#define MD_STYLE_FENCE "\033[90m"
+#define MD_STYLE_BULLET "\033[36m"
+#define MD_STYLE_KEYWORD "\033[35m"
+#define MD_STYLE_STRING "\033[32m"
+#define MD_STYLE_COMMENT "\033[90m"
+#define MD_STYLE_NUMBER "\033[36m"
+
+enum { MD_SPAN_BLOCK, MD_SPAN_CMD };
+
+typedef struct {
+  int kind;
+  size_t start, end; /* ham cevap metnindeki [start, end) */
+  size_t cmds;       /* blok içindeki "$ " satırı sayısı */
+  char lang[16];
+} MdSpan;
+
+typedef struct {
+  const char *names; /* boşlukla ayrılmış dil adları */
+  const char *line_comment;
+  int block_comment; /* C tarzı yorum */
+  const char *quotes;
+  const char *const *keywords;
+} MdLang;
+
+static const char *const MD_KW_SH[] = {
+    "if",    "then",  "else",   "elif",   "fi",     "for",    "while",
+    "do",    "done",  "case",   "esac",   "in",     "function", "return",
+    "local", "export", "echo",  "cd",     "sudo",   "exit",   NULL};
+static const char *const MD_KW_C[] = {
+    "int",    "char",   "void",     "long",    "short",   "unsigned",
+    "signed", "float",  "double",   "const",   "static",  "struct",
+    "union",  "enum",   "typedef",  "if",      "else",    "for",
+    "while",  "do",     "switch",   "case",    "default", "break",
+    "continue", "return", "sizeof", "goto",    "extern",  "volatile",
+    "inline", "size_t", "NULL",     "include", "define",  "bool",
+    "true",   "false",  "auto",     "class",   "public",  "private",
+    "namespace", "template", "new", "delete",  NULL};
+static const char *const MD_KW_PY[] = {
+    "def",    "class", "return", "if",     "elif",   "else",   "for",
+    "while",  "in",    "not",    "and",    "or",     "is",     "import",
+    "from",   "as",    "with",   "try",    "except", "finally", "raise",
+    "pass",   "break", "continue", "lambda", "yield", "None",  "True",
+    "False",  "self",  "async",  "await",  "global", "print",  NULL};
+static const char *const MD_KW_JSON[] = {"true", "false", "null", NULL};
+
+static const MdLang MD_LANGS[] = {
+    {"sh bash shell zsh console", "#", 0, "\"'", MD_KW_SH},
+    {"c h cpp c++ cc hpp java js javascript ts typescript go rust", "//", 1,
+     "\"'", MD_KW_C},
+    {"python py python3", "#", 0, "\"'", MD_KW_PY},
+    {"json jsonc", NULL, 0, "\"", MD_KW_JSON},
+};
+
+enum { MD_TEXT, MD_CODE };
+enum { HL_NONE, HL_STRING, HL_LINE_COMMENT, HL_BLOCK_COMMENT };
+
+typedef struct {
+  int style; /* ANSI uygula */
+  int mode;  /* MD_TEXT / MD_CODE */
+  size_t off; /* işlenen ham bayt sayısı = sıradaki baytın konumu */
+  StrBuf out; /* bu parçanın dönüştürülmüş çıktısı */
+
+  /* satır başı */
+  int line_start;
+  char head[MD_HEAD_MAX];
+  size_t head_len;
+  size_t head_off;
+
+  /* metin satırı */
+  int heading, bold, icode, star, tick;
+
+  /* kod bloğu */
+  const MdLang *lang;
+  char lang_name[16];
+  size_t fence_len;
+  size_t block_start;
+  size_t block_cmds; /* blok içindeki "$ " satırı sayısı */
+  int hl;
+  char quote;
+  int esc, slash, comment_star;
+  char word[MD_WORD_MAX];
+  size_t word_len;
+
+  /* "$ " komut satırı */
+  int in_cmd;
+  size_t cmd_start;
+
+  MdSpan *spans;
+  size_t span_count, span_cap;
+} Md;
+
+static Md MD;
+
+/* Son başarılı cevabın kod blokları ve komutları */
+static MdSpan *LAST_SPANS = NULL;
+static size_t LAST_SPAN_COUNT = 0;
+
+static MdSpan *md_span(int kind, size_t start, size_t end, const char *lang) {
+  if (MD.span_count == MD.span_cap) {
+    size_t cap = MD.span_cap ? MD.span_cap * 2 : 8;
+    MdSpan *tmp = realloc(MD.spans, cap * sizeof(MdSpan));
+    if (!tmp)
+      return NULL;
+    MD.spans = tmp;
+    MD.span_cap = cap;
+  }
+  MdSpan *s = &MD.spans[MD.span_count++];
+  s->kind = kind;
+  s->start = start;
+  s->end = end;
+  s->cmds = 0;
+  snprintf(s->lang, sizeof(s->lang), "%s", lang ? lang : "");
+  return s;
+}
+
+static void md_style(const char *code) {
+  if (MD.style)
+    sb_append(&MD.out, code);
+}
+
+/* Tüm stilleri kapatıp hâlâ geçerli olanları yeniden açar */
+static void md_restyle(void) {
+  if (!MD.style)
     return;
+  sb_append(&MD.out, COLOR_RESET);
+  if (MD.heading)
+    sb_append(&MD.out, MD_STYLE_HEADING);
+  if (MD.bold)
+    sb_append(&MD.out, MD_STYLE_BOLD);
+  if (MD.icode)
+    sb_append(&MD.out, MD_STYLE_ICODE);
+}
 
-  const char *p = answer;
-  while (*p && LAST_CMD_COUNT < MAX_CMDS) {
-    const char *line_start = p;
-    const char *line_end = strchr(p, '\n');
-    size_t len =
-        line_end ? (size_t)(line_end - line_start) : strlen(line_start);
+static const MdLang *md_find_lang(const char *name) {
+  size_t n = strlen(name);
+  if (n == 0)
+    return NULL;
+  for (size_t i = 0; i < sizeof(MD_LANGS) / sizeof(MD_LANGS[0]); i++) {
+    const char *p = MD_LANGS[i].names;
+    while (*p) {
+      const char *e = strchr(p, ' ');
+      size_t l = e ? (size_t)(e - p) : strlen(p);
+      if (l == n && strncasecmp(p, name, n) == 0)
+        return &MD_LANGS[i];
+      p += l;
+      while (*p == ' ')
+        p++;
+    }
+  }
+  return NULL;
+}
 
-    if (len >= 3 && line_start[0] == '$' && line_start[1] == ' ') {
-      size_t cmdlen = len - 2;
-      char *cmd = malloc(cmdlen + 1);
-      if (cmd) {
-        memcpy(cmd, line_start + 2, cmdlen);
-        cmd[cmdlen] = '\0';
-        LAST_CMDS[LAST_CMD_COUNT++] = cmd;
+/* ---- Kod renklendirme ---- */
+
+static int md_ident(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_' || (unsigned char)c >= 0x80;
+}
+
+static void md_flush_word(void) {
+  if (MD.word_len == 0)
+    return;
+  const char *style = NULL;
+  if (MD.lang) {
+    if (MD.word[0] >= '0' && MD.word[0] <= '9') {
+      style = MD_STYLE_NUMBER;
+    } else {
+      for (const char *const *k = MD.lang->keywords; *k; k++) {
+        if (strlen(*k) == MD.word_len &&
+            memcmp(*k, MD.word, MD.word_len) == 0) {
+          style = MD_STYLE_KEYWORD;
+          break;
+        }
       }
     }
+  }
+  if (style)
+    md_style(style);
+  sb_append_n(&MD.out, MD.word, MD.word_len);
+  if (style)
+    md_style(COLOR_RESET);
+  MD.word_len = 0;
+}
 
-    if (!line_end)
-      break;
-    p = line_end + 1;
+static void md_code_char(char c);
+
+/* Bekleyen '/' bir yorum başlatmadıysa düz karakter olarak bas */
+static void md_flush_slash(void) {
+  if (MD.slash) {
+    MD.slash = 0;
+    sb_putc(&MD.out, '/');
   }
 }
 
-/* Konuşma geçmişi */
-static void add_turn(const char *user, const char *assistant) {
-  if (!user || !assistant)
+static void md_code_char(char c) {
+  if (c == '\n') {
+    md_flush_word();
+    md_flush_slash();
+    if (MD.hl == HL_STRING || MD.hl == HL_LINE_COMMENT) {
+      MD.hl = HL_NONE;
+      md_style(COLOR_RESET);
+    } else if (MD.hl == HL_BLOCK_COMMENT) {
+      /* Her satır kendi stilini açıp kapatsın */
+      md_style(COLOR_RESET);
+      sb_putc(&MD.out, '\n');
+      md_style(MD_STYLE_COMMENT);
+      return;
+    }
+    sb_putc(&MD.out, '\n');
+    return;
+  }
+  if (!MD.lang) {
+    sb_putc(&MD.out, c);
+    return;
+  }
+  switch (MD.hl) {
+  case HL_STRING:
+    sb_putc(&MD.out, c);
+    if (MD.esc)
+      MD.esc = 0;
+    else if (c == '\\')
+      MD.esc = 1;
+    else if (c == MD.quote) {
+      MD.hl = HL_NONE;
+      md_style(COLOR_RESET);
+    }
     return;
+  case HL_LINE_COMMENT:
+    sb_putc(&MD.out, c);
+    return;
+  case HL_BLOCK_COMMENT:
+    sb_putc(&MD.out, c);
+    if (MD.comment_star && c == '/') {
+      MD.hl = HL_NONE;
+      md_style(COLOR_RESET);
+    }
+    MD.comment_star = c == '*';
+    return;
+  }
 
-  if (TURN_COUNT >= MAX_TURNS) {
-    free(TURNS[0].user);
-    free(TURNS[0].assistant);
-    memmove(&TURNS[0], &TURNS[1], sizeof(Turn) * (MAX_TURNS - 1));
-    TURN_COUNT = MAX_TURNS - 1;
+  if (md_ident(c) && MD.word_len < MD_WORD_MAX) {
+    md_flush_slash();
+    MD.word[MD.word_len++] = c;
+    return;
+  }
+  md_flush_word();
+
+  const char *lc = MD.lang->line_comment;
+  if (lc && lc[0] == '/' && MD.slash) {
+    MD.slash = 0;
+    if (c == '/' || (c == '*' && MD.lang->block_comment)) {
+      MD.hl = c == '/' ? HL_LINE_COMMENT : HL_BLOCK_COMMENT;
+      MD.comment_star = 0;
+      md_style(MD_STYLE_COMMENT);
+      sb_putc(&MD.out, '/');
+      sb_putc(&MD.out, c);
+      return;
+    }
+    sb_putc(&MD.out, '/');
   }
+  if (lc && lc[0] == '/' && c == '/') {
+    MD.slash = 1;
+    return;
+  }
+  if (lc && lc[0] == '#' && c == '#') {
+    MD.hl = HL_LINE_COMMENT;
+    md_style(MD_STYLE_COMMENT);
+    sb_putc(&MD.out, c);
+    return;
+  }
+  if (strchr(MD.lang->quotes, c)) {
+    MD.hl = HL_STRING;
+    MD.quote = c;
+    MD.esc = 0;
+    md_style(MD_STYLE_STRING);
+    sb_putc(&MD.out, c);
+    return;
+  }
+  sb_putc(&MD.out, c);
+}
+
+/* ---- Metin satırı ---- */
 
-  TURNS[TURN_COUNT].user = my_strdup(user);
-  TURNS[TURN_COUNT].assistant = my_strdup(assistant);
-  TURN_COUNT++;
+/* Bekleyen ` dizisi: tek ` satır içi kodu açar/kapatır, daha uzun diziler
+   (``x`` ya da satır ortasındaki ```) olduğu gibi basılır */
+static void md_flush_tick(void) {
+  if (MD.tick == 1) {
+    MD.icode = !MD.icode;
+    md_restyle();
+  } else {
+    for (int i = 0; i < MD.tick; i++)
+      sb_putc(&MD.out, '`');
+  }
+  MD.tick = 0;
 }
 
-static void print_history(void) {
-  if (TURN_COUNT == 0) {
-    printf("%s(henüz geçmiş yok)%s\n", COLOR_INFO, COLOR_RESET);
+static void md_text_char(char c) {
+  if (c != '`' && MD.tick)
+    md_flush_tick();
+  if (c == '\n') {
+    if (MD.star) {
+      MD.star = 0;
+      sb_putc(&MD.out, '*');
+    }
+    if (MD.heading || MD.bold || MD.icode)
+      md_style(COLOR_RESET);
+    MD.heading = MD.bold = MD.icode = 0;
+    sb_putc(&MD.out, '\n');
+    return;
+  }
+  if (!MD.style) {
+    sb_putc(&MD.out, c);
+    return;
+  }
+  if (c == '`') {
+    if (MD.star) {
+      MD.star = 0;
+      sb_putc(&MD.out, '*');
+    }
+    MD.tick++;
+    return;
+  }
+  if (c == '*' && !MD.icode) {
+    if (MD.star) {
+      MD.star = 0;
+      MD.bold = !MD.bold;
+      md_restyle();
+    } else {
+      MD.star = 1;
+    }
     return;
   }
+  if (MD.star) {
+    MD.star = 0;
+    sb_putc(&MD.out, '*');
+  }
+  sb_putc(&MD.out, c);
+}
 
-  for (int i = 0; i < TURN_COUNT; i++) {
-    printf("%s[%d] Ben:%s %s\n", COLOR_USER, i + 1, COLOR_RESET,
-           TURNS[i].user ? TURNS[i].user : "");
-    printf("%s[%d] ChatGPT:%s\n%s\n", COLOR_ASSIST, i + 1, COLOR_RESET,
-           TURNS[i].assistant ? TURNS[i].assistant : "");
-    printf("----\n");
+/* ---- Satır başı sınıflandırması ---- */
+
+enum {
+  LINE_MORE,   /* karar için daha fazla bayt gerekli */
+  LINE_PLAIN,
+  LINE_FENCE,  /* ``` (satırın tamamı gerekli) */
+  LINE_HEADING,
+  LINE_BULLET,
+  LINE_NUMBER,
+  LINE_QUOTE,
+  LINE_CMD
+};
+
+/* marker: işaretin (ve ardındaki boşluğun) bayt uzunluğu */
+static int md_classify(const char *h, size_t n, int complete, size_t *marker) {
+  size_t i = 0;
+  *marker = 0;
+  if (n >= 2 && h[0] == '$' && h[1] == ' ') {
+    *marker = 2;
+    return LINE_CMD;
+  }
+  if (n == 1 && h[0] == '$')
+    return complete ? LINE_PLAIN : LINE_MORE;
+  while (i < n && i < 3 && h[i] == ' ')
+    i++;
+  if (i == n)
+    return complete ? LINE_PLAIN : LINE_MORE;
+  const char *p = h + i;
+  size_t m = n - i;
+
+  if (p[0] == '`') {
+    size_t t = 0;
+    while (t < m && p[t] == '`')
+      t++;
+    if (t >= 3)
+      return complete ? LINE_FENCE : LINE_MORE;
+    return t == m && !complete ? LINE_MORE : LINE_PLAIN;
+  }
+  if (MD.mode == MD_CODE)
+    return LINE_PLAIN;
+
+  if (p[0] == '#') {
+    size_t t = 0;
+    while (t < m && p[t] == '#')
+      t++;
+    if (t == m)
+      return complete || t > 6 ? LINE_PLAIN : LINE_MORE;
+    if (t <= 6 && p[t] == ' ') {
+      *marker = i + t + 1;
+      return LINE_HEADING;
+    }
+    return LINE_PLAIN;
+  }
+  if (p[0] == '-' || p[0] == '*' || p[0] == '+') {
+    if (m == 1)
+      return complete ? LINE_PLAIN : LINE_MORE;
+    if (p[1] == ' ') {
+      *marker = i + 2;
+      return LINE_BULLET;
+    }
+    return LINE_PLAIN;
+  }
+  if (p[0] >= '0' && p[0] <= '9') {
+    size_t t = 0;
+    while (t < m && t < 9 && p[t] >= '0' && p[t] <= '9')
+      t++;
+    if (t == m)
+      return complete ? LINE_PLAIN : LINE_MORE;
+    if (p[t] == '.' || p[t] == ')') {
+      if (t + 1 == m)
+        return complete ? LINE_PLAIN : LINE_MORE;
+      if (p[t + 1] == ' ') {
+        *marker = i + t + 2;
+        return LINE_NUMBER;
+      }
+    }
+    return LINE_PLAIN;
   }
+  if (p[0] == '>') {
+    *marker = i + 1;
+    return LINE_QUOTE;
+  }
+  return LINE_PLAIN;
 }
 
-/* Çok satırlı giriş */
-static char *read_multiline_prompt(void) {
-  printf("%sÇok satırlı moda geçtin. Metni yaz, sadece '.' içeren bir satırla "
-         "bitir.%s\n",
-         COLOR_INFO, COLOR_RESET);
+static void md_byte(char c);
+
+/* Çit satırı (tam satır, varsa sonundaki '\n' dahil) */
+static void md_fence(const char *head, size_t head_len) {
+  const char *p = head;
+  size_t n = head_len;
+  while (n > 0 && (p[n - 1] == '\n' || p[n - 1] == '\r' || p[n - 1] == ' '))
+    n--;
+  size_t i = 0;
+  while (i < n && p[i] == ' ')
+    i++;
+  size_t run = 0;
+  while (i + run < n && p[i + run] == '`')
+    run++;
+  i += run;
+
+  if (MD.mode == MD_CODE) {
+    /* Kapanış çiti en az açılış kadar ` ve boşluktan oluşur */
+    if (run < MD.fence_len || i < n) {
+      for (size_t k = 0; k < head_len; k++)
+        md_code_char(head[k]);
+      return;
+    }
+    md_flush_word();
+    if (MD.hl != HL_NONE)
+      md_style(COLOR_RESET);
+    MD.hl = HL_NONE;
+    MdSpan *blk = md_span(MD_SPAN_BLOCK, MD.block_start, MD.head_off, MD.lang_name);
+    if (blk)
+      blk->cmds = MD.block_cmds;
+    MD.mode = MD_TEXT;
+  } else {
+    size_t l = 0;
+    while (i < n && p[i] == ' ')
+      i++;
+    while (i + l < n && p[i + l] != ' ' && l < sizeof(MD.lang_name) - 1)
+      l++;
+    memcpy(MD.lang_name, p + i, l);
+    MD.lang_name[l] = '\0';
+    MD.lang = md_find_lang(MD.lang_name);
+    MD.fence_len = run;
+    MD.block_start = MD.head_off + head_len;
+    MD.block_cmds = 0;
+    MD.hl = HL_NONE;
+    MD.mode = MD_CODE;
+  }
+  int nl = head[head_len - 1] == '\n';
+  md_style(MD_STYLE_FENCE);
+  sb_append_n(&MD.out, head, head_len - (size_t)nl);
+  md_style(COLOR_RESET);
+  if (nl)
+    sb_putc(&MD.out, '\n');
+}
 
-  size_t cap = 1024;
-  size_t len = 0;
-  char *buf = malloc(cap);
-  if (!buf) {
-    printf("%sBellek hatası.%s\n", COLOR_ERROR, COLOR_RESET);
-    return NULL;
+/* Satır başı kararı verildi: işareti bas, kalan baytları normal işle */
+static void md_resolve(int kind, size_t marker) {
+  char head[MD_HEAD_MAX];
+  size_t n = MD.head_len;
+  memcpy(head, MD.head, n);
+  MD.head_len = 0;
+  MD.line_start = 0;
+
+  if (kind == LINE_FENCE) {
+    md_fence(head, n);
+    MD.line_start = 1;
+    return;
+  }
+  if (kind == LINE_CMD) {
+    MD.in_cmd = 1;
+    MD.cmd_start = MD.head_off + marker;
+    if (MD.mode == MD_CODE)
+      MD.block_cmds++;
   }
-  buf[0] = '\0';
 
-  while (1) {
-    char line[4096];
-    if (!fgets(line, sizeof(line), stdin)) {
+  size_t rest = 0;
+  if (MD.mode == MD_TEXT && MD.style) {
+    switch (kind) {
+    case LINE_HEADING:
+      MD.heading = 1;
+      md_restyle();
+      rest = marker;
+      break;
+    case LINE_BULLET: {
+      size_t indent = 0;
+      while (head[indent] == ' ')
+        indent++;
+      sb_append_n(&MD.out, head, indent);
+      md_style(MD_STYLE_BULLET);
+      sb_append(&MD.out, "• ");
+      md_style(COLOR_RESET);
+      rest = marker;
       break;
     }
-    trim(line);
-    if (strcmp(line, ".") == 0) {
+    case LINE_NUMBER:
+    case LINE_QUOTE:
+    case LINE_CMD:
+      md_style(MD_STYLE_BULLET);
+      sb_append_n(&MD.out, head, marker);
+      md_style(COLOR_RESET);
+      rest = marker;
       break;
     }
-    size_t l = strlen(line);
-    if (len + l + 2 >= cap) {
-      cap *= 2;
-      char *tmp = realloc(buf, cap);
-      if (!tmp) {
-        free(buf);
-        printf("%sBellek hatası.%s\n", COLOR_ERROR, COLOR_RESET);
-        return NULL;
-      }
-      buf = tmp;
+  }
+  for (size_t k = rest; k < n; k++)
+    md_byte(head[k]);
+}
+
+static void md_byte(char c) {
+  if (MD.line_start) {
+    if (MD.head_len == 0)
+      MD.head_off = MD.off;
+    MD.head[MD.head_len++] = c;
+    size_t marker;
+    int complete = c == '\n';
+    int kind = md_classify(MD.head, MD.head_len, complete, &marker);
+    if (kind == LINE_FENCE && !complete && MD.head_len < MD_HEAD_MAX)
+      return; /* çit satırının sonunu bekle */
+    if (kind == LINE_MORE && MD.head_len < MD_HEAD_MAX)
+      return;
+    if (kind == LINE_MORE || (kind == LINE_FENCE && !complete))
+      kind = LINE_PLAIN;
+    md_resolve(kind, marker);
+    return;
+  }
+
+  if (c == '\n') {
+    if (MD.in_cmd) {
+      size_t end = MD.off;
+      if (end > MD.cmd_start)
+        md_span(MD_SPAN_CMD, MD.cmd_start, end, NULL);
+      MD.in_cmd = 0;
     }
-    memcpy(buf + len, line, l);
-    len += l;
-    buf[len++] = '\n';
-    buf[len] = '\0';
+    MD.line_start = 1;
   }
+  if (MD.mode == MD_CODE)
+    md_code_char(c);
+  else
+    md_text_char(c);
+}
 
-  if (len == 0) {
-    free(buf);
-    printf("%sBoş çok satırlı giriş.%s\n", COLOR_INFO, COLOR_RESET);
-    return NULL;
+static void md_begin(void) {
+  out_init();
+  StrBuf out = MD.out;
+  MdSpan *spans = MD.spans;
+  size_t cap = MD.span_cap;
+  memset(&MD, 0, sizeof(MD));
+  MD.out = out;
+  if (!MD.out.data)
+    sb_init(&MD.out);
+  MD.out.len = 0;
+  MD.spans = spans;
+  MD.span_cap = cap;
+  MD.line_start = 1;
+  const char *env = getenv("CHATGPT_MARKDOWN");
+  MD.style = OUT.tty && !(env && strcmp(env, "0") == 0);
+}
+
+static void md_feed(const char *text, size_t len) {
+  MD.out.len = 0;
+  for (size_t i = 0; i < len; i++) {
+    md_byte(text[i]);
+    MD.off++;
   }
+  if (MD.out.len)
+    out_append(MD.out.data, MD.out.len);
+}
 
-  return buf;
+/* Akış bitti: bekleyen satır başı, kelime ve stilleri boşalt. Birden
+   fazla kez çağrılabilir. */
+static void md_end(void) {
+  MD.out.len = 0;
+  if (MD.line_start && MD.head_len > 0) {
+    size_t marker;
+    int kind = md_classify(MD.head, MD.head_len, 1, &marker);
+    if (kind == LINE_MORE)
+      kind = LINE_PLAIN;
+    md_resolve(kind, marker);
+  }
+  md_flush_word();
+  md_flush_slash();
+  md_flush_tick();
+  if (MD.star) {
+    MD.star = 0;
+    sb_putc(&MD.out, '*');
+  }
+  if (MD.in_cmd) {
+    if (MD.off > MD.cmd_start)
+      md_span(MD_SPAN_CMD, MD.cmd_start, MD.off, NULL);
+    MD.in_cmd = 0;
+  }
+  if (MD.mode == MD_CODE) {
+    /* Kapanmamış blok cevabın sonuna kadar sayılır */
+    MdSpan *blk = md_span(MD_SPAN_BLOCK, MD.block_start, MD.off, MD.lang_name);
+    if (blk)
+      blk->cmds = MD.block_cmds;
+    MD.mode = MD_TEXT;
+  }
+  if (MD.heading || MD.bold || MD.icode || MD.hl != HL_NONE)
+    md_style(COLOR_RESET);
+  MD.heading = MD.bold = MD.icode = 0;
+  MD.hl = HL_NONE;
+  if (MD.out.len)
+    out_append(MD.out.data, MD.out.len);
 }
 
-/* Argümanları birleştirme */
-static char *join_args_from(int start, int argc, char **argv) {
-  size_t total = 0;
-  for (int i = start; i < argc; i++) {
-    total += strlen(argv[i]) + 1;
+/* Başarılı cevabın aralıklarını /run, /save N ve /blocks için sakla */
+static void md_commit(void) {
+  free(LAST_SPANS);
+  LAST_SPANS = NULL;
+  LAST_SPAN_COUNT = 0;
+  if (MD.span_count == 0)
+    return;
+  LAST_SPANS = malloc(MD.span_count * sizeof(MdSpan));
+  if (!LAST_SPANS)
+    return;
+  memcpy(LAST_SPANS, MD.spans, MD.span_count * sizeof(MdSpan));
+  LAST_SPAN_COUNT = MD.span_count;
+}
+
+static void md_free(void) {
+  sb_free(&MD.out);
+  free(MD.spans);
+  MD.spans = NULL;
+  MD.span_count = MD.span_cap = 0;
+  free(LAST_SPANS);
+  LAST_SPANS = NULL;
+  LAST_SPAN_COUNT = 0;
+}
+
+/* ===== Streaming (SSE) ayrıştırıcı =====
+   Ağdan gelen byte'ları parçalar arasında kaldığı yerden devam eden bir durum
+   makinesiyle tek geçişte işler. Sadece o an işlenen olayın `data:` yükü
+   tutulur (olay bitince sıfırlanır, kapasite yeniden kullanılır); çözülen
+   metin doğrudan cevap tamponuna ve terminale gider. Böylece bellek kablodaki
+   toplam veriyle değil cevabın kendisiyle orantılı kalır. */
+
+typedef struct {
+  StrBuf text; /* Çözülmüş cevap metni */
+  int discard; /* metin tutulmaz: her delta basılınca tampon sıfırlanır */
+  size_t seen; /* çözülen toplam bayt (discard'da text boş kalır) */
+  char last;   /* son çözülen bayt */
+  long prompt_tokens;
+  long completion_tokens;
+  long total_tokens;
+  long cached_tokens; /* prompt_tokens_details.cached_tokens */
+  char finish_reason[32];
+} Reply;
+
+enum {
+  SSE_LINE_START, /* satır başı: alan adı ya da boş satır bekleniyor */
+  SSE_FIELD,      /* "data:" ile eşleştiriliyor */
+  SSE_DATA_SPACE, /* "data:" sonrası isteğe bağlı tek boşluk */
+  SSE_DATA,       /* data yükü satır sonuna kadar */
+  SSE_SKIP        /* ilgilenmediğimiz satır (event:, id:, yorum) */
+};
+
+typedef struct {
+  int state;
+  size_t matched; /* "data:" önekinden eşleşen karakter sayısı */
+  StrBuf event;   /* mevcut olayın data yükü */
+  int done;       /* [DONE] görüldü */
+  int echo;       /* deltaları terminale bas */
+  Reply *reply;
+  CURL *easy;  /* HTTP durum kodunu okumak için (isteğe bağlı) */
+  long status; /* 0: henüz bilinmiyor */
+  StrBuf err;  /* 2xx dışı cevapların gövdesi (sınırlı) */
+  double t_first_token; /* monoton; 0 = henüz içerik gelmedi */
+  double t_last_token;
+  Hdr gaps; /* token arası boşluklar (µs) */
+} SseParser;
+
+#define SSE_ERR_MAX 8192
+
+static void sse_init(SseParser *sp, Reply *reply) {
+  memset(sp, 0, sizeof(*sp));
+  sp->state = SSE_LINE_START;
+  sp->echo = 1;
+  sp->reply = reply;
+  sb_init(&sp->event);
+  sb_init(&sp->err);
+}
+
+static void sse_free(SseParser *sp) {
+  sb_free(&sp->event);
+  sb_free(&sp->err);
+}
+
+static void reply_init(Reply *r) {
+  memset(r, 0, sizeof(*r));
+  sb_init(&r->text);
+}
+
+/* --output=ndjson olayları. Delta içeriği kablodaki kaçırılmış haliyle
+   (json_string_span aralığı) aynen kopyalanır: çözülüp yeniden
+   kaçırılmaz, arada metin birleştirilmez. Her olay tek satırdır. */
+static void ndjson_delta(const char *esc, size_t len) {
+  static const char head[] = "{\"type\":\"delta\",\"content\":\"";
+  out_append(head, sizeof(head) - 1);
+  out_append(esc, len);
+  out_append("\"}\n", 3);
+}
+
+static void ndjson_finish(const char *reason) {
+  char line[96];
+  int n = snprintf(line, sizeof(line),
+                   "{\"type\":\"finish\",\"reason\":\"%s\"}\n", reason);
+  out_append(line, (size_t)n);
+}
+
+static void ndjson_usage(const Reply *r) {
+  char line[160];
+  int n = snprintf(line, sizeof(line),
+                   "{\"type\":\"usage\",\"prompt_tokens\":%ld,"
+                   "\"completion_tokens\":%ld,\"total_tokens\":%ld}\n",
+                   r->prompt_tokens, r->completion_tokens, r->total_tokens);
+  out_append(line, (size_t)n);
+}
+
+static int NDJSON_SUMMARY_SENT = 0;
+
+/* Son olay: başarı/hata, model, bitiş nedeni, kullanım ve ölçümler
+   (ms; ölçülmeyenler null). r/t NULL olabilir (istek gönderilmedi). */
+static void ndjson_summary(const char *model, const Reply *r, const Timing *t,
+                           int cached, long status, const char *error) {
+  StrBuf sb;
+  sb_init(&sb);
+  char num[224];
+  sb_append(&sb, "{\"type\":\"summary\",\"ok\":");
+  sb_append(&sb, error ? "false" : "true");
+  sb_append(&sb, ",\"model\":\"");
+  json_escape_append(&sb, model, strlen(model));
+  sb_append(&sb, "\"");
+  snprintf(num, sizeof(num), ",\"cached\":%s,\"status\":%ld",
+           cached ? "true" : "false", status);
+  sb_append(&sb, num);
+  if (r) {
+    sb_append(&sb, ",\"finish_reason\":");
+    if (r->finish_reason[0]) {
+      sb_append(&sb, "\"");
+      json_escape_append(&sb, r->finish_reason, strlen(r->finish_reason));
+      sb_append(&sb, "\"");
+    } else {
+      sb_append(&sb, "null");
+    }
+    snprintf(num, sizeof(num),
+             ",\"usage\":{\"prompt_tokens\":%ld,\"completion_tokens\":%ld,"
+             "\"total_tokens\":%ld}",
+             r->prompt_tokens, r->completion_tokens, r->total_tokens);
+    sb_append(&sb, num);
   }
-  char *out = malloc(total + 1);
-  if (!out)
-    return NULL;
-  out[0] = '\0';
-  for (int i = start; i < argc; i++) {
-    strcat(out, argv[i]);
-    if (i != argc - 1)
-      strcat(out, " ");
+  if (t) {
+    const int64_t v[] = {t->dns,  t->connect, t->tls,     t->ttfb,
+                         t->ttft, t->total,   t->gap_p50, t->gap_p99};
+    static const char *const k[] = {"dns",   "connect", "tls",     "ttfb",
+                                    "ttft",  "total",   "itl_p50", "itl_p99"};
+    sb_append(&sb, ",\"timing_ms\":{");
+    for (size_t i = 0; i < sizeof(v) / sizeof(v[0]); i++) {
+      if (v[i] < 0)
+        snprintf(num, sizeof(num), "%s\"%s\":null", i ? "," : "", k[i]);
+      else
+        snprintf(num, sizeof(num), "%s\"%s\":%.3f", i ? "," : "", k[i],
+                 (double)v[i] / 1000);
+      sb_append(&sb, num);
+    }
+    snprintf(num, sizeof(num), ",\"tokens_per_sec\":%.1f,\"reused\":%s}",
+             t->tokens_per_sec, t->reused ? "true" : "false");
+    sb_append(&sb, num);
   }
-  return out;
+  if (error) {
+    sb_append(&sb, ",\"error\":\"");
+    json_escape_append(&sb, error, strlen(error));
+    sb_append(&sb, "\"");
+  }
+  sb_append(&sb, "}\n");
+  if (sb.data)
+    out_append(sb.data, sb.len);
+  out_flush();
+  sb_free(&sb);
+  NDJSON_SUMMARY_SENT = 1;
 }
 
-/* CLI yardım ve model listesi */
-static void print_usage(const char *progname) {
-  fprintf(
-      stdout,
-      "Kullanim: %s [seçenekler] [\"tek seferlik soru...\"]\n\n"
-      "Seçenekler:\n"
-      "  -m, --model ADI            Bu istek için model seç\n"
+/* Çözülmüş cevap parçalarının tek çıkış noktası (ağdan ya da önbellekten) */
+static void emit_delta(const char *text, size_t len) {
+  if (OUTPUT_MODE == OUTPUT_NDJSON) {
+    /* Önbellekten gelen metin çözülmüş durur: bir kez kaçırılır */
+    StrBuf esc;
+    sb_init(&esc);
+    json_escape_append(&esc, text, len);
+    if (esc.data)
+      ndjson_delta(esc.data, esc.len);
+    sb_free(&esc);
+  } else if (PLAIN_OUTPUT) {
+    out_append(text, len);
+  } else {
+    md_feed(text, len);
+  }
+}
+
+static void emit_usage(const Reply *r) {
+  if (OUTPUT_MODE == OUTPUT_NDJSON) {
+    ndjson_usage(r);
+    return;
+  }
+  if (PLAIN_OUTPUT)
+    return; /* boruya sadece cevap metni gider */
+  md_end();
+  out_flush();
+  printf("\n%s[Usage: %ld tokens]%s", COLOR_INFO, r->total_tokens,
+         COLOR_RESET);
+}
+
+/* Bir olayın JSON yükünü işler: delta metni, finish_reason ve usage */
+static void sse_dispatch(SseParser *sp) {
+  const char *p = sp->event.data;
+  size_t n = sp->event.len;
+  sp->event.len = 0;
+  if (!p || n == 0)
+    return;
+  if (n >= 6 && memcmp(p, "[DONE]", 6) == 0) {
+    sp->done = 1;
+    return;
+  }
+
+  const char *end = p + n;
+  Reply *r = sp->reply;
+  const char *v;
+
+  if (json_obj_get(p, end, "choices", &v)) {
+    const char *choice = json_arr_first(v, end);
+    const char *delta, *content, *fr;
+    const char *s, *e;
+    if (choice && json_obj_get(choice, end, "delta", &delta) &&
+        json_obj_get(delta, end, "content", &content) &&
+        json_string_span(content, end, &s, &e)) {
+      size_t before = r->text.len;
+      size_t got;
+      if (r->discard && OUTPUT_MODE == OUTPUT_NDJSON) {
+        got = (size_t)(e - s); /* metin gerekmiyor: çözülmez bile */
+      } else {
+        json_unescape_append(&r->text, s, e);
+        got = r->text.len - before;
+      }
+      if (got > 0) {
+        r->seen += got;
+        if (r->text.len > before)
+          r->last = r->text.data[r->text.len - 1];
+        double now = mono_now();
+        if (sp->t_first_token == 0)
+          sp->t_first_token = now;
+        else
+          hdr_record(&sp->gaps, (int64_t)((now - sp->t_last_token) * 1e6));
+        sp->t_last_token = now;
+        if (sp->echo && OUTPUT_MODE == OUTPUT_NDJSON)
+          ndjson_delta(s, (size_t)(e - s));
+        else if (sp->echo)
+          emit_delta(r->text.data + before, r->text.len - before);
+        if (r->discard) {
+          r->text.len = before;
+          r->text.data[before] = '\0';
+        }
+      }
+    }
+    if (choice && json_obj_get(choice, end, "finish_reason", &fr) &&
+        json_string_span(fr, end, &s, &e)) {
+      size_t l = (size_t)(e - s);
+      if (l >= sizeof(r->finish_reason))
+        l = sizeof(r->finish_reason) - 1;
+      memcpy(r->finish_reason, s, l);
+      r->finish_reason[l] = '\0';
+      if (sp->echo && OUTPUT_MODE == OUTPUT_NDJSON)
+        ndjson_finish(r->finish_reason);
+    }
+  }
+
+  if (json_obj_get(p, end, "usage", &v) && v < end && *v == '{') {
+    r->prompt_tokens = json_get_long(v, end, "prompt_tokens");
+    r->completion_tokens = json_get_long(v, end, "completion_tokens");
+    r->total_tokens = json_get_long(v, end, "total_tokens");
+    const char *d;
+    if (json_obj_get(v, end, "prompt_tokens_details", &d))
+      r->cached_tokens = json_get_long(d, end, "cached_tokens");
+    if (sp->echo)
+      emit_usage(r);
+  }
+}
+
+static void sse_feed(SseParser *sp, const char *buf, size_t len) {
+  static const char prefix[] = "data:";
+  const char *p = buf;
+  const char *end = buf + len;
+
+  while (p < end) {
+    switch (sp->state) {
+    case SSE_LINE_START:
+      if (*p == '\n') {
+        sse_dispatch(sp); /* boş satır: olay tamamlandı */
+        p++;
+      } else if (*p == '\r') {
+        p++;
+      } else {
+        sp->matched = 0;
+        sp->state = SSE_FIELD;
+      }
+      break;
+    case SSE_FIELD:
+      if (*p == prefix[sp->matched]) {
+        p++;
+        if (++sp->matched == sizeof(prefix) - 1) {
+          /* Aynı olayda birden fazla data satırı '\n' ile birleşir */
+          if (sp->event.len > 0)
+            sb_putc(&sp->event, '\n');
+          sp->state = SSE_DATA_SPACE;
+        }
+      } else {
+        sp->state = SSE_SKIP;
+      }
+      break;
+    case SSE_DATA_SPACE:
+      if (*p == ' ')
+        p++;
+      sp->state = SSE_DATA;
+      break;
+    case SSE_DATA: {
+      const char *nl = memchr(p, '\n', (size_t)(end - p));
+      const char *stop = nl ? nl : end;
+      const char *data_end = stop;
+      if (nl && data_end > p && data_end[-1] == '\r')
+        data_end--;
+      sb_append_n(&sp->event, p, (size_t)(data_end - p));
+      p = stop;
+      if (nl) {
+        p++;
+        sp->state = SSE_LINE_START;
+      }
+      break;
+    }
+    case SSE_SKIP: {
+      const char *nl = memchr(p, '\n', (size_t)(end - p));
+      if (!nl) {
+        p = end;
+      } else {
+        p = nl + 1;
+        sp->state = SSE_LINE_START;
+      }
+      break;
+    }
+    }
+  }
+}
+
+/* Akış bitti: boş satırla kapanmamış son olayı da işle. Bu sırada
+   üretilen metin/NDJSON olayları tamponda kalmasın diye çıktı boşaltılır. */
+static void sse_finish(SseParser *sp) {
+  if (sp->event.len > 0)
+    sse_dispatch(sp);
+  out_flush();
+}
+
+static size_t stream_callback(void *contents, size_t size, size_t nmemb,
+                              void *userp) {
+  size_t realsize = size * nmemb;
+  SseParser *sp = (SseParser *)userp;
+  if (sp->easy && sp->status == 0)
+    curl_easy_getinfo(sp->easy, CURLINFO_RESPONSE_CODE, &sp->status);
+  if (sp->status >= 300) {
+    /* Hata gövdesi SSE değil, düz JSON: mesajı göstermek için sakla */
+    size_t room = SSE_ERR_MAX - sp->err.len;
+    sb_append_n(&sp->err, (const char *)contents,
+                realsize < room ? realsize : room);
+    return realsize;
+  }
+  sse_feed(sp, (const char *)contents, realsize);
+  return realsize;
+}
+
+/* {"error":{"message":"..."}} gövdesinden okunabilir mesajı çıkarır */
+static void sse_error_message(const SseParser *sp, StrBuf *out) {
+  const char *p = sp->err.data;
+  const char *end = p + sp->err.len;
+  const char *v, *m, *s, *e;
+  if (sp->err.len > 0 && json_obj_get(p, end, "error", &v) &&
+      json_obj_get(v, end, "message", &m) && json_string_span(m, end, &s, &e))
+    json_unescape_append(out, s, e);
+  else if (sp->status >= 300)
+    sb_append(out, "HTTP hatası");
+}
+
+static void ledger_append(const char *model, long status, int64_t ttft_us,
+                          int64_t total_us, long prompt_tokens,
+                          long completion_tokens, long cached_tokens);
+
+/* Biten isteğin ölçümlerini toplar, model istatistiklerine ve izleme
+   dosyasına ekler. t_start: istek başlamadan hemen önceki monoton zaman. */
+static void latency_finish(const char *model, CURL *h, const SseParser *sp,
+                           double t_start, long status, Timing *t) {
+  const Reply *r = sp->reply;
+  timing_from_curl(h, t);
+  t->ttft = sp->t_first_token > 0
+                ? (int64_t)((sp->t_first_token - t_start) * 1e6)
+                : -1;
+  t->gap_p50 = hdr_percentile(&sp->gaps, 0.5);
+  t->gap_p99 = hdr_percentile(&sp->gaps, 0.99);
+  t->gap_max = hdr_percentile(&sp->gaps, 1.0);
+  double gen = sp->t_last_token - sp->t_first_token;
+  t->tokens_per_sec =
+      gen > 0 && r->completion_tokens > 1
+          ? (double)(r->completion_tokens - 1) / gen
+          : 0;
+
+  if (status >= 200 && status < 300 && t->ttft >= 0) {
+    ModelStats *m = lat_model(model);
+    if (m) {
+      m->requests++;
+      hdr_record(&m->ttft, t->ttft);
+      hdr_record(&m->total, t->total);
+      hdr_merge(&m->gap, &sp->gaps);
+      if (gen > 0 && r->completion_tokens > 1) {
+        m->tokens += (double)(r->completion_tokens - 1);
+        m->gen_secs += gen;
+      }
+    }
+  }
+  trace_write(model, status, t, r->prompt_tokens, r->completion_tokens);
+  ledger_append(model, status, t->ttft, t->total, r->prompt_tokens,
+                r->completion_tokens, r->cached_tokens);
+}
+
+/* ===== Ayarlar =====
+   ~/.config/chatgpt-cli-c altındaki ayar dosyaları (config, model, lang,
+   system_prompt) açılışta bir kez okunup CFG'de tutulur; dizin yolu da bir
+   kez hesaplanır. Sistem mesajı JSON'a kaçırılmış hazır bir parça olarak
+   saklanır, her istekte diskten okunup yeniden kaçırılmaz. Etkileşimli
+   modda dizin Linux'ta inotify ile izlenir; değişiklik her tur başında
+   tek bir bloklamayan read() ile fark edilip ilgili dosya yeniden okunur.
+   inotify yoksa dosyalar en fazla CONFIG_STAT_INTERVAL saniyede bir
+   stat'lanır. */
+
+enum { CFG_KEY, CFG_MODEL, CFG_LANG, CFG_SYSTEM, CFG_FILES };
+
+static const char *const CFG_NAMES[CFG_FILES] = {"config", "model", "lang",
+                                                 "system_prompt"};
+
+#define CONFIG_STAT_INTERVAL 2
+
+typedef struct {
+  char dir[1024];
+  char *val[CFG_FILES]; /* kırpılmış içerik; NULL = yok ya da boş */
+  StrBuf sys_frag;      /* {"role":"system","content":"..."}, */
+  int sys_frag_en;      /* sys_frag hangi dilin varsayılanıyla kuruldu */
+  int sys_frag_ok;
+  size_t sys_tokens;       /* sistem mesajının token sayısı ... */
+  char sys_tokens_enc[32]; /* ... bu kodlama ve BPE durumu için */
+  int sys_tokens_state;
+  int watch_fd; /* inotify; -1 = stat ile yoklama */
+  time_t last_check;
+  struct timespec mtime[CFG_FILES];
+} Config;
+
+static Config CFG = {.watch_fd = -1};
+
+static const char *config_dir(void) {
+  if (!CFG.dir[0]) {
+    const char *home = getenv("HOME");
+    snprintf(CFG.dir, sizeof(CFG.dir), "%s/.config/chatgpt-cli-c",
+             home ? home : ".");
+  }
+  return CFG.dir;
+}
+
+/* Ayar dizinindeki bir dosyanın tam yolu (serbest bırakılmalı) */
+static char *config_path(const char *name) {
+  const char *dir = config_dir();
+  size_t len = strlen(dir) + 1 + strlen(name) + 1;
+  char *path = malloc(len);
+  if (path)
+    snprintf(path, len, "%s/%s", dir, name);
+  return path;
+}
+
+static void config_read(int i) {
+  free(CFG.val[i]);
+  CFG.val[i] = NULL;
+  char *path = config_path(CFG_NAMES[i]);
+  if (!path)
+    return;
+  struct stat st;
+  if (stat(path, &st) == 0)
+    CFG.mtime[i] = st.st_mtim;
+  else
+    memset(&CFG.mtime[i], 0, sizeof(CFG.mtime[i]));
+  char *content = read_file(path);
+  free(path);
+  if (content) {
+    trim(content);
+    if (content[0] == '\0') {
+      free(content);
+      content = NULL;
+    }
+  }
+  CFG.val[i] = content;
+  if (i == CFG_SYSTEM)
+    CFG.sys_frag_ok = 0;
+}
+
+static void config_load(void) {
+  for (int i = 0; i < CFG_FILES; i++)
+    config_read(i);
+}
+
+static void config_free(void) {
+  for (int i = 0; i < CFG_FILES; i++) {
+    free(CFG.val[i]);
+    CFG.val[i] = NULL;
+  }
+  sb_free(&CFG.sys_frag);
+  CFG.sys_frag_ok = 0;
+  if (CFG.watch_fd >= 0)
+    close(CFG.watch_fd);
+  CFG.watch_fd = -1;
+}
+
+/* Sistem mesajı. Öncelik: Config > Hardcoded (dile göre) */
+static const char *config_system_prompt(void) {
+  if (CFG.val[CFG_SYSTEM])
+    return CFG.val[CFG_SYSTEM];
+  if (CURRENT_LANG && strcmp(CURRENT_LANG, "en") == 0)
+    return "You are a helpful assistant accessed from a Linux terminal.";
+  return "Sen Linux terminalinden erişilen yardımcı bir asistansın. Türkçe "
+         "konuş.";
+}
+
+/* Hazır kaçırılmış sistem mesajı parçası; sadece sistem mesajı dosyası ya
+   da (varsayılan kullanılıyorsa) dil değişince yeniden kurulur. */
+static const StrBuf *config_sys_frag(void) {
+  int en = CURRENT_LANG && strcmp(CURRENT_LANG, "en") == 0;
+  if (CFG.sys_frag_ok && (CFG.val[CFG_SYSTEM] || CFG.sys_frag_en == en))
+    return &CFG.sys_frag;
+  const char *text = config_system_prompt();
+  sb_free(&CFG.sys_frag);
+  sb_init(&CFG.sys_frag);
+  sb_append(&CFG.sys_frag, "{\"role\":\"system\",\"content\":\"");
+  json_escape_append(&CFG.sys_frag, text, strlen(text));
+  sb_append(&CFG.sys_frag, "\"},");
+  CFG.sys_frag_en = en;
+  CFG.sys_frag_ok = CFG.sys_frag.data != NULL;
+  CFG.sys_tokens_enc[0] = '\0'; /* token sayısı yeniden hesaplansın */
+  return &CFG.sys_frag;
+}
+
+/* Etkileşimli mod için dizini izlemeye başlar */
+static void config_watch(void) {
+#ifdef __linux__
+  if (CFG.watch_fd >= 0)
+    return;
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0)
+    return;
+  if (inotify_add_watch(fd, config_dir(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE |
+                            IN_MOVED_FROM) < 0) {
+    close(fd);
+    return;
+  }
+  CFG.watch_fd = fd;
+#endif
+}
+
+static int config_index(const char *name) {
+  for (int i = 0; i < CFG_FILES; i++)
+    if (strcmp(name, CFG_NAMES[i]) == 0)
+      return i;
+  return -1;
+}
+
+/* Değişen ayar dosyalarını yeniden okur; değişenlerin bit maskesini döner
+   (1 << CFG_MODEL gibi). */
+static unsigned config_poll(void) {
+  unsigned changed = 0;
+#ifdef __linux__
+  if (CFG.watch_fd >= 0) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(CFG.watch_fd, buf, sizeof(buf))) > 0) {
+      for (char *p = buf; p < buf + n;) {
+        struct inotify_event *ev = (struct inotify_event *)p;
+        int i = ev->len ? config_index(ev->name) : -1;
+        if (i >= 0)
+          changed |= 1u << i;
+        p += sizeof(struct inotify_event) + ev->len;
+      }
+    }
+  } else
+#endif
+  {
+    time_t now = time(NULL);
+    if (now - CFG.last_check < CONFIG_STAT_INTERVAL)
+      return 0;
+    CFG.last_check = now;
+    for (int i = 0; i < CFG_FILES; i++) {
+      char *path = config_path(CFG_NAMES[i]);
+      struct stat st;
+      struct timespec m = {0, 0};
+      if (path && stat(path, &st) == 0)
+        m = st.st_mtim;
+      free(path);
+      if (m.tv_sec != CFG.mtime[i].tv_sec || m.tv_nsec != CFG.mtime[i].tv_nsec)
+        changed |= 1u << i;
+    }
+  }
+  for (int i = 0; i < CFG_FILES; i++) {
+    if (!(changed & (1u << i)))
+      continue;
+    config_read(i);
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Ayar yeniden yüklendi: %s", CFG_NAMES[i]);
+    log_msg(msg);
+  }
+  return changed;
+}
+
+/* Ayar dizinine bir dosya yazar ve CFG'yi günceller */
+static int config_write(int i, const char *value) {
+  if (mkdir(config_dir(), 0700) != 0 && errno != EEXIST) {
+    perror("mkdir");
+    log_msg("Config dizini oluşturulamadı.");
+    return -1;
+  }
+  char *path = config_path(CFG_NAMES[i]);
+  if (!path)
+    return -1;
+  int res = write_file(path, value);
+  if (res == 0)
+    chmod(path, 0600);
+  free(path);
+  if (res == 0)
+    config_read(i);
+  return res;
+}
+
+/* API key yükleme */
+static char *load_api_key(void) {
+  const char *env_key = getenv("OPENAI_API_KEY");
+  if (env_key && env_key[0] != '\0') {
+    log_msg("API anahtarı OPENAI_API_KEY ortam değişkeninden yüklendi.");
+    return my_strdup(env_key);
+  }
+
+  if (CFG.val[CFG_KEY]) {
+    log_msg("API anahtarı config dosyasından yüklendi.");
+    return my_strdup(CFG.val[CFG_KEY]);
+  }
+
+  log_msg("Config dosyası yok veya boş. İlk kurulum.");
+  printf("OpenAI API anahtarını gir (sadece ilk sefer): ");
+  fflush(stdout);
+
+  char buf[512];
+  if (!fgets(buf, sizeof(buf), stdin)) {
+    log_msg("API anahtarı okunamadı.");
+    return NULL;
+  }
+  trim(buf);
+  if (buf[0] == '\0') {
+    log_msg("Boş API anahtarı girildi.");
+    return NULL;
+  }
+
+  if (config_write(CFG_KEY, buf) != 0) {
+    log_msg("Config dosyasına yazılamadı.");
+    return NULL;
+  }
+
+  log_msg("API anahtarı config dosyasına kaydedildi "
+          "(~/.config/chatgpt-cli-c/config).");
+  return my_strdup(buf);
+}
+
+/* Komut listesi yönetimi */
+static void clear_last_cmds(void) {
+  for (int i = 0; i < LAST_CMD_COUNT; i++) {
+    free(LAST_CMDS[i]);
+    LAST_CMDS[i] = NULL;
+  }
+  LAST_CMD_COUNT = 0;
+}
+
+/* Önerilen komutlar: akış sırasında kaydedilen "$ " satırları ve içinde
+   "$ " satırı olmayan kabuk bloklarının tamamı (cevap yeniden taranmaz) */
+static void md_commands(const char *answer) {
+  clear_last_cmds();
+  if (!answer)
+    return;
+  size_t len = strlen(answer);
+  const MdLang *shell = &MD_LANGS[0];
+  for (size_t i = 0; i < LAST_SPAN_COUNT && LAST_CMD_COUNT < MAX_CMDS; i++) {
+    const MdSpan *sp = &LAST_SPANS[i];
+    if (sp->end > len || sp->end <= sp->start)
+      continue;
+    if (sp->kind == MD_SPAN_BLOCK &&
+        (sp->cmds > 0 || md_find_lang(sp->lang) != shell))
+      continue;
+    size_t n = sp->end - sp->start;
+    while (n > 0 && (answer[sp->start + n - 1] == '\n' ||
+                     answer[sp->start + n - 1] == '\r'))
+      n--;
+    if (n == 0)
+      continue;
+    char *cmd = malloc(n + 1);
+    if (cmd) {
+      memcpy(cmd, answer + sp->start, n);
+      cmd[n] = '\0';
+      LAST_CMDS[LAST_CMD_COUNT++] = cmd;
+    }
+  }
+}
+
+/* N. kod bloğunu (1'den) bulur */
+static const MdSpan *md_block(int n) {
+  for (size_t i = 0; i < LAST_SPAN_COUNT; i++)
+    if (LAST_SPANS[i].kind == MD_SPAN_BLOCK && --n == 0)
+      return &LAST_SPANS[i];
+  return NULL;
+}
+
+static void print_blocks(const char *answer) {
+  int n = 0;
+  size_t len = answer ? strlen(answer) : 0;
+  for (size_t i = 0; i < LAST_SPAN_COUNT; i++) {
+    const MdSpan *sp = &LAST_SPANS[i];
+    if (sp->kind != MD_SPAN_BLOCK || sp->end > len)
+      continue;
+    size_t lines = 0;
+    const char *first = answer + sp->start;
+    const char *nl = memchr(first, '\n', sp->end - sp->start);
+    for (const char *p = first; p < answer + sp->end; p++)
+      lines += *p == '\n';
+    int flen = (int)((nl ? nl : answer + sp->end) - first);
+    printf("  [%d] %s%s%s (%zu satır) %s%.*s%s\n", ++n, COLOR_CMD,
+           sp->lang[0] ? sp->lang : "metin", COLOR_RESET, lines, COLOR_INFO,
+           flen > 60 ? 60 : flen, first, COLOR_RESET);
+  }
+  if (n == 0)
+    printf("%s(son cevapta kod bloğu yok)%s\n", COLOR_INFO, COLOR_RESET);
+}
+
+/* ===== Kullanım defteri =====
+   Her API isteğinin model, token (girdi/önbellekli girdi/çıktı), gecikme
+   ve zaman bilgisi ~/.config/chatgpt-cli-c/usage.ledger dosyasına sabit
+   genişlikte (64 bayt) ikili kayıt olarak eklenir. Kayıt tek bir O_APPEND
+   write() ile yazılır; eşzamanlı süreçler ve sıkıştırma thread'i
+   birbirini bozmaz. CHATGPT_LEDGER=0 kapatır, başka bir değer dosya
+   yoludur. --usage dosyayı eşleyip tek geçişte toplar: kayıtlar zaman
+   sırasıyla eklendiğinden --since sınırı ikili aramayla bulunur, gerisi
+   her biri tek önbellek satırı olan kayıtlar üzerinde düz bir döngüdür. */
+
+#define LEDGER_MAGIC 0x314c4743u /* "CGL1" */
+#define LEDGER_MODELS 64         /* --by-model'de ayrı tutulan model sayısı */
+#define LEDGER_NO_TIME UINT32_MAX
+
+typedef struct {
+  uint32_t magic;
+  uint32_t rec_size;
+  int64_t created; /* unix zamanı, ms */
+} LedgerHeader;
+
+typedef struct {
+  int64_t ts; /* unix zamanı, ms */
+  uint32_t prompt_tokens;
+  uint32_t completion_tokens;
+  uint32_t cached_tokens;
+  uint32_t ttft_us; /* LEDGER_NO_TIME = ölçülmedi */
+  uint32_t total_us;
+  uint16_t status;
+  uint16_t reserved;
+  char model[32]; /* sığmazsa kesilir; NUL ile doldurulur */
+} LedgerRec;
+
+_Static_assert(sizeof(LedgerRec) == 64, "LedgerRec 64 bayt olmalı");
+
+/* Serbest bırakılmalı; kapalıysa NULL */
+static char *ledger_path(void) {
+  const char *env = getenv("CHATGPT_LEDGER");
+  if (env && strcmp(env, "0") == 0)
+    return NULL;
+  if (env && env[0])
+    return my_strdup(env);
+  return config_path("usage.ledger");
+}
+
+static uint32_t ledger_u32(long long v) {
+  return v < 0 ? 0 : v > (long long)UINT32_MAX ? UINT32_MAX : (uint32_t)v;
+}
+
+static void ledger_append(const char *model, long status, int64_t ttft_us,
+                          int64_t total_us, long prompt_tokens,
+                          long completion_tokens, long cached_tokens) {
+  char *path = ledger_path();
+  if (!path)
+    return;
+  int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0 && errno == ENOENT && !getenv("CHATGPT_LEDGER")) {
+    mkdir(config_dir(), 0700);
+    fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  }
+  free(path);
+  if (fd < 0)
+    return;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  int64_t now = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+  /* Yeni dosyaya başlık: ikinci süreç kilidi alınca boyutu yeniden görür */
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size == 0) {
+    flock(fd, LOCK_EX);
+    if (fstat(fd, &st) == 0 && st.st_size == 0) {
+      LedgerHeader h = {LEDGER_MAGIC, sizeof(LedgerRec), now};
+      if (write(fd, &h, sizeof(h)) != (ssize_t)sizeof(h))
+        log_msg("Kullanım defterine yazılamadı.");
+    }
+    flock(fd, LOCK_UN);
+  }
+
+  LedgerRec rec;
+  memset(&rec, 0, sizeof(rec));
+  rec.ts = now;
+  rec.prompt_tokens = ledger_u32(prompt_tokens);
+  rec.completion_tokens = ledger_u32(completion_tokens);
+  rec.cached_tokens = ledger_u32(cached_tokens);
+  rec.ttft_us = ttft_us < 0 ? LEDGER_NO_TIME : ledger_u32(ttft_us);
+  rec.total_us = ledger_u32(total_us);
+  rec.status = (uint16_t)(status < 0 || status > 65535 ? 0 : status);
+  strncpy(rec.model, model, sizeof(rec.model) - 1);
+  if (write(fd, &rec, sizeof(rec)) != (ssize_t)sizeof(rec))
+    log_msg("Kullanım defterine yazılamadı.");
+  close(fd);
+}
+
+/* Liste fiyatları, 1M token başına USD (girdi, önbellekli girdi, çıktı).
+   Tahmin içindir; uzun önek önce gelmeli. */
+static const struct {
+  const char *prefix;
+  double in, cached, out;
+} LEDGER_PRICES[] = {
+    {"gpt-4o-mini", 0.15, 0.075, 0.60}, {"gpt-4o", 2.50, 1.25, 10.00},
+    {"gpt-4.1-nano", 0.10, 0.025, 0.40}, {"gpt-4.1-mini", 0.40, 0.10, 1.60},
+    {"gpt-4.1", 2.00, 0.50, 8.00},       {"o3-mini", 1.10, 0.55, 4.40},
+    {"o4-mini", 1.10, 0.275, 4.40},      {"o3", 2.00, 0.50, 8.00},
+};
+
+typedef struct {
+  char model[33];
+  uint64_t requests, errors;
+  uint64_t prompt, cached, completion;
+  uint64_t ttft_sum, ttft_n, total_sum;
+} LedgerSum;
+
+static void ledger_add(LedgerSum *s, const LedgerRec *r) {
+  s->requests++;
+  s->errors += r->status < 200 || r->status >= 300;
+  s->prompt += r->prompt_tokens;
+  s->cached += r->cached_tokens;
+  s->completion += r->completion_tokens;
+  s->total_sum += r->total_us;
+  if (r->ttft_us != LEDGER_NO_TIME) {
+    s->ttft_sum += r->ttft_us;
+    s->ttft_n++;
+  }
+}
+
+/* Tahmini maliyet; fiyatı bilinmeyen modelde -1 */
+static double ledger_cost(const LedgerSum *s) {
+  for (size_t i = 0; i < sizeof(LEDGER_PRICES) / sizeof(LEDGER_PRICES[0]);
+       i++) {
+    const char *p = LEDGER_PRICES[i].prefix;
+    if (strncmp(s->model, p, strlen(p)) != 0)
+      continue;
+    uint64_t fresh = s->prompt > s->cached ? s->prompt - s->cached : 0;
+    return ((double)fresh * LEDGER_PRICES[i].in +
+            (double)s->cached * LEDGER_PRICES[i].cached +
+            (double)s->completion * LEDGER_PRICES[i].out) /
+           1e6;
+  }
+  return -1;
+}
+
+static void ledger_print_row(const LedgerSum *s, const char *label) {
+  char ttft[16], cost[24];
+  if (s->ttft_n)
+    fmt_us(ttft, sizeof(ttft), (int64_t)(s->ttft_sum / s->ttft_n));
+  else
+    snprintf(ttft, sizeof(ttft), "-");
+  double c = ledger_cost(s);
+  if (c >= 0)
+    snprintf(cost, sizeof(cost), "%.4f", c);
+  else
+    snprintf(cost, sizeof(cost), "-");
+  printf("  %-24s %8llu %6llu %12llu %12llu %12llu %10s %10s\n", label,
+         (unsigned long long)s->requests, (unsigned long long)s->errors,
+         (unsigned long long)s->prompt, (unsigned long long)s->cached,
+         (unsigned long long)s->completion, ttft, cost);
+}
+
+/* "2025-01-31" (yerel gece yarısı) ya da "7d", "12h", "2w" (şimdiden
+   geriye); unix ms döner, geçersizse -1 */
+static int64_t ledger_parse_since(const char *s) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  const char *end = strptime(s, "%Y-%m-%d", &tm);
+  if (end && !*end) {
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    return t == (time_t)-1 ? -1 : (int64_t)t * 1000;
+  }
+  char *unit;
+  long n = strtol(s, &unit, 10);
+  long mult = !strcmp(unit, "h")   ? 3600
+              : !strcmp(unit, "d") ? 86400
+              : !strcmp(unit, "w") ? 7 * 86400
+                                   : 0;
+  if (n <= 0 || unit == s || !mult)
+    return -1;
+  return ((int64_t)time(NULL) - (int64_t)n * mult) * 1000;
+}
+
+static int run_usage(const char *since, int by_model) {
+  int64_t from = 0;
+  if (since && (from = ledger_parse_since(since)) < 0) {
+    fprintf(stderr,
+            "Hata: --since YYYY-AA-GG ya da 7d/12h/2w biçiminde olmalı.\n");
+    return 1;
+  }
+  char *path = ledger_path();
+  if (!path) {
+    printf("Kullanım defteri kapalı (CHATGPT_LEDGER=0).\n");
+    return 0;
+  }
+  double t0 = mono_now();
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 ||
+      st.st_size < (off_t)sizeof(LedgerHeader)) {
+    printf("Henüz kayıt yok (%s).\n", path);
+    if (fd >= 0)
+      close(fd);
+    free(path);
+    return 0;
+  }
+  const char *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  const LedgerHeader *h = (const LedgerHeader *)m;
+  if (m == MAP_FAILED || h->magic != LEDGER_MAGIC ||
+      h->rec_size != sizeof(LedgerRec)) {
+    fprintf(stderr, "%s[!] Kullanım defteri okunamadı: %s%s\n", COLOR_ERROR,
+            path, COLOR_RESET);
+    if (m != MAP_FAILED)
+      munmap((void *)m, (size_t)st.st_size);
+    free(path);
+    return 1;
+  }
+  free(path);
+  madvise((void *)m, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+  /* Yarım kalmış son kayıt (varsa) sayılmaz */
+  const LedgerRec *rec = (const LedgerRec *)(m + sizeof(LedgerHeader));
+  size_t n = ((size_t)st.st_size - sizeof(LedgerHeader)) / sizeof(LedgerRec);
+
+  /* İlk ts >= from kaydı. Saat geri alınırsa sadece sınır bulanıklaşır. */
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (rec[mid].ts < from)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  /* Maliyet model başına hesaplandığından modeller hep ayrı toplanır;
+     --by-model sadece satırlarını basar */
+  LedgerSum total;
+  memset(&total, 0, sizeof(total));
+  LedgerSum *models = calloc(LEDGER_MODELS + 1, sizeof(LedgerSum));
+  size_t model_count = 0, cur = 0;
+  for (size_t i = lo; i < n; i++) {
+    const LedgerRec *r = &rec[i];
+    ledger_add(&total, r);
+    if (!models)
+      continue;
+    /* Ardışık kayıtlar çoğunlukla aynı modeldir: son eşleşme önce */
+    if (cur >= model_count ||
+        strncmp(models[cur].model, r->model, sizeof(r->model)) != 0) {
+      size_t k = 0;
+      while (k < model_count &&
+             strncmp(models[k].model, r->model, sizeof(r->model)) != 0)
+        k++;
+      if (k == model_count && model_count < LEDGER_MODELS)
+        memcpy(models[model_count++].model, r->model, sizeof(r->model));
+      else if (k == model_count)
+        k = LEDGER_MODELS; /* taşanlar "(diğer)" satırında */
+      cur = k;
+    }
+    ledger_add(&models[cur], r);
+  }
+  size_t rows = n - lo;
+  munmap((void *)m, (size_t)st.st_size);
+  double scan_ms = (mono_now() - t0) * 1000;
+
+  /* İ, Ö, Ç, ı iki bayt: başlık genişlikleri o kadar fazla */
+  printf("%s  %-24s %9s %6s %12s %13s %14s %11s %10s%s\n", COLOR_INFO,
+         "Model", "İstek", "Hata", "Girdi", "Önbellekli", "Çıktı",
+         "İlk token", "Tahmini $", COLOR_RESET);
+  /* Fiyatı bilinmeyen modeller toplamı boşaltmaz: bilinenler toplanır,
+     eksik kalan toplam "≥" ile gösterilir */
+  double cost = 0;
+  size_t priced = 0, unpriced = 0;
+  for (size_t k = 0; models && k <= LEDGER_MODELS; k++) {
+    if (!models[k].requests)
+      continue;
+    if (by_model)
+      ledger_print_row(&models[k],
+                       k == LEDGER_MODELS ? "(diğer)" : models[k].model);
+    double c = ledger_cost(&models[k]);
+    if (c < 0) {
+      unpriced++;
+    } else {
+      cost += c;
+      priced++;
+    }
+  }
+  char ttft[16] = "-", usd[24] = "-";
+  int usd_width = 10;
+  if (total.ttft_n)
+    fmt_us(ttft, sizeof(ttft), (int64_t)(total.ttft_sum / total.ttft_n));
+  if (priced && unpriced) {
+    snprintf(usd, sizeof(usd), "≥%.4f", cost);
+    usd_width += 2; /* "≥" üç bayt, tek sütun */
+  } else if (priced) {
+    snprintf(usd, sizeof(usd), "%.4f", cost);
+  }
+  printf("  %-24s %8llu %6llu %12llu %12llu %12llu %10s %*s\n", "Toplam",
+         (unsigned long long)total.requests, (unsigned long long)total.errors,
+         (unsigned long long)total.prompt, (unsigned long long)total.cached,
+         (unsigned long long)total.completion, ttft, usd_width, usd);
+  if (priced && unpriced)
+    printf("  ≥ Fiyatı bilinmeyen %zu model toplama dahil değil.\n",
+           unpriced);
+  fflush(stdout);
+  fprintf(stderr, "%s[%zu kayıt %.1f ms'de tarandı]%s\n", COLOR_INFO, rows,
+          scan_ms, COLOR_RESET);
+  free(models);
+  return 0;
+}
+
+/* ===== Token sayımı (BPE) =====
+   tiktoken biçimindeki sözlük ("<base64 token> <rank>" satırları) yerel
+   dosyadan bir kez yüklenir: ~/.config/chatgpt-cli-c/<kodlama>.tiktoken
+   (CHATGPT_VOCAB ile ezilebilir). Metin önce cl100k/o200k düzenine yakın bir
+   ön bölücüyle parçalara ayrılır, her parça sıralı birleştirme (rank merge)
+   ile token'lara indirgenir. Sözlük yoksa byte/4 tahmini kullanılır. */
+
+#define BPE_MSG_OVERHEAD 4 /* mesaj başına rol/ayraç token'ları */
+#define BPE_MAX_PIECE 512  /* daha uzun parçalar pencerelere bölünür */
+
+typedef struct {
+  uint32_t off; /* blob içindeki konum */
+  uint32_t len; /* 0 = boş yuva */
+  uint32_t rank;
+} BpeEntry;
+
+typedef struct {
+  char encoding[32];
+  int state; /* 0: yüklenmedi, 1: yüklü, -1: sözlük yok (tahmin) */
+  unsigned char *blob;
+  size_t blob_len;
+  BpeEntry *slots;
+  size_t mask;
+} Bpe;
+
+static Bpe BPE;
+
+static uint32_t bpe_hash(const unsigned char *p, size_t n) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < n; i++) {
+    h ^= p[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static uint32_t bpe_rank(const unsigned char *p, size_t n) {
+  if (!BPE.slots)
+    return UINT32_MAX;
+  size_t i = bpe_hash(p, n) & BPE.mask;
+  while (BPE.slots[i].len) {
+    const BpeEntry *e = &BPE.slots[i];
+    if (e->len == n && memcmp(BPE.blob + e->off, p, n) == 0)
+      return e->rank;
+    i = (i + 1) & BPE.mask;
+  }
+  return UINT32_MAX;
+}
+
+static int b64_val(int c) {
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if (c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if (c == '+')
+    return 62;
+  if (c == '/')
+    return 63;
+  return -1;
+}
+
+static size_t b64_decode(const char *s, size_t n, unsigned char *out) {
+  uint32_t acc = 0;
+  int bits = 0;
+  size_t o = 0;
+  for (size_t i = 0; i < n; i++) {
+    int v = b64_val((unsigned char)s[i]);
+    if (v < 0)
+      continue; /* '=' dolgusu */
+    acc = (acc << 6) | (uint32_t)v;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      out[o++] = (unsigned char)(acc >> bits);
+    }
+  }
+  return o;
+}
+
+/* gpt-4o, gpt-4.1 ve o-serisi o200k; eski gpt-4 / 3.5 cl100k kullanır */
+static const char *bpe_encoding_for(const char *model) {
+  if (!strncmp(model, "gpt-4o", 6) || !strncmp(model, "gpt-4.1", 7) ||
+      !strncmp(model, "gpt-5", 5) || model[0] == 'o')
+    return "o200k_base";
+  return "cl100k_base";
+}
+
+static char *get_vocab_path(const char *encoding) {
+  const char *env_path = getenv("CHATGPT_VOCAB");
+  if (env_path && env_path[0] != '\0')
+    return my_strdup(env_path);
+  char name[64];
+  snprintf(name, sizeof(name), "%s.tiktoken", encoding);
+  return config_path(name);
+}
+
+static void bpe_unload(void) {
+  free(BPE.blob);
+  free(BPE.slots);
+  memset(&BPE, 0, sizeof(BPE));
+}
+
+static int bpe_load(const char *path) {
+  char *text = read_file(path);
+  if (!text)
+    return -1;
+
+  size_t lines = 0;
+  size_t text_len = strlen(text);
+  for (const char *c = text; (c = strchr(c, '\n')); c++)
+    lines++;
+
+  size_t slot_count = 1;
+  while (slot_count < (lines + 1) * 2)
+    slot_count <<= 1;
+  /* base64 çözülünce en fazla 3/4 boyuta iner */
+  BPE.blob = malloc(text_len / 4 * 3 + 4);
+  BPE.slots = calloc(slot_count, sizeof(BpeEntry));
+  if (!BPE.blob || !BPE.slots) {
+    free(text);
+    bpe_unload();
+    return -1;
+  }
+  BPE.mask = slot_count - 1;
+
+  char *line = text;
+  while (*line) {
+    char *nl = strchr(line, '\n');
+    char *sp = memchr(line, ' ', nl ? (size_t)(nl - line) : strlen(line));
+    if (sp) {
+      unsigned char *dst = BPE.blob + BPE.blob_len;
+      size_t n = b64_decode(line, (size_t)(sp - line), dst);
+      uint32_t rank = (uint32_t)strtoul(sp + 1, NULL, 10);
+      if (n > 0) {
+        size_t i = bpe_hash(dst, n) & BPE.mask;
+        while (BPE.slots[i].len)
+          i = (i + 1) & BPE.mask;
+        BPE.slots[i].off = (uint32_t)BPE.blob_len;
+        BPE.slots[i].len = (uint32_t)n;
+        BPE.slots[i].rank = rank;
+        BPE.blob_len += n;
+      }
+    }
+    if (!nl)
+      break;
+    line = nl + 1;
+  }
+  free(text);
+  return 0;
+}
+
+/* Model için doğru sözlüğü hazırlar (gerekirse yükler) */
+static void bpe_select(const char *model) {
+  const char *enc = bpe_encoding_for(model);
+  if (BPE.state != 0 && strcmp(BPE.encoding, enc) == 0)
+    return;
+  bpe_unload();
+  snprintf(BPE.encoding, sizeof(BPE.encoding), "%s", enc);
+
+  char *path = get_vocab_path(enc);
+  if (path && bpe_load(path) == 0) {
+    BPE.state = 1;
+  } else {
+    BPE.state = -1;
+    log_msg("Token sözlüğü bulunamadı; token sayıları tahminidir "
+            "(~/.config/chatgpt-cli-c/<kodlama>.tiktoken).");
+  }
+  free(path);
+}
+
+/* Tek bir ön-parçanın token sayısı: en düşük rank'li komşu çift
+   birleştirilerek ilerlenir (tiktoken'ın byte_pair_merge'i). */
+static size_t bpe_piece_tokens(const unsigned char *p, size_t n) {
+  if (n <= 1 || bpe_rank(p, n) != UINT32_MAX)
+    return n ? 1 : 0;
+  if (n > BPE_MAX_PIECE) {
+    size_t total = 0;
+    for (size_t off = 0; off < n; off += BPE_MAX_PIECE)
+      total += bpe_piece_tokens(
+          p + off, n - off > BPE_MAX_PIECE ? BPE_MAX_PIECE : n - off);
+    return total;
+  }
+
+  /* starts[i]: i. parçanın başlangıcı; ranks[i]: i ve i+1 birleşiminin rank'i */
+  size_t starts[BPE_MAX_PIECE + 1];
+  uint32_t ranks[BPE_MAX_PIECE];
+  size_t parts = n;
+  for (size_t i = 0; i <= n; i++)
+    starts[i] = i;
+  for (size_t i = 0; i + 1 < parts; i++)
+    ranks[i] = bpe_rank(p + starts[i], starts[i + 2] - starts[i]);
+
+  while (parts > 1) {
+    uint32_t best = UINT32_MAX;
+    size_t bi = 0;
+    for (size_t i = 0; i + 1 < parts; i++) {
+      if (ranks[i] < best) {
+        best = ranks[i];
+        bi = i;
+      }
+    }
+    if (best == UINT32_MAX)
+      break;
+    /* bi ile bi+1'i birleştir */
+    memmove(&starts[bi + 1], &starts[bi + 2],
+            (parts - bi - 1) * sizeof(size_t));
+    memmove(&ranks[bi], &ranks[bi + 1], (parts - bi - 2) * sizeof(uint32_t));
+    parts--;
+    if (bi + 1 < parts)
+      ranks[bi] = bpe_rank(p + starts[bi], starts[bi + 2] - starts[bi]);
+    if (bi > 0)
+      ranks[bi - 1] =
+          bpe_rank(p + starts[bi - 1], starts[bi + 1] - starts[bi - 1]);
+  }
+  return parts;
+}
+
+enum { CC_LETTER, CC_DIGIT, CC_SPACE, CC_NEWLINE, CC_OTHER, CC_END };
+
+/* UTF-8 karakter sınıfı. ASCII dışı her şey harf sayılır (yaklaşık). */
+static int bpe_class(const unsigned char *p, const unsigned char *end,
+                     size_t *clen) {
+  if (p >= end) {
+    *clen = 0;
+    return CC_END;
+  }
+  unsigned char c = *p;
+  *clen = 1;
+  if (c >= 0x80) {
+    size_t l = (c >> 5) == 6 ? 2 : (c >> 4) == 14 ? 3 : (c >> 3) == 30 ? 4 : 1;
+    *clen = l <= (size_t)(end - p) ? l : (size_t)(end - p);
+    return CC_LETTER;
+  }
+  if ((c | 0x20) >= 'a' && (c | 0x20) <= 'z')
+    return CC_LETTER;
+  if (c >= '0' && c <= '9')
+    return CC_DIGIT;
+  if (c == '\n' || c == '\r')
+    return CC_NEWLINE;
+  if (c == ' ' || c == '\t' || c == '\v' || c == '\f')
+    return CC_SPACE;
+  return CC_OTHER;
+}
+
+static const unsigned char *bpe_skip_class(const unsigned char *p,
+                                           const unsigned char *end, int cls) {
+  size_t l;
+  while (p < end && bpe_class(p, end, &l) == cls)
+    p += l;
+  return p;
+}
+
+/* Ön bölücü: 's 't 're.. | ?harfler | 1-3 rakam | ?noktalama\n* | boşluk */
+static const unsigned char *bpe_next_piece(const unsigned char *p,
+                                           const unsigned char *end) {
+  size_t l, l2;
+  int cls = bpe_class(p, end, &l);
+
+  if (*p == '\'' && end - p >= 2) {
+    int a = p[1] | 0x20, b = end - p >= 3 ? (p[2] | 0x20) : 0;
+    if ((a == 'r' && b == 'e') || (a == 'v' && b == 'e') ||
+        (a == 'l' && b == 'l'))
+      return p + 3;
+    if (a == 's' || a == 't' || a == 'm' || a == 'd')
+      return p + 2;
+  }
+
+  if ((cls == CC_SPACE || cls == CC_OTHER) &&
+      bpe_class(p + l, end, &l2) == CC_LETTER)
+    return bpe_skip_class(p + l, end, CC_LETTER);
+  if (cls == CC_LETTER)
+    return bpe_skip_class(p, end, CC_LETTER);
+
+  if (cls == CC_DIGIT) {
+    const unsigned char *q = p;
+    while (q < end && q - p < 3 && *q >= '0' && *q <= '9')
+      q++;
+    return q;
+  }
+
+  const unsigned char *q = p;
+  if (*q == ' ' && bpe_class(q + 1, end, &l2) == CC_OTHER)
+    q++;
+  if (bpe_class(q, end, &l2) == CC_OTHER) {
+    q = bpe_skip_class(q, end, CC_OTHER);
+    return bpe_skip_class(q, end, CC_NEWLINE);
+  }
+
+  /* Boşluk dizisi: son satır sonuna kadar; yoksa sonraki kelimeye bir
+     boşluk bırakılır */
+  const unsigned char *ws = p;
+  const unsigned char *last_nl = NULL;
+  while (ws < end && (*ws == ' ' || *ws == '\t' || *ws == '\n' ||
+                      *ws == '\r' || *ws == '\v' || *ws == '\f')) {
+    if (*ws == '\n' || *ws == '\r')
+      last_nl = ws;
+    ws++;
+  }
+  if (last_nl)
+    return last_nl + 1;
+  if (ws < end && ws - p > 1)
+    return ws - 1;
+  return ws > p ? ws : p + l;
+}
+
+static size_t count_tokens(const char *s, size_t n) {
+  if (BPE.state != 1)
+    return (n + 3) / 4;
+  const unsigned char *p = (const unsigned char *)s;
+  const unsigned char *end = p + n;
+  size_t total = 0;
+  while (p < end) {
+    const unsigned char *q = bpe_next_piece(p, end);
+    total += bpe_piece_tokens(p, (size_t)(q - p));
+    p = q;
+  }
+  return total;
+}
+
+/* Modelin bağlam penceresinden cevap payı düşülmüş istek bütçesi.
+   CHATGPT_TOKEN_BUDGET ile ezilebilir. */
+#define BPE_REPLY_RESERVE 4096
+
+static size_t model_token_budget(const char *model) {
+  const char *env_budget = getenv("CHATGPT_TOKEN_BUDGET");
+  if (env_budget && env_budget[0] != '\0')
+    return (size_t)strtoul(env_budget, NULL, 10);
+
+  size_t window = 128000;
+  if (!strncmp(model, "gpt-4.1", 7))
+    window = 1047576;
+  else if (!strncmp(model, "gpt-4o", 6) || !strncmp(model, "gpt-4-turbo", 11))
+    window = 128000;
+  else if (!strncmp(model, "gpt-4", 5))
+    window = 8192;
+  else if (!strncmp(model, "gpt-3.5", 7))
+    window = 16385;
+  else if (model[0] == 'o')
+    window = 200000;
+  return window > BPE_REPLY_RESERVE * 2 ? window - BPE_REPLY_RESERVE
+                                        : window / 2;
+}
+
+/* Konuşma geçmişi
+   Turlar büyüyebilen bir halka tamponda (ring buffer) tutulur; metinleri
+   blok blok ayrılan bir arenaya yazılır. Her blok içindeki canlı tur
+   sayısını bilir, sayı sıfıra inince blok tek seferde bırakılır. Böylece en
+   eski turu atmak O(1), /clear ise toplu serbest bırakmadır; uzun
+   oturumlarda küçük malloc/free parçalanması oluşmaz. */
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/* Boş bir bloğu listeden çıkarır. Son boşalan normal boyutlu blok bir
+   sonraki tahsis için saklanır, diğerleri serbest bırakılır. */
+static void arena_unlink(Arena *a, ArenaBlock *b) {
+  if (b->prev)
+    b->prev->next = b->next;
+  else
+    a->head = b->next;
+  if (b->next)
+    b->next->prev = b->prev;
+  else
+    a->tail = b->prev;
+  if (!a->spare && b->cap == ARENA_BLOCK_SIZE) {
+    a->spare = b;
+  } else {
+    free(b);
+  }
+}
+
+static void *arena_alloc(Arena *a, size_t size, ArenaBlock **out_block) {
+  ArenaBlock *b = a->tail;
+  /* Boş kuyruk blok isteği karşılamıyorsa arkasına yenisi eklenmez; önce
+     listeden çıkarılır ki canlı turu olmayan bloklar birikmesin. */
+  if (b && b->refs == 0 && b->cap < size) {
+    arena_unlink(a, b);
+    b = a->tail;
+  }
+  if (!b || b->cap - b->used < size) {
+    size_t cap = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    if (a->spare && a->spare->cap >= cap) {
+      b = a->spare;
+      a->spare = NULL;
+    } else {
+      b = malloc(sizeof(ArenaBlock) + cap);
+      if (!b)
+        return NULL;
+      b->cap = cap;
+    }
+    b->used = 0;
+    b->refs = 0;
+    b->next = NULL;
+    b->prev = a->tail;
+    if (a->tail)
+      a->tail->next = b;
+    else
+      a->head = b;
+    a->tail = b;
+  }
+  void *p = b->data + b->used;
+  b->used += size;
+  b->refs++;
+  *out_block = b;
+  return p;
+}
+
+/* Bloktaki bir referansı bırakır; boşalan blok listeden çıkarılır. Kuyruk
+   blok boşalınca yerinde kalır ve sıradaki tahsiste yeniden kullanılır. */
+static void arena_release(Arena *a, ArenaBlock *b) {
+  if (!b || --b->refs > 0)
+    return;
+  if (b == a->tail) {
+    b->used = 0;
+    return;
+  }
+  arena_unlink(a, b);
+}
+
+static void arena_reset(Arena *a) {
+  ArenaBlock *b = a->head;
+  while (b) {
+    ArenaBlock *next = b->next;
+    free(b);
+    b = next;
+  }
+  free(a->spare);
+  memset(a, 0, sizeof(*a));
+}
+
+static Turn *hist_at(size_t i) {
+  return &HIST.ring[(HIST.head + i) % HIST.cap];
+}
+
+static void hist_pop_front(void) {
+  if (HIST.count == 0)
+    return;
+  Turn *t = hist_at(0);
+  arena_release(&HIST.arena, t->block);
+  memset(t, 0, sizeof(*t));
+  HIST.head = (HIST.head + 1) % HIST.cap;
+  HIST.count--;
+}
+
+static int hist_grow(void) {
+  size_t cap = HIST.cap ? HIST.cap * 2 : 16;
+  Turn *ring = malloc(cap * sizeof(Turn));
+  if (!ring)
+    return -1;
+  for (size_t i = 0; i < HIST.count; i++)
+    ring[i] = *hist_at(i);
+  free(HIST.ring);
+  HIST.ring = ring;
+  HIST.cap = cap;
+  HIST.head = 0;
+  return 0;
+}
+
+static void clear_history(void) {
+  arena_reset(&HIST.arena);
+  if (HIST.map) {
+    munmap(HIST.map, HIST.map_len);
+    HIST.map = NULL;
+    HIST.map_len = 0;
+  }
+  HIST.head = 0;
+  HIST.count = 0;
+}
+
+static void free_history(void) {
+  clear_history();
+  free(HIST.ring);
+  HIST.ring = NULL;
+  HIST.cap = 0;
+}
+
+/* Tur sınırı: CHATGPT_MAX_TURNS (0 = sınırsız), yoksa MAX_TURNS */
+static void hist_configure(void) {
+  HIST.max_turns = MAX_TURNS;
+  const char *env_max = getenv("CHATGPT_MAX_TURNS");
+  if (env_max && env_max[0] != '\0')
+    HIST.max_turns = (size_t)strtoul(env_max, NULL, 10);
+}
+
+/* Sona eklenecek tur için yer açar (gerekirse en eskiyi atar). Dönen yuva
+   HIST.count artırılana kadar geçmişe dahil değildir. */
+static Turn *hist_slot(void) {
+  if (HIST.max_turns > 0 && HIST.count >= HIST.max_turns)
+    hist_pop_front();
+  if (HIST.count == HIST.cap && hist_grow() != 0)
+    return NULL;
+  Turn *t = &HIST.ring[(HIST.head + HIST.count) % HIST.cap];
+  memset(t, 0, sizeof(*t));
+  t->id = ++HIST.next_id;
+  return t;
+}
+
+static void journal_append_turn(const Turn *t);
+
+/* Turun mesaj parçası bir kez, eklendiği anda kaçırılır; sonraki her istekte
+   gövdeye olduğu gibi eklenir. Metinler ve parça tek bir arena tahsisinde
+   yan yana durur. */
+static int turn_build(Turn *t, const char *user, const char *assistant) {
+  static const char f1[] = "{\"role\":\"user\",\"content\":\"";
+  static const char f2[] = "\"},{\"role\":\"assistant\",\"content\":\"";
+  static const char f3[] = "\"},";
+
+  size_t ulen = strlen(user);
+  size_t alen = strlen(assistant);
+  size_t frag_len = (sizeof(f1) - 1) + json_escaped_len(user, ulen) +
+                    (sizeof(f2) - 1) + json_escaped_len(assistant, alen) +
+                    (sizeof(f3) - 1);
+
+  ArenaBlock *block;
+  char *mem = arena_alloc(&HIST.arena, ulen + 1 + alen + 1 + frag_len + 1,
+                          &block);
+  if (!mem)
+    return -1;
+
+  t->block = block;
+  t->user = mem;
+  t->user_len = ulen;
+  memcpy(mem, user, ulen + 1);
+  mem += ulen + 1;
+
+  t->assistant = mem;
+  t->assistant_len = alen;
+  memcpy(mem, assistant, alen + 1);
+  mem += alen + 1;
+
+  char *f = mem;
+  memcpy(f, f1, sizeof(f1) - 1);
+  f += sizeof(f1) - 1;
+  f += json_escape_to(f, user, ulen);
+  memcpy(f, f2, sizeof(f2) - 1);
+  f += sizeof(f2) - 1;
+  f += json_escape_to(f, assistant, alen);
+  memcpy(f, f3, sizeof(f3) - 1);
+  f += sizeof(f3) - 1;
+  *f = '\0';
+  t->frag = mem;
+  t->frag_len = frag_len;
+  t->tokens = count_tokens(user, ulen) + count_tokens(assistant, alen) +
+              2 * BPE_MSG_OVERHEAD;
+  return 0;
+}
+
+static void add_turn(const char *user, const char *assistant) {
+  if (!user || !assistant)
+    return;
+  Turn *t = hist_slot();
+  if (!t || turn_build(t, user, assistant) != 0)
+    return;
+  HIST.count++;
+  journal_append_turn(t);
+}
+
+static void print_history(void) {
+  if (HIST.count == 0) {
+    printf("%s(henüz geçmiş yok)%s\n", COLOR_INFO, COLOR_RESET);
+    return;
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; i < HIST.count; i++) {
+    const Turn *t = hist_at(i);
+    printf("%s[%zu] Ben:%s %s\n", COLOR_USER, i + 1, COLOR_RESET, t->user);
+    printf("%s[%zu] ChatGPT:%s\n%s\n", COLOR_ASSIST, i + 1, COLOR_RESET,
+           t->assistant);
+    printf("---- %s(%zu token)%s\n", COLOR_INFO, t->tokens, COLOR_RESET);
+    total += t->tokens;
+  }
+  printf("%sToplam: %zu tur, %zu token%s\n", COLOR_INFO, HIST.count, total,
+         COLOR_RESET);
+}
+
+/* ===== Oturum günlüğü =====
+   Her tur ~/.config/chatgpt-cli-c/sessions/<ad>.journal dosyasına uzunluk
+   önekli bir kayıt olarak eklenir; <ad>.idx her kaydın ofsetini (u64) tutar.
+   Tur yükü bellekteki düzenle aynıdır (user\0 assistant\0 frag\0), bu yüzden
+   /load günlüğü mmap'ler ve turları doğrudan eşleme işaret ettirir: metin
+   ayrıştırılmaz, sayfalar ancak erişildiğinde diskten okunur. ZSTD=1 ile
+   derlenirse büyük turlar zstd bloğu olarak sıkıştırılır. */
+
+#define JOURNAL_MAGIC 0x314A4743u /* "CGJ1" */
+#define JOURNAL_REC_TURN 1
+#define JOURNAL_REC_CLEAR 2
+#define JOURNAL_FLAG_ZSTD 1
+#define JOURNAL_ZSTD_MIN 4096 /* bundan küçük turlar sıkıştırılmaz */
+#define JOURNAL_PAD(n) (((n) + 7u) & ~(size_t)7u)
+
+typedef struct {
+  uint32_t magic;
+  uint8_t type;
+  uint8_t flags;
+  uint16_t reserved;
+  uint32_t len;     /* diskteki yük uzunluğu */
+  uint32_t raw_len; /* açılmış yük uzunluğu */
+} JournalRec;
+
+typedef struct {
+  uint32_t user_len;
+  uint32_t assistant_len;
+  uint32_t frag_len;
+  uint32_t tokens;
+  uint32_t flags;
+  uint32_t reserved;
+} JournalTurn;
+
+typedef struct {
+  char name[64];
+  int fd;     /* .journal (O_APPEND) */
+  int idx_fd; /* .idx */
+  uint64_t size;
+} Journal;
+
+static Journal JOURNAL = {"", -1, -1, 0};
+
+static char *get_sessions_dir(void) { return config_path("sessions"); }
+
+/* Oturum adı dosya adı olarak kullanılır: sadece [A-Za-z0-9._-] */
+static int session_name_ok(const char *name) {
+  if (!name || !name[0] || name[0] == '.' || strlen(name) >= 64)
+    return 0;
+  for (const char *c = name; *c; c++) {
+    if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') ||
+          (*c >= '0' && *c <= '9') || *c == '.' || *c == '_' || *c == '-'))
+      return 0;
+  }
+  return 1;
+}
+
+static char *session_file(const char *name, const char *ext) {
+  char *dir = get_sessions_dir();
+  if (!dir)
+    return NULL;
+  size_t len = strlen(dir) + strlen(name) + strlen(ext) + 2;
+  char *path = malloc(len);
+  if (path)
+    snprintf(path, len, "%s/%s%s", dir, name, ext);
+  free(dir);
+  return path;
+}
+
+static void journal_close(void) {
+  if (JOURNAL.fd >= 0)
+    close(JOURNAL.fd);
+  if (JOURNAL.idx_fd >= 0)
+    close(JOURNAL.idx_fd);
+  JOURNAL.fd = -1;
+  JOURNAL.idx_fd = -1;
+  JOURNAL.name[0] = '\0';
+}
+
+static int journal_open(const char *name) {
+  journal_close();
+
+  mkdir(config_dir(), 0700);
+  char *sdir = get_sessions_dir();
+  if (sdir) {
+    mkdir(sdir, 0700);
+    free(sdir);
+  }
+
+  char *jpath = session_file(name, ".journal");
+  char *ipath = session_file(name, ".idx");
+  if (jpath && ipath) {
+    JOURNAL.fd = open(jpath, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    JOURNAL.idx_fd = open(ipath, O_WRONLY | O_CREAT | O_APPEND, 0600);
+  }
+  free(jpath);
+  free(ipath);
+  if (JOURNAL.fd < 0 || JOURNAL.idx_fd < 0) {
+    log_msg("Oturum günlüğü açılamadı.");
+    journal_close();
+    return -1;
+  }
+
+  struct stat st;
+  JOURNAL.size = fstat(JOURNAL.fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+  snprintf(JOURNAL.name, sizeof(JOURNAL.name), "%s", name);
+  return 0;
+}
+
+static void journal_write(uint8_t type, uint8_t flags, const void *hdr,
+                          size_t hdr_len, const void *payload,
+                          size_t payload_len, size_t raw_len) {
+  if (JOURNAL.fd < 0) {
+    /* Dosyalar ilk kayıtta oluşturulur; boş oturum dosyası bırakılmaz */
+    char name[sizeof(JOURNAL.name)];
+    memcpy(name, JOURNAL.name, sizeof(name));
+    if (!name[0] || journal_open(name) != 0)
+      return;
+  }
+  static const char pad[8];
+  JournalRec rec = {JOURNAL_MAGIC, type, flags, 0,
+                    (uint32_t)(hdr_len + payload_len),
+                    (uint32_t)(hdr_len + raw_len)};
+  /* Kayıtlar 8 byte'a hizalanır ki eşlemde başlıklar hizalı okunsun */
+  size_t body = hdr_len + payload_len;
+  size_t pad_len = JOURNAL_PAD(body) - body;
+  struct iovec iov[4] = {{&rec, sizeof(rec)},
+                         {(void *)hdr, hdr_len},
+                         {(void *)payload, payload_len},
+                         {(void *)pad, pad_len}};
+  size_t total = sizeof(rec) + body + pad_len;
+  struct iovec *v = iov;
+  int n = 4;
+  size_t left = total;
+  while (left > 0) {
+    ssize_t w = writev(JOURNAL.fd, v, n);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      break;
+    /* Kısmi yazım: kalan kısmı ilerlet */
+    left -= (size_t)w;
+    while (n > 0 && (size_t)w >= v->iov_len) {
+      w -= (ssize_t)v->iov_len;
+      v++;
+      n--;
+    }
+    if (n > 0) {
+      v->iov_base = (char *)v->iov_base + w;
+      v->iov_len -= (size_t)w;
+    }
+  }
+  if (left > 0) {
+    /* Yarım kayıt, dosya hâlâ bu sürecin beklediği boyuttaysa geri alınır.
+       Araya başka bir süreç (aynı oturuma yazan tek seferlik --session)
+       kayıt eklediyse kesilmez; journal_load bozuk kayıtta zaten durur.
+       Boyut her durumda diskteki hâliyle eşitlenir. */
+    struct stat st;
+    uint64_t expect = JOURNAL.size + (total - left);
+    if (fstat(JOURNAL.fd, &st) == 0) {
+      if ((uint64_t)st.st_size == expect &&
+          ftruncate(JOURNAL.fd, (off_t)JOURNAL.size) == 0)
+        st.st_size = (off_t)JOURNAL.size;
+      JOURNAL.size = (uint64_t)st.st_size;
+    }
+    log_msg("Oturum günlüğüne yazılamadı.");
+    return;
+  }
+  uint64_t off = JOURNAL.size;
+  if (write(JOURNAL.idx_fd, &off, sizeof(off)) != (ssize_t)sizeof(off))
+    log_msg("Oturum dizinine yazılamadı.");
+  JOURNAL.size += total;
+}
+
+/* Tur, arenadaki bitişik user\0assistant\0frag\0 bölgesinden tek writev ile
+   yazılır */
+static void journal_append_turn(const Turn *t) {
+  if (!JOURNAL.name[0])
+    return;
+  JournalTurn jt = {(uint32_t)t->user_len, (uint32_t)t->assistant_len,
+                    (uint32_t)t->frag_len, (uint32_t)t->tokens, 0, 0};
+  size_t raw_len = t->user_len + 1 + t->assistant_len + 1 + t->frag_len + 1;
+
+#ifdef HAVE_ZSTD
+  if (raw_len >= JOURNAL_ZSTD_MIN) {
+    size_t bound = ZSTD_compressBound(raw_len);
+    void *z = malloc(bound);
+    if (z) {
+      size_t zlen = ZSTD_compress(z, bound, t->user, raw_len, 3);
+      if (!ZSTD_isError(zlen) && zlen < raw_len) {
+        journal_write(JOURNAL_REC_TURN, JOURNAL_FLAG_ZSTD, &jt, sizeof(jt), z,
+                      zlen, raw_len);
+        free(z);
+        return;
+      }
+      free(z);
+    }
+  }
+#endif
+  journal_write(JOURNAL_REC_TURN, 0, &jt, sizeof(jt), t->user, raw_len,
+                raw_len);
+}
+
+static void journal_mark_clear(void) {
+  journal_write(JOURNAL_REC_CLEAR, 0, NULL, 0, NULL, 0, 0);
+}
+
+/* ofs'deki kaydı doğrular; geçerliyse başlığını döner */
+static const JournalRec *journal_rec_at(const char *map, size_t map_len,
+                                        uint64_t ofs) {
+  if (ofs + sizeof(JournalRec) > map_len || ofs % 8 != 0)
+    return NULL;
+  const JournalRec *rec = (const JournalRec *)(map + ofs);
+  if (rec->magic != JOURNAL_MAGIC ||
+      ofs + sizeof(JournalRec) + rec->len > map_len)
+    return NULL;
+  return rec;
+}
+
+/* Eşlemdeki bir tur kaydını geçmişe ekler (kopyasız; zstd ise arenaya açılır) */
+static int journal_push_turn(const JournalRec *rec) {
+  if (rec->len < sizeof(JournalTurn))
+    return -1;
+  const JournalTurn *jt = (const JournalTurn *)(rec + 1);
+  const char *payload = (const char *)(jt + 1);
+  size_t raw_len = (size_t)jt->user_len + 1 + jt->assistant_len + 1 +
+                   jt->frag_len + 1;
+  if (rec->raw_len != sizeof(JournalTurn) + raw_len)
+    return -1;
+  /* Metinler C dizgisi olarak kullanılır; her biri kaydın içinde NUL ile
+     bitmeli (sıkıştırılmış kayıt açıldıktan sonra denetlenir). */
+  if (!(rec->flags & JOURNAL_FLAG_ZSTD) &&
+      (rec->len != sizeof(JournalTurn) + raw_len ||
+       payload[jt->user_len] != '\0' ||
+       payload[jt->user_len + 1 + jt->assistant_len] != '\0' ||
+       payload[raw_len - 1] != '\0'))
+    return -1;
+
+  Turn *t = hist_slot();
+  if (!t)
+    return -1;
+  if (rec->flags & JOURNAL_FLAG_ZSTD) {
+#ifdef HAVE_ZSTD
+    ArenaBlock *block;
+    char *mem = arena_alloc(&HIST.arena, raw_len, &block);
+    if (!mem)
+      return -1;
+    size_t got = ZSTD_decompress(mem, raw_len, payload,
+                                 rec->len - sizeof(JournalTurn));
+    if (ZSTD_isError(got) || got != raw_len) {
+      arena_release(&HIST.arena, block);
+      return -1;
+    }
+    payload = mem;
+    t->block = block;
+    if (mem[jt->user_len] != '\0' ||
+        mem[jt->user_len + 1 + jt->assistant_len] != '\0' ||
+        mem[raw_len - 1] != '\0') {
+      arena_release(&HIST.arena, block);
+      return -1;
+    }
+#else
+    log_msg("Günlükte zstd kaydı var ama bu derleme zstd desteklemiyor.");
+    return -1;
+#endif
+  }
+
+  t->user = payload;
+  t->user_len = jt->user_len;
+  t->assistant = payload + jt->user_len + 1;
+  t->assistant_len = jt->assistant_len;
+  t->frag = t->assistant + jt->assistant_len + 1;
+  t->frag_len = jt->frag_len;
+  t->tokens = jt->tokens;
+  HIST.count++;
+  return 0;
+}
+
+static void *map_file(const char *path, size_t *len) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  void *m = NULL;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED)
+      m = NULL;
+    else
+      *len = (size_t)st.st_size;
+  }
+  close(fd);
+  return m;
+}
+
+/* Oturumu geçmişe yükler ve sonraki turların o günlüğe eklenmesini sağlar
+   (dosya yoksa ilk turda oluşturulur).
+   Dizin dosyası sondan geriye okunur: son CLEAR işaretine ya da tur
+   sınırına kadar olan kayıtlar alınır. Dizin yoksa/bozuksa günlük kayıt
+   başlıkları üzerinden taranır (yine metin ayrıştırılmaz). */
+static int journal_load(const char *name) {
+  clear_history();
+
+  char *jpath = session_file(name, ".journal");
+  char *ipath = session_file(name, ".idx");
+  size_t map_len = 0, idx_len = 0;
+  char *map = jpath ? map_file(jpath, &map_len) : NULL;
+  uint64_t *idx = ipath ? map_file(ipath, &idx_len) : NULL;
+  free(jpath);
+  free(ipath);
+
+  size_t loaded = 0;
+  if (map) {
+    HIST.map = map;
+    HIST.map_len = map_len;
+
+    uint64_t *offs = idx;
+    size_t n = idx_len / sizeof(uint64_t);
+    uint64_t *scanned = NULL;
+    if (!offs || n == 0 || !journal_rec_at(map, map_len, offs[n - 1])) {
+      /* Dizin yok: kayıt başlıklarını takip ederek ofsetleri çıkar */
+      size_t cap = 64;
+      scanned = malloc(cap * sizeof(uint64_t));
+      n = 0;
+      uint64_t ofs = 0;
+      const JournalRec *rec;
+      while (scanned && (rec = journal_rec_at(map, map_len, ofs))) {
+        if (n == cap) {
+          cap *= 2;
+          uint64_t *tmp = realloc(scanned, cap * sizeof(uint64_t));
+          if (!tmp)
+            break;
+          scanned = tmp;
+        }
+        scanned[n++] = ofs;
+        ofs += sizeof(JournalRec) + JOURNAL_PAD(rec->len);
+      }
+      offs = scanned;
+
+      /* Dizini yeniden yaz ki sonraki eklemeler tutarlı devam etsin */
+      char *rpath = session_file(name, ".idx");
+      int ifd = rpath ? open(rpath, O_WRONLY | O_CREAT | O_TRUNC, 0600) : -1;
+      if (ifd >= 0) {
+        if (scanned && write(ifd, scanned, n * sizeof(uint64_t)) < 0)
+          log_msg("Oturum dizini yeniden yazılamadı.");
+        close(ifd);
+      }
+      free(rpath);
+    }
+
+    /* Sondan geriye: yüklenecek ilk kaydı bul */
+    size_t first = n;
+    size_t turns = 0;
+    while (first > 0) {
+      const JournalRec *rec = journal_rec_at(map, map_len, offs[first - 1]);
+      if (!rec || rec->type == JOURNAL_REC_CLEAR)
+        break;
+      if (HIST.max_turns > 0 && turns >= HIST.max_turns)
+        break;
+      first--;
+      turns++;
+    }
+    for (size_t i = first; i < n; i++) {
+      const JournalRec *rec = journal_rec_at(map, map_len, offs[i]);
+      if (rec && rec->type == JOURNAL_REC_TURN && journal_push_turn(rec) == 0)
+        loaded++;
+    }
+    free(scanned);
+  }
+  if (idx)
+    munmap(idx, idx_len);
+
+  journal_close();
+  snprintf(JOURNAL.name, sizeof(JOURNAL.name), "%s", name);
+  return (int)loaded;
+}
+
+/* Aynı saniyede açılan iki süreç aynı günlüğe yazmasın diye pid eklenir */
+static void default_session_name(char *out, size_t len) {
+  time_t now = time(NULL);
+  struct tm tmv;
+  localtime_r(&now, &tmv);
+  size_t n = strftime(out, len, "%Y%m%d-%H%M%S", &tmv);
+  snprintf(out + n, len - n, "-%ld", (long)getpid());
+}
+
+static int session_filter(const struct dirent *d) {
+  size_t l = strlen(d->d_name);
+  return l > 8 && strcmp(d->d_name + l - 8, ".journal") == 0;
+}
+
+static void print_sessions(void) {
+  char *dir = get_sessions_dir();
+  struct dirent **list = NULL;
+  int n = dir ? scandir(dir, &list, session_filter, alphasort) : -1;
+  if (n <= 0) {
+    printf("%s(kayıtlı oturum yok)%s\n", COLOR_INFO, COLOR_RESET);
+    free(dir);
+    free(list);
+    return;
+  }
+
+  for (int i = 0; i < n; i++) {
+    char name[64];
+    size_t l = strlen(list[i]->d_name) - 8;
+    if (l >= sizeof(name))
+      l = sizeof(name) - 1;
+    memcpy(name, list[i]->d_name, l);
+    name[l] = '\0';
+
+    struct stat st;
+    long records = 0;
+    char *ipath = session_file(name, ".idx");
+    if (ipath && stat(ipath, &st) == 0)
+      records = (long)(st.st_size / (off_t)sizeof(uint64_t));
+    free(ipath);
+
+    printf("  %s%-24s%s %5ld kayıt%s\n",
+           strcmp(name, JOURNAL.name) == 0 ? COLOR_ASSIST : "", name,
+           COLOR_RESET, records,
+           strcmp(name, JOURNAL.name) == 0 ? "  (aktif)" : "");
+    free(list[i]);
+  }
+  free(list);
+  free(dir);
+}
+
+/* Çok satırlı giriş */
+static char *read_multiline_prompt(void) {
+  printf("%sÇok satırlı moda geçtin. Metni yaz, sadece '.' içeren bir satırla "
+         "bitir.%s\n",
+         COLOR_INFO, COLOR_RESET);
+
+  size_t cap = 1024;
+  size_t len = 0;
+  char *buf = malloc(cap);
+  if (!buf) {
+    printf("%sBellek hatası.%s\n", COLOR_ERROR, COLOR_RESET);
+    return NULL;
+  }
+  buf[0] = '\0';
+
+  char *line = NULL;
+  size_t line_cap = 0;
+  while (1) {
+    /* Satır uzunluğu sınırsız: yapıştırılan uzun satırlar bölünmez */
+    if (getline(&line, &line_cap, stdin) < 0) {
+      break;
+    }
+    trim(line);
+    if (strcmp(line, ".") == 0) {
+      break;
+    }
+    size_t l = strlen(line);
+    if (len + l + 2 >= cap) {
+      while (len + l + 2 >= cap)
+        cap *= 2;
+      char *tmp = realloc(buf, cap);
+      if (!tmp) {
+        free(buf);
+        free(line);
+        printf("%sBellek hatası.%s\n", COLOR_ERROR, COLOR_RESET);
+        return NULL;
+      }
+      buf = tmp;
+    }
+    memcpy(buf + len, line, l);
+    len += l;
+    buf[len++] = '\n';
+    buf[len] = '\0';
+  }
+  free(line);
+
+  if (len == 0) {
+    free(buf);
+    printf("%sBoş çok satırlı giriş.%s\n", COLOR_INFO, COLOR_RESET);
+    return NULL;
+  }
+
+  return buf;
+}
+
+/* Argümanları birleştirme */
+static char *join_args_from(int start, int argc, char **argv) {
+  size_t total = 0;
+  for (int i = start; i < argc; i++) {
+    total += strlen(argv[i]) + 1;
+  }
+  char *out = malloc(total + 1);
+  if (!out)
+    return NULL;
+  out[0] = '\0';
+  for (int i = start; i < argc; i++) {
+    strcat(out, argv[i]);
+    if (i != argc - 1)
+      strcat(out, " ");
+  }
+  return out;
+}
+
+/* CLI yardım ve model listesi */
+static void print_usage(const char *progname) {
+  fprintf(
+      stdout,
+      "Kullanim: %s [seçenekler] [\"tek seferlik soru...\"]\n\n"
+      "Seçenekler:\n"
+      "  -m, --model ADI            Bu istek için model seç; 'a,b,c' verilirse\n"
+      "                             soru modellere aynı anda sorulup karşılaştırılır\n"
       "  --set-default-model ADI    Varsayılan modeli kalıcı olarak ayarla\n"
       "  -l, --list-models          Kullanılabilir modelleri listele\n"
       "  -q, --no-log               Sessiz mod (logları kapat)\n"
+      "  --stats                    İstek başına token/gecikme dökümünü göster\n"
+      "  --output=ndjson            Tek seferlik cevabı satır başına bir JSON\n"
+      "                             olayı olarak yaz (delta/finish/usage/summary)\n"
+      "  --compact                  Büyüyen geçmişin eski turlarını arka planda\n"
+      "                             özetle (CHATGPT_COMPACT=1 veya token eşiği)\n"
+      "  --session AD               Adlı oturumu devam ettir / oluştur\n"
+      "  --cache                    Cevap önbelleğini kullan (CHATGPT_CACHE=1)\n"
+      "  --no-cache                 Önbelleği bu çalıştırmada kapat\n"
+      "  --refresh                  Önbelleği atla, taze cevabı kaydet\n"
+      "  --trace DOSYA              İstek başına gecikme ölçümlerini JSONL ekle\n"
+      "  --batch DOSYA.jsonl        Satır başına bir istek, eşzamanlı yürüt\n"
+      "  --concurrency N            Toplu işte aynı anda en fazla N istek\n"
+      "  --completion-order         Sonuçları bitiş sırasıyla yaz\n"
+      "  --daemon                   Arka planda kal; tek seferlik çağrılar\n"
+      "                             bağlantıları hazır daemon'a iletilir\n"
+      "  --usage                    Kullanım defterinden token/maliyet özeti\n"
+      "    --since TARİH|7d|12h     Sadece bu tarihten (ya da süreden) beri\n"
+      "    --by-model               Model başına satırlar\n"
       "  -h, --help                 Bu yardımı göster\n\n"
       "Model önceliği: CLI > config > CHATGPT_MODEL > DEFAULT_MODEL\n\n"
       "Etkileşimli mod komutları:\n"
       "  /history    Konuşma geçmişini göster\n"
       "  /clear      Konuşma geçmişini temizle\n"
+      "  /sessions   Kayıtlı oturumları listele\n"
+      "  /load AD    Kayıtlı bir oturumu yükle\n"
       "  /ml         Çok satırlı mesaj yaz ('.' ile bitir)\n"
       "  /run N      Son yanıttaki $ komutlarından N'inciyi çalıştır\n"
       "  /model      Aktif modeli göster\n"
+      "  /compare m1,m2 SORU  Soruyu modellere aynı anda sor, karşılaştır\n"
       "  /exit       Çıkış\n",
       progname);
 }
 
-static void print_models(void) {
-  fprintf(stdout,
-          "Örnek sohbet modelleri:\n\n"
-          "  gpt-4o-mini   - Hızlı, ucuz, günlük işler\n"
-          "  gpt-4.1-mini  - Mini serisinin yeni nesli (erişimin varsa)\n"
-          "  gpt-4o        - Daha güçlü, multimodal, genel amaçlı\n"
-          "  gpt-4.1       - Güçlü, teknik işler ve kod için iyi\n"
-          "  gpt-4.1-pro   - En üst seviye, yoğun reasoning için\n"
-          "  o3-mini       - Mantık / reasoning odaklı\n\n"
-          "Not: Hesabında hangilerinin açık olduğunu OpenAI panelinden kontrol "
-          "et.\n");
-}
+static void print_models(void) {
+  fprintf(stdout,
+          "Örnek sohbet modelleri:\n\n"
+          "  gpt-4o-mini   - Hızlı, ucuz, günlük işler\n"
+          "  gpt-4.1-mini  - Mini serisinin yeni nesli (erişimin varsa)\n"
+          "  gpt-4o        - Daha güçlü, multimodal, genel amaçlı\n"
+          "  gpt-4.1       - Güçlü, teknik işler ve kod için iyi\n"
+          "  gpt-4.1-pro   - En üst seviye, yoğun reasoning için\n"
+          "  o3-mini       - Mantık / reasoning odaklı\n\n"
+          "Not: Hesabında hangilerinin açık olduğunu OpenAI panelinden kontrol "
+          "et.\n");
+}
+
+/* ===== HTTP taşıma katmanı =====
+   Süreç boyunca tek bir easy handle ve bir CURLSH paylaşımı tutulur. DNS
+   önbelleği, açık bağlantılar ve TLS oturumları istekler arasında yaşar; her
+   turda yeniden el sıkışma yapılmaz. Paylaşım, ileride başka thread'lerdeki
+   handle'lar da kullanabilsin diye mutex'lerle korunur. */
+
+static CURLSH *HTTP_SHARE = NULL;
+static CURL *HTTP = NULL;
+static CURLM *HTTP_MULTI = NULL; /* HTTP'yi çıktı zamanlayıcısıyla sürer */
+static CURL *WARM = NULL;        /* istem beklenirken bağlantı ısıtıcı */
+static int WARM_ACTIVE = 0;      /* WARM, HTTP_MULTI üzerinde sürüyor */
+static double HTTP_LAST_USE = 0; /* son aktarımın bittiği an (mono_now) */
+/* Okunabilir olunca (daemon'da istemci bağlantısı kapandı) süren aktarım
+   kesilir; HTTP_ABORTED işaretlenir */
+static int HTTP_ABORT_FD = -1;
+static int HTTP_ABORTED = 0;
+/* Etkileşimli modda Ctrl-C: aktarım sürerken sadece o aktarım iptal
+   edilir (CANCEL_ARMED), yoksa süreç eskisi gibi sonlanır. Sinyal hangi
+   thread'e düşerse düşsün bekleyen poll'u kendi borusu uyandırır. */
+static volatile sig_atomic_t CANCEL_ARMED = 0;
+static volatile sig_atomic_t CANCEL_REQUESTED = 0;
+static int CANCEL_PIPE[2] = {-1, -1};
+static int HTTP_CANCELLED = 0; /* son aktarım Ctrl-C ile kesildi */
+static pthread_mutex_t HTTP_LOCKS[CURL_LOCK_DATA_LAST];
+
+static void http_lock_cb(CURL *handle, curl_lock_data data,
+                         curl_lock_access access, void *userp) {
+  (void)handle;
+  (void)access;
+  (void)userp;
+  pthread_mutex_lock(&HTTP_LOCKS[data]);
+}
+
+static void http_unlock_cb(CURL *handle, curl_lock_data data, void *userp) {
+  (void)handle;
+  (void)userp;
+  pthread_mutex_unlock(&HTTP_LOCKS[data]);
+}
+
+/* Uç nokta: CHATGPT_API_URL ile (proxy / yerel test sunucusu) ezilebilir */
+static const char *api_url(void) {
+  const char *env_url = getenv("CHATGPT_API_URL");
+  if (env_url && env_url[0] != '\0')
+    return env_url;
+  return API_URL;
+}
+
+static int http_init(void) {
+  if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+    log_msg("curl_global_init başarısız.");
+    return -1;
+  }
+
+  for (int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+    pthread_mutex_init(&HTTP_LOCKS[i], NULL);
+
+  HTTP_SHARE = curl_share_init();
+  if (HTTP_SHARE) {
+    curl_share_setopt(HTTP_SHARE, CURLSHOPT_LOCKFUNC, http_lock_cb);
+    curl_share_setopt(HTTP_SHARE, CURLSHOPT_UNLOCKFUNC, http_unlock_cb);
+    curl_share_setopt(HTTP_SHARE, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(HTTP_SHARE, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(HTTP_SHARE, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+  }
+
+  HTTP = curl_easy_init();
+  if (!HTTP) {
+    log_msg("curl_easy_init başarısız.");
+    return -1;
+  }
+  HTTP_MULTI = curl_multi_init(); /* yoksa curl_easy_perform'a düşülür */
+  return 0;
+}
+
+static void http_cleanup(void) {
+  if (WARM) {
+    if (WARM_ACTIVE && HTTP_MULTI)
+      curl_multi_remove_handle(HTTP_MULTI, WARM);
+    curl_easy_cleanup(WARM);
+    WARM = NULL;
+    WARM_ACTIVE = 0;
+  }
+  if (HTTP_MULTI) {
+    curl_multi_cleanup(HTTP_MULTI);
+    HTTP_MULTI = NULL;
+  }
+  if (HTTP) {
+    curl_easy_cleanup(HTTP);
+    HTTP = NULL;
+  }
+  if (HTTP_SHARE) {
+    curl_share_cleanup(HTTP_SHARE);
+    HTTP_SHARE = NULL;
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++)
+      pthread_mutex_destroy(&HTTP_LOCKS[i]);
+  }
+  curl_global_cleanup();
+}
+
+/* Tüm handle'lar için ortak ayarlar: paylaşım, HTTP/2, keep-alive, TLS */
+static void http_setup(CURL *h) {
+  if (HTTP_SHARE)
+    curl_easy_setopt(h, CURLOPT_SHARE, HTTP_SHARE);
+  curl_easy_setopt(h, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+  curl_easy_setopt(h, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(h, CURLOPT_TCP_KEEPIDLE, 30L);
+  curl_easy_setopt(h, CURLOPT_TCP_KEEPINTVL, 15L);
+  curl_easy_setopt(h, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(h, CURLOPT_SSL_VERIFYPEER, 1L);
+  curl_easy_setopt(h, CURLOPT_SSL_VERIFYHOST, 2L);
+}
+
+/* İlerleme geri çağrısı: Ctrl-C'de aktarımı keser */
+static int cancel_xfer_cb(void *p, curl_off_t dt, curl_off_t dn,
+                          curl_off_t ut, curl_off_t un) {
+  (void)p;
+  (void)dt;
+  (void)dn;
+  (void)ut;
+  (void)un;
+  return CANCEL_REQUESTED != 0;
+}
+
+static void cancel_on_sigint(int sig) {
+  if (!CANCEL_ARMED) {
+    signal(sig, SIG_DFL);
+    raise(sig);
+    return;
+  }
+  CANCEL_REQUESTED = 1;
+  int saved = errno;
+  if (CANCEL_PIPE[1] >= 0 && write(CANCEL_PIPE[1], "", 1) < 0) {
+    /* boru doluysa zaten uyandırılacak */
+  }
+  errno = saved;
+}
+
+/* Etkileşimli mod başında bir kez */
+static void cancel_install(void) {
+  if (pipe2(CANCEL_PIPE, O_NONBLOCK | O_CLOEXEC) != 0)
+    CANCEL_PIPE[0] = CANCEL_PIPE[1] = -1;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = cancel_on_sigint; /* SA_RESTART yok: poll hemen döner */
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+}
+
+/* Aktarım başında: eski basışları ve boruyu temizle, Ctrl-C'yi bağla */
+static void cancel_arm(void) {
+  char drain[64];
+  while (CANCEL_PIPE[0] >= 0 && read(CANCEL_PIPE[0], drain, sizeof(drain)) > 0)
+    ;
+  CANCEL_REQUESTED = 0;
+  CANCEL_ARMED = 1;
+}
+
+static void cancel_disarm(void) { CANCEL_ARMED = 0; }
+
+/* Kalıcı handle'ı bir sonraki istek için hazırlar. curl_easy_reset
+   seçenekleri sıfırlar ama bağlantı/DNS/TLS önbelleklerine dokunmaz. */
+static CURL *http_acquire(void) {
+  if (!HTTP)
+    return NULL;
+  curl_easy_reset(HTTP);
+  http_setup(HTTP);
+  /* curl_easy_perform yedeğinde de Ctrl-C aktarımı keser */
+  curl_easy_setopt(HTTP, CURLOPT_NOPROGRESS, 0L);
+  curl_easy_setopt(HTTP, CURLOPT_XFERINFOFUNCTION, cancel_xfer_cb);
+  return HTTP;
+}
+
+/* Tek bir isteği çalıştırır. curl_easy_perform yerine multi handle
+   kullanılır ki bekleme sırasında da terminal tamponu kare süresinde
+   boşaltılabilsin. Dönüşte bekleyen çıktı yazılmış olur. */
+static CURLcode http_perform(CURL *h) {
+  HTTP_CANCELLED = 0;
+  /* Çağıran (yeniden denemeler dahil bütün istek için) bağladıysa dokunma */
+  int outer = CANCEL_ARMED;
+  if (!outer)
+    cancel_arm();
+  if (!HTTP_MULTI || curl_multi_add_handle(HTTP_MULTI, h) != CURLM_OK) {
+    CURLcode res = curl_easy_perform(h);
+    if (!outer)
+      cancel_disarm();
+    HTTP_CANCELLED = res == CURLE_ABORTED_BY_CALLBACK && CANCEL_REQUESTED;
+    HTTP_LAST_USE = mono_now();
+    out_flush();
+    return res;
+  }
+
+  CURLcode res = CURLE_OK;
+  int running = 1;
+  HTTP_ABORTED = 0;
+  while (running) {
+    if (curl_multi_perform(HTTP_MULTI, &running) != CURLM_OK) {
+      res = CURLE_RECV_ERROR;
+      break;
+    }
+    if (!running)
+      break;
+    int timeout = out_timeout_ms();
+    struct curl_waitfd wait[2];
+    unsigned nwait = 0;
+    if (HTTP_ABORT_FD >= 0)
+      wait[nwait++] = (struct curl_waitfd){HTTP_ABORT_FD, CURL_WAIT_POLLIN, 0};
+    if (CANCEL_PIPE[0] >= 0)
+      wait[nwait++] = (struct curl_waitfd){CANCEL_PIPE[0], CURL_WAIT_POLLIN, 0};
+    curl_multi_poll(HTTP_MULTI, nwait ? wait : NULL, nwait,
+                    timeout < 0 ? 1000 : timeout, NULL);
+    if (HTTP_ABORT_FD >= 0 && wait[0].revents) {
+      HTTP_ABORTED = 1;
+      res = CURLE_ABORTED_BY_CALLBACK;
+      break;
+    }
+    if (CANCEL_REQUESTED) {
+      /* Aktarım kaldırılınca HTTP/2'de sadece akış sıfırlanır, bağlantı
+         havuzda kalır; HTTP/1.1'de yarım cevaplı bağlantı kapanır */
+      res = CURLE_ABORTED_BY_CALLBACK;
+      break;
+    }
+    out_tick();
+  }
+  if (!outer)
+    cancel_disarm();
+  CURLMsg *msg;
+  int left;
+  while ((msg = curl_multi_info_read(HTTP_MULTI, &left))) {
+    if (msg->msg == CURLMSG_DONE && msg->easy_handle == h)
+      res = msg->data.result;
+  }
+  HTTP_CANCELLED = res == CURLE_ABORTED_BY_CALLBACK && CANCEL_REQUESTED;
+  curl_multi_remove_handle(HTTP_MULTI, h);
+  HTTP_LAST_USE = mono_now();
+  out_flush();
+  return res;
+}
+
+/* İstek bittikten sonra bağlantının yeniden kullanılıp kullanılmadığını
+   bildirir (yeni bağlantı sayısı 0 ise havuzdan gelmiştir). */
+static void http_report(CURL *h) {
+  long new_conns = 0;
+  long http_ver = 0;
+  curl_easy_getinfo(h, CURLINFO_NUM_CONNECTS, &new_conns);
+  curl_easy_getinfo(h, CURLINFO_HTTP_VERSION, &http_ver);
+
+  const char *ver = http_ver == CURL_HTTP_VERSION_1_0   ? "1.0"
+                    : http_ver == CURL_HTTP_VERSION_1_1 ? "1.1"
+                    : http_ver == CURL_HTTP_VERSION_2_0 ? "2"
+#ifdef CURL_HTTP_VERSION_3
+                    : http_ver == CURL_HTTP_VERSION_3 ? "3"
+#endif
+                                                        : "?";
+  char msg[128];
+  snprintf(msg, sizeof(msg), "%s (HTTP/%s).",
+           new_conns == 0 ? "Bağlantı yeniden kullanıldı"
+                          : "Yeni bağlantı açıldı",
+           ver);
+  log_msg(msg);
+}
+
+/* ===== Bağlantı ısıtma =====
+   Etkileşimli modda istem beklenirken (stdin bir terminalse) API ucuna
+   gövdesiz bir HEAD isteği atılır: DNS, TCP ve TLS el sıkışması kullanıcı
+   yazarken tamamlanır ve bağlantı paylaşılan havuza düşer, ilk istek hazır
+   bağlantıyla başlar. Uzun beklemelerde bağlantı libcurl'ün yeniden
+   kullanım süresi dolmadan tazelenir; HTTP/2'de arada curl_easy_upkeep
+   PING gönderir. Daemon da istemci beklerken aynı döngüyü kullanır.
+   CHATGPT_PREWARM=0 ile kapatılır. */
+
+#define WARM_REFRESH_SEC 100.0 /* libcurl 118 sn boşta kalanı kullanmaz */
+#define WARM_IDLE_MAX_SEC 1800.0 /* bundan uzun boşlukta tazelemeyi bırak */
+#define WARM_TIMEOUT_SEC 10L
+
+static int warm_enabled(void) {
+  const char *env = getenv("CHATGPT_PREWARM");
+  if (env && strcmp(env, "0") == 0)
+    return 0;
+  return HTTP_MULTI != NULL;
+}
+
+static size_t warm_discard_cb(void *ptr, size_t size, size_t nmemb,
+                              void *userp) {
+  (void)ptr;
+  (void)userp;
+  return size * nmemb;
+}
+
+static void warm_start(void) {
+  if (!WARM)
+    WARM = curl_easy_init();
+  if (!WARM)
+    return;
+  curl_easy_reset(WARM);
+  http_setup(WARM);
+  curl_easy_setopt(WARM, CURLOPT_URL, api_url());
+  curl_easy_setopt(WARM, CURLOPT_NOBODY, 1L);
+  curl_easy_setopt(WARM, CURLOPT_TIMEOUT, WARM_TIMEOUT_SEC);
+  curl_easy_setopt(WARM, CURLOPT_WRITEFUNCTION, warm_discard_cb);
+  if (curl_multi_add_handle(HTTP_MULTI, WARM) == CURLM_OK)
+    WARM_ACTIVE = 1;
+}
+
+static void warm_reap(void) {
+  CURLMsg *msg;
+  int left;
+  while ((msg = curl_multi_info_read(HTTP_MULTI, &left))) {
+    if (msg->msg == CURLMSG_DONE && msg->easy_handle == WARM) {
+      curl_multi_remove_handle(HTTP_MULTI, WARM);
+      WARM_ACTIVE = 0;
+      HTTP_LAST_USE = mono_now();
+    }
+  }
+}
+
+/* fd okunabilir olana kadar bekler; bu sırada bağlantıyı ısıtır. fd
+   hazır olduğunda yarım kalmış bir el sıkışma varsa bitmesi beklenir,
+   çünkü gerçek istek de aynı el sıkışmayı bekleyecekti. */
+static void http_idle_wait(int fd) {
+  if (!warm_enabled())
+    return;
+  int ready = 0;
+  for (;;) {
+    if (STOP_REQUESTED)
+      return;
+    double idle = HTTP_LAST_USE > 0 ? mono_now() - HTTP_LAST_USE : -1;
+    if (!WARM_ACTIVE && !ready &&
+        (idle < 0 || (idle >= WARM_REFRESH_SEC && idle < WARM_IDLE_MAX_SEC)))
+      warm_start();
+    if (ready && !WARM_ACTIVE)
+      return;
+    if (WARM && !WARM_ACTIVE)
+      curl_easy_upkeep(WARM);
+
+    struct curl_waitfd in = {fd, CURL_WAIT_POLLIN, 0};
+    int timeout = 1000;
+    if (!WARM_ACTIVE) {
+      /* Bir sonraki tazelemeye kadar sadece stdin beklenir */
+      double due = WARM_REFRESH_SEC - (idle < 0 ? 0 : idle);
+      if (due > 0 && due < 3600)
+        timeout = (int)(due * 1000) + 1;
+      else
+        timeout = 60000;
+    }
+    if (curl_multi_poll(HTTP_MULTI, ready ? NULL : &in, ready ? 0 : 1,
+                        timeout, NULL) != CURLM_OK)
+      return;
+    if (!ready && in.revents)
+      ready = 1;
+    if (WARM_ACTIVE) {
+      int running = 0;
+      curl_multi_perform(HTTP_MULTI, &running);
+      warm_reap();
+    }
+  }
+}
+
+/* İstem satırını beklerken ısıtır. stdin terminal değilse hemen döner ve
+   okuma her zamanki gibi fgets'te bloklanır. */
+static void prompt_wait(void) {
+  if (isatty(STDIN_FILENO))
+    http_idle_wait(STDIN_FILENO);
+}
+
+/* ===== İstek gövdesi =====
+   POST gövdesi tek parça halinde kopyalanmaz; sabit parçalar, önceden
+   kaçırılmış tur parçaları ve yeni mesajdan oluşan bir parça listesi
+   (iovec benzeri) CURLOPT_READFUNCTION ile curl'e sırayla beslenir.
+   Eklenen dosyalar gibi büyük parçalar kaçırılmadan referansla eklenir ve
+   okuma sırasında parça parça kaçırılır. Tek seferlik modda boru ile gelen
+   stdin de böyle bir parçadır (ptr == NULL): boyu bilinmediği için gövde
+   chunked gider, stdin okundukça kaçırılıp gönderilir ve bellekte sadece
+   bir okuma tamponu durur. */
+
+#define STREAM_DEFAULT_MAX_MB 64
+
+typedef struct {
+  int fd;
+  char buf[65536];
+  size_t len, pos;
+  int eof;
+  int started;      /* okunmaya başlandı: gövde artık başa sarılamaz */
+  size_t bytes;     /* okunan ham bayt */
+  size_t tokens;    /* okunan kısmın token sayısı */
+  size_t max_bytes; /* 0 = sınırsız */
+  size_t max_tokens;
+  char error[192]; /* sınır aşıldıysa kullanıcıya gösterilecek neden */
+} BodyStream;
+
+typedef struct {
+  const char *ptr;
+  size_t len;     /* gövdeye giden bayt sayısı */
+  size_t raw_len; /* 0 = olduğu gibi; değilse ptr'deki kaçırılacak kaynak */
+} BodySeg;
+
+typedef struct {
+  BodySeg *segs;
+  size_t count;
+  size_t cap;
+  size_t cur; /* okunan parça */
+  size_t off; /* parça içindeki (çıktı) konumu */
+  size_t src; /* kaçırılan parçada kaynak konumu */
+  char pend[8]; /* yarım kalan kaçış dizisi */
+  size_t pend_len, pend_pos;
+  curl_off_t total;
+  BodyStream *stream; /* varsa boy bilinmez (total = -1) */
+} Body;
+
+static void body_init(Body *b) { memset(b, 0, sizeof(*b)); }
+
+static void body_free(Body *b) {
+  free(b->segs);
+  memset(b, 0, sizeof(*b));
+}
+
+static int body_push(Body *b, const char *ptr, size_t len, size_t raw_len) {
+  if (b->count == b->cap) {
+    size_t cap = b->cap ? b->cap * 2 : 64;
+    BodySeg *tmp = realloc(b->segs, cap * sizeof(BodySeg));
+    if (!tmp)
+      return -1;
+    b->segs = tmp;
+    b->cap = cap;
+  }
+  b->segs[b->count].ptr = ptr;
+  b->segs[b->count].len = len;
+  b->segs[b->count].raw_len = raw_len;
+  b->count++;
+  if (!b->stream)
+    b->total += (curl_off_t)len;
+  return 0;
+}
+
+static int body_add(Body *b, const char *ptr, size_t len) {
+  if (!ptr || len == 0)
+    return 0;
+  return body_push(b, ptr, len, 0);
+}
+
+/* Ham metni gönderim sırasında kaçırılacak şekilde ekler. esc_len,
+   json_escaped_len(ptr, len) olmalı (Content-Length için). */
+static int body_add_escaped(Body *b, const char *ptr, size_t len,
+                            size_t esc_len) {
+  if (!ptr || len == 0)
+    return 0;
+  return body_push(b, ptr, esc_len, len);
+}
+
+static int body_add_str(Body *b, const char *s) {
+  return s ? body_add(b, s, strlen(s)) : 0;
+}
+
+/* stdin akışını bu noktaya ekler (gövdede en fazla bir tane) */
+static int body_add_stream(Body *b, BodyStream *s) {
+  b->stream = s;
+  b->total = -1;
+  return body_push(b, NULL, 0, 0);
+}
+
+/* stdin boru ya da dosyaysa. Terminal, /dev/null ve soketler (Node gibi
+   ortamların açık bırakıp hiç kapatmadığı stdio'su) okunmaz; EOF
+   beklerken asılı kalınmasın. CHATGPT_STDIN=0 ile tamamen kapatılır. */
+static int stream_wanted(int fd) {
+  struct stat st;
+  const char *env = getenv("CHATGPT_STDIN");
+  if (fd < 0 || (env && strcmp(env, "0") == 0) || isatty(fd) ||
+      fstat(fd, &st) != 0)
+    return 0;
+  return S_ISFIFO(st.st_mode) || S_ISREG(st.st_mode);
+}
+
+static void stream_init(BodyStream *s, int fd) {
+  memset(s, 0, sizeof(*s));
+  s->fd = fd;
+  size_t mb = STREAM_DEFAULT_MAX_MB;
+  const char *env = getenv("CHATGPT_STDIN_MAX_MB");
+  if (env && env[0])
+    mb = (size_t)strtoul(env, NULL, 10);
+  s->max_bytes = mb << 20;
+}
+
+/* Kaçırılacak parçadan en fazla room bayt üretir; sığmayan kaçış dizisi
+   bir sonraki çağrıya bekletilir. */
+static size_t body_escape_read(Body *b, const BodySeg *seg, char *dst,
+                               size_t room) {
+  size_t out = 0;
+  while (out < room) {
+    if (b->pend_pos < b->pend_len) {
+      size_t n = b->pend_len - b->pend_pos;
+      if (n > room - out)
+        n = room - out;
+      memcpy(dst + out, b->pend + b->pend_pos, n);
+      out += n;
+      b->pend_pos += n;
+      continue;
+    }
+    if (b->src >= seg->raw_len)
+      break;
+    size_t lim = seg->raw_len - b->src;
+    if (lim > room - out)
+      lim = room - out;
+    size_t run = json_scan(seg->ptr + b->src, lim);
+    memcpy(dst + out, seg->ptr + b->src, run);
+    out += run;
+    b->src += run;
+    if (run < lim) {
+      b->pend_len =
+          json_escape_char((unsigned char)seg->ptr[b->src++], b->pend);
+      b->pend_pos = 0;
+    }
+  }
+  return out;
+}
+
+/* stdin'den okuyup kaçırarak en fazla room bayt üretir. Elde veri varsa
+   yenisi için bloklanmaz, böylece yükleme stdin bitmeden başlar. 0 sadece
+   akış bittiğinde döner; sınır aşılırsa CURL_READFUNC_ABORT. */
+static size_t body_stream_read(Body *b, char *dst, size_t room) {
+  BodyStream *s = b->stream;
+  size_t out = 0;
+  while (out < room) {
+    if (s->pos == s->len && b->pend_pos == b->pend_len) {
+      if (s->eof || out > 0)
+        break;
+      ssize_t r = read(s->fd, s->buf, sizeof(s->buf));
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r < 0) {
+        snprintf(s->error, sizeof(s->error), "stdin okunamadı: %s",
+                 strerror(errno));
+        return CURL_READFUNC_ABORT;
+      }
+      if (r == 0) {
+        s->eof = 1;
+        break;
+      }
+      s->started = 1;
+      s->len = (size_t)r;
+      s->pos = 0;
+      s->bytes += (size_t)r;
+      s->tokens += count_tokens(s->buf, s->len);
+      if (s->max_bytes && s->bytes > s->max_bytes) {
+        snprintf(s->error, sizeof(s->error),
+                 "stdin %zu MB sınırını aştı (CHATGPT_STDIN_MAX_MB), istek "
+                 "iptal edildi.",
+                 s->max_bytes >> 20);
+        return CURL_READFUNC_ABORT;
+      }
+      if (s->tokens > s->max_tokens) {
+        snprintf(s->error, sizeof(s->error),
+                 "stdin bağlam bütçesine sığmıyor (%zu bayttan sonra ~%zu / "
+                 "%zu token), istek iptal edildi.",
+                 s->bytes, s->tokens, s->max_tokens);
+        return CURL_READFUNC_ABORT;
+      }
+      continue;
+    }
+    BodySeg seg = {s->buf, 0, s->len};
+    b->src = s->pos;
+    out += body_escape_read(b, &seg, dst + out, room - out);
+    s->pos = b->src;
+  }
+  return out;
+}
+
+static size_t body_read_cb(char *buffer, size_t size, size_t nitems,
+                           void *userp) {
+  Body *b = (Body *)userp;
+  size_t room = size * nitems;
+  size_t written = 0;
+
+  while (room > 0 && b->cur < b->count) {
+    const BodySeg *seg = &b->segs[b->cur];
+    size_t n;
+    if (!seg->ptr) {
+      n = body_stream_read(b, buffer + written, room);
+      if (n == CURL_READFUNC_ABORT)
+        return CURL_READFUNC_ABORT;
+      written += n;
+      room -= n;
+      if (!b->stream->eof || b->stream->pos < b->stream->len ||
+          b->pend_pos < b->pend_len)
+        break; /* akış sürüyor: üretilen kadarı gitsin */
+      b->cur++;
+      b->off = 0;
+      b->src = 0;
+      b->pend_len = b->pend_pos = 0;
+      continue;
+    }
+    if (seg->raw_len) {
+      n = body_escape_read(b, seg, buffer + written, room);
+    } else {
+      n = seg->len - b->off;
+      if (n > room)
+        n = room;
+      memcpy(buffer + written, seg->ptr + b->off, n);
+    }
+    written += n;
+    room -= n;
+    b->off += n;
+    if (b->off == seg->len) {
+      b->cur++;
+      b->off = 0;
+      b->src = 0;
+      b->pend_len = b->pend_pos = 0;
+    }
+  }
+  return written;
+}
+
+/* Kaçırılan parçada çıktı konumuna karşılık gelen kaynak konumunu bulur */
+static void body_escape_seek(Body *b, const BodySeg *seg, size_t offset) {
+  size_t out = 0;
+  while (out < offset && b->src < seg->raw_len) {
+    size_t run = json_scan(seg->ptr + b->src, seg->raw_len - b->src);
+    if (out + run >= offset) {
+      b->src += offset - out;
+      return;
+    }
+    out += run;
+    b->src += run;
+    char esc[8];
+    size_t n = json_escape_char((unsigned char)seg->ptr[b->src++], esc);
+    if (out + n > offset) {
+      memcpy(b->pend, esc, n);
+      b->pend_len = n;
+      b->pend_pos = offset - out;
+      return;
+    }
+    out += n;
+  }
+}
+
+/* Yönlendirme / yeniden deneme durumunda curl gövdeyi başa sarabilsin */
+static int body_seek_cb(void *userp, curl_off_t offset, int origin) {
+  Body *b = (Body *)userp;
+  if (b->stream && (b->stream->started || offset != 0))
+    return CURL_SEEKFUNC_CANTSEEK; /* okunan stdin geri alınamaz */
+  if (origin != SEEK_SET || offset < 0 || offset > b->total)
+    return CURL_SEEKFUNC_CANTSEEK;
+  b->cur = 0;
+  b->off = 0;
+  b->src = 0;
+  b->pend_len = b->pend_pos = 0;
+  while (b->cur < b->count && offset >= (curl_off_t)b->segs[b->cur].len) {
+    offset -= (curl_off_t)b->segs[b->cur].len;
+    b->cur++;
+  }
+  b->off = (size_t)offset;
+  if (b->cur < b->count && b->segs[b->cur].raw_len)
+    body_escape_seek(b, &b->segs[b->cur], b->off);
+  return CURL_SEEKFUNC_OK;
+}
+
+static void body_attach(CURL *curl, Body *b) {
+  b->cur = 0;
+  b->off = 0;
+  b->src = 0;
+  b->pend_len = b->pend_pos = 0;
+  curl_easy_setopt(curl, CURLOPT_POST, 1L);
+  curl_easy_setopt(curl, CURLOPT_READFUNCTION, body_read_cb);
+  curl_easy_setopt(curl, CURLOPT_READDATA, (void *)b);
+  curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, body_seek_cb);
+  curl_easy_setopt(curl, CURLOPT_SEEKDATA, (void *)b);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, b->total);
+}
+
+/* ===== Cevap önbelleği =====
+   İsteğe bağlı (--cache / CHATGPT_CACHE=1). Anahtar, hedef URL ve
+   gönderilecek gövdenin kendisidir: URL, model, sistem mesajı, geçmiş, yeni
+   mesaj ve sıcaklık aynı sırayla tek bir XXH64 özetine akıtılır. Cevaplar
+   ~/.cache/chatgpt-cli-c/<özet>.ans dosyalarında durur; isabet olursa metin
+   aynı çıkış yolundan (emit_delta) basılır. Süre (CHATGPT_CACHE_TTL, sn) ve
+   toplam boyut (CHATGPT_CACHE_MAX_MB) sınırlıdır; sınır aşılınca en uzun
+   süredir kullanılmayan kayıtlar silinir (kullanım zamanı = mtime). */
+
+#define CACHE_MAGIC 0x31414743u /* "CGA1" */
+#define CACHE_DEFAULT_TTL (24 * 60 * 60)
+#define CACHE_DEFAULT_MAX_MB 64
+
+enum { CACHE_OFF = 0, CACHE_ON, CACHE_REFRESH };
+static int CACHE_MODE = CACHE_OFF;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t reserved;
+  uint64_t created;
+  uint64_t text_len;
+  int64_t prompt_tokens;
+  int64_t completion_tokens;
+  int64_t total_tokens;
+} CacheHeader;
+
+/* XXH64 (akış halinde) */
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+typedef struct {
+  uint64_t v[4];
+  uint64_t total;
+  unsigned char mem[32];
+  size_t memsize;
+} Xxh64;
+
+static uint64_t xxh_rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static uint64_t xxh_read64(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v; /* little-endian varsayımı (x86_64 / arm64) */
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+  acc += input * XXH_P2;
+  acc = xxh_rotl(acc, 31);
+  return acc * XXH_P1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+  acc ^= xxh_round(0, val);
+  return acc * XXH_P1 + XXH_P4;
+}
+
+static void xxh64_init(Xxh64 *x) {
+  memset(x, 0, sizeof(*x));
+  x->v[0] = XXH_P1 + XXH_P2;
+  x->v[1] = XXH_P2;
+  x->v[2] = 0;
+  x->v[3] = (uint64_t)0 - XXH_P1;
+}
+
+static void xxh64_update(Xxh64 *x, const void *data, size_t len) {
+  const unsigned char *p = data;
+  const unsigned char *end = p + len;
+  x->total += len;
+
+  if (x->memsize + len < 32) {
+    memcpy(x->mem + x->memsize, p, len);
+    x->memsize += len;
+    return;
+  }
+  if (x->memsize) {
+    size_t fill = 32 - x->memsize;
+    memcpy(x->mem + x->memsize, p, fill);
+    for (int i = 0; i < 4; i++)
+      x->v[i] = xxh_round(x->v[i], xxh_read64(x->mem + i * 8));
+    p += fill;
+    x->memsize = 0;
+  }
+  while (p + 32 <= end) {
+    for (int i = 0; i < 4; i++)
+      x->v[i] = xxh_round(x->v[i], xxh_read64(p + i * 8));
+    p += 32;
+  }
+  if (p < end) {
+    memcpy(x->mem, p, (size_t)(end - p));
+    x->memsize = (size_t)(end - p);
+  }
+}
+
+static uint64_t xxh64_digest(const Xxh64 *x) {
+  uint64_t h;
+  if (x->total >= 32) {
+    h = xxh_rotl(x->v[0], 1) + xxh_rotl(x->v[1], 7) + xxh_rotl(x->v[2], 12) +
+        xxh_rotl(x->v[3], 18);
+    for (int i = 0; i < 4; i++)
+      h = xxh_merge(h, x->v[i]);
+  } else {
+    h = x->v[2] + XXH_P5;
+  }
+  h += x->total;
+
+  const unsigned char *p = x->mem;
+  const unsigned char *end = p + x->memsize;
+  while (p + 8 <= end) {
+    h ^= xxh_round(0, xxh_read64(p));
+    h = xxh_rotl(h, 27) * XXH_P1 + XXH_P4;
+    p += 8;
+  }
+  if (p + 4 <= end) {
+    uint32_t k;
+    memcpy(&k, p, 4);
+    h ^= (uint64_t)k * XXH_P1;
+    h = xxh_rotl(h, 23) * XXH_P2 + XXH_P3;
+    p += 4;
+  }
+  while (p < end) {
+    h ^= (*p++) * XXH_P5;
+    h = xxh_rotl(h, 11) * XXH_P1;
+  }
+  h ^= h >> 33;
+  h *= XXH_P2;
+  h ^= h >> 29;
+  h *= XXH_P3;
+  h ^= h >> 32;
+  return h;
+}
+
+static uint64_t body_hash(const Body *b) {
+  Xxh64 x;
+  xxh64_init(&x);
+  /* Farklı uç noktaların (CHATGPT_API_URL) cevapları birbirine karışmasın */
+  const char *url = api_url();
+  xxh64_update(&x, url, strlen(url) + 1);
+  for (size_t i = 0; i < b->count; i++) {
+    const BodySeg *seg = &b->segs[i];
+    xxh64_update(&x, seg->ptr, seg->raw_len ? seg->raw_len : seg->len);
+  }
+  return xxh64_digest(&x);
+}
+
+static char *get_cache_dir(void) {
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (!home)
+    home = ".";
+  size_t len = (xdg && xdg[0] ? strlen(xdg) : strlen(home) + 7) +
+               strlen("/chatgpt-cli-c") + 1;
+  char *path = malloc(len);
+  if (!path)
+    return NULL;
+  if (xdg && xdg[0])
+    snprintf(path, len, "%s/chatgpt-cli-c", xdg);
+  else
+    snprintf(path, len, "%s/.cache/chatgpt-cli-c", home);
+  return path;
+}
+
+/* Dizini (ve bir üst dizinini) oluşturur; varsa dokunmaz */
+static void make_cache_dir(const char *dir) {
+  char parent[1024];
+  snprintf(parent, sizeof(parent), "%s", dir);
+  char *slash = strrchr(parent, '/');
+  if (slash && slash != parent) {
+    *slash = '\0';
+    mkdir(parent, 0700);
+  }
+  mkdir(dir, 0700);
+}
+
+static char *cache_path(uint64_t key) {
+  char *dir = get_cache_dir();
+  if (!dir)
+    return NULL;
+  size_t len = strlen(dir) + 1 + 16 + 4 + 1;
+  char *path = malloc(len);
+  if (path)
+    snprintf(path, len, "%s/%016llx.ans", dir, (unsigned long long)key);
+  free(dir);
+  return path;
+}
+
+static long env_long(const char *name, long def) {
+  const char *v = getenv(name);
+  if (!v || !v[0])
+    return def;
+  return strtol(v, NULL, 10);
+}
+
+/* İsabet varsa cevabı reply'a doldurur ve 1 döner */
+static int cache_lookup(uint64_t key, Reply *reply) {
+  char *path = cache_path(key);
+  if (!path)
+    return 0;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    free(path);
+    return 0;
+  }
+
+  int hit = 0;
+  CacheHeader h;
+  long ttl = env_long("CHATGPT_CACHE_TTL", CACHE_DEFAULT_TTL);
+  if (read(fd, &h, sizeof(h)) == (ssize_t)sizeof(h) &&
+      h.magic == CACHE_MAGIC && h.text_len < ((uint64_t)1 << 32)) {
+    if (ttl > 0 && (uint64_t)time(NULL) > h.created + (uint64_t)ttl) {
+      unlink(path); /* süresi dolmuş */
+    } else if (sb_reserve(&reply->text, (size_t)h.text_len) == 0 &&
+               read(fd, reply->text.data, (size_t)h.text_len) ==
+                   (ssize_t)h.text_len) {
+      reply->text.len = (size_t)h.text_len;
+      reply->text.data[reply->text.len] = '\0';
+      reply->prompt_tokens = h.prompt_tokens;
+      reply->completion_tokens = h.completion_tokens;
+      reply->total_tokens = h.total_tokens;
+      futimens(fd, NULL); /* LRU: son kullanım */
+      hit = 1;
+    }
+  }
+  close(fd);
+  free(path);
+  return hit;
+}
+
+typedef struct {
+  char *name;
+  off_t size;
+  time_t used;
+} CacheEntry;
+
+static int cache_entry_cmp(const void *a, const void *b) {
+  const CacheEntry *x = a, *y = b;
+  return (x->used > y->used) - (x->used < y->used);
+}
+
+/* Toplam boyut sınırı aşıldıysa en eski kullanılanlardan başlayarak sil */
+static void cache_evict(const char *dir) {
+  long max_mb = env_long("CHATGPT_CACHE_MAX_MB", CACHE_DEFAULT_MAX_MB);
+  off_t limit = (off_t)max_mb * 1024 * 1024;
+  DIR *d = opendir(dir);
+  if (!d)
+    return;
+
+  CacheEntry *ents = NULL;
+  size_t n = 0, cap = 0;
+  off_t total = 0;
+  struct dirent *de;
+  while ((de = readdir(d))) {
+    size_t l = strlen(de->d_name);
+    if (l < 5 || strcmp(de->d_name + l - 4, ".ans") != 0)
+      continue;
+    struct stat st;
+    if (fstatat(dirfd(d), de->d_name, &st, 0) != 0)
+      continue;
+    if (n == cap) {
+      cap = cap ? cap * 2 : 64;
+      CacheEntry *tmp = realloc(ents, cap * sizeof(CacheEntry));
+      if (!tmp)
+        break;
+      ents = tmp;
+    }
+    ents[n].name = my_strdup(de->d_name);
+    ents[n].size = st.st_size;
+    ents[n].used = st.st_mtime;
+    total += st.st_size;
+    n++;
+  }
+
+  if (total > limit) {
+    qsort(ents, n, sizeof(CacheEntry), cache_entry_cmp);
+    /* Sınırın %90'ına inene kadar sil ki her yazımda tekrar taranmasın */
+    for (size_t i = 0; i < n && total > limit / 10 * 9; i++) {
+      if (unlinkat(dirfd(d), ents[i].name, 0) == 0)
+        total -= ents[i].size;
+    }
+  }
+  for (size_t i = 0; i < n; i++)
+    free(ents[i].name);
+  free(ents);
+  closedir(d);
+}
+
+static void cache_store(uint64_t key, const Reply *reply) {
+  char *dir = get_cache_dir();
+  char *path = cache_path(key);
+  if (!dir || !path) {
+    free(dir);
+    free(path);
+    return;
+  }
+  make_cache_dir(dir);
+
+  /* Yarım yazılmış dosya okunmasın: geçici dosyaya yaz, sonra rename */
+  size_t tlen = strlen(path) + 5;
+  char *tmp = malloc(tlen);
+  if (tmp) {
+    snprintf(tmp, tlen, "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0) {
+      CacheHeader h = {CACHE_MAGIC,
+                       0,
+                       (uint64_t)time(NULL),
+                       reply->text.len,
+                       reply->prompt_tokens,
+                       reply->completion_tokens,
+                       reply->total_tokens};
+      struct iovec iov[2] = {{&h, sizeof(h)},
+                             {reply->text.data, reply->text.len}};
+      ssize_t want = (ssize_t)(sizeof(h) + reply->text.len);
+      int ok = writev(fd, iov, 2) == want;
+      close(fd);
+      if (ok && rename(tmp, path) == 0)
+        cache_evict(dir);
+      else
+        unlink(tmp);
+    }
+    free(tmp);
+  }
+  free(dir);
+  free(path);
+}
+
+/* ===== Dosya ekleri (/read) =====
+   Dosya kopyalanmaz: belleğe eşlenir (mmap) ve sadece referansı tutulur.
+   İçerik gövdeye kaçırılmış parça olarak eklenir, yani eşlemeden doğrudan
+   kaçırılarak gönderilir. Token bütçesini (CHATGPT_READ_TOKENS, varsayılan
+   ATTACH_DEFAULT_TOKENS) aşan dosyaların tamamı gönderilmez. Onların yerine
+   baştan, sondan ve desene uyan satırların çevresinden satır sınırında
+   kesilmiş pencereler gider; atlanan kısımlar bayt sayısıyla belirtilir.
+
+   Dizinler ve glob desenleri (*, ?, [..] ve dizin atlayan **) dosya
+   listesine açılır; .gitignore'a uyan yollar, gizli dizinler ve ikili
+   dosyalar atlanır.
+   Dosyalar küçük bir iş parçacığı havuzunda eşlenip XXH64 ile özetlenir.
+   Gönderilen dosyalar tur kimliğiyle kaydedilir; aynı içerik o tur hâlâ
+   bağlamdayken tekrar eklenirse sadece adıyla anılır, yani sonraki
+   turlarda yalnız değişen dosyalar gider. */
+
+#define ATTACH_DEFAULT_TOKENS 32000
+#define ATTACH_MIN_TOKENS 256
+#define ATTACH_CONTEXT_LINES 2
+#define ATTACH_DEFAULT_GREP "error|fail|exception|fatal|panic|traceback|warn"
+#define ATTACH_MAX_FILES 500
+#define ATTACH_THREADS 8
+#define ATTACH_BINARY_PROBE 8000 /* git'in ikili dosya sezgisi */
+
+typedef struct {
+  size_t off, len; /* dosyadaki pencere */
+  size_t esc_len;
+  size_t pre_off, pre_len; /* öncesindeki metin (text içinde) */
+} AttachWin;
+
+typedef struct Attach {
+  char *path;
+  char *grep; /* '|' ile ayrılmış desenler; NULL = varsayılan */
+  const char *data;
+  size_t size;
+  int mapped; /* 1 = munmap, 0 = free */
+  dev_t dev;   /* eşlenen dosyanın kimliği ve /read anındaki mtime'ı */
+  ino_t ino;
+  struct timespec mtime;
+  uint64_t hash;
+  const char *ref; /* bağlamda aynı içerikle duran dosya; NULL = gönder */
+
+  /* attach_plan() çıktısı */
+  AttachWin *wins;
+  size_t win_count, win_cap;
+  StrBuf text; /* başlık, ayraçlar ve kapanış (kaçırılmamış) */
+  size_t post_off, post_len;
+  size_t tokens;
+  size_t sent; /* gönderilen dosya baytı */
+
+  struct Attach *next;
+} Attach;
+
+static Attach *PENDING_ATTACH = NULL;
+
+static size_t attach_limit(void) {
+  const char *env = getenv("CHATGPT_READ_TOKENS");
+  if (env && env[0] != '\0')
+    return (size_t)strtoul(env, NULL, 10);
+  return ATTACH_DEFAULT_TOKENS;
+}
+
+static void attach_free(Attach *a) {
+  while (a) {
+    Attach *next = a->next;
+    if (a->mapped)
+      munmap((void *)a->data, a->size);
+    else
+      free((void *)a->data);
+    free(a->path);
+    free(a->grep);
+    free(a->wins);
+    sb_free(&a->text);
+    free(a);
+    a = next;
+  }
+}
+
+/* Dosyayı eşler; eşlenemeyen (boru, özel dosya) girdiler okunarak alınır */
+static Attach *attach_open(const char *path, const char *grep) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || S_ISDIR(st.st_mode)) {
+    close(fd);
+    return NULL;
+  }
+  Attach *a = calloc(1, sizeof(Attach));
+  if (!a) {
+    close(fd);
+    return NULL;
+  }
+  if (S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m != MAP_FAILED) {
+      madvise(m, (size_t)st.st_size, MADV_SEQUENTIAL);
+      a->data = m;
+      a->size = (size_t)st.st_size;
+      a->mapped = 1;
+      a->dev = st.st_dev;
+      a->ino = st.st_ino;
+      a->mtime = st.st_mtim;
+    }
+  }
+  close(fd);
+  if (!a->mapped) {
+    char *content = read_file_len(path, &a->size);
+    if (!content) {
+      free(a);
+      return NULL;
+    }
+    a->data = content;
+  }
+  a->path = my_strdup(path);
+  a->grep = grep && grep[0] ? my_strdup(grep) : NULL;
+  sb_init(&a->text);
+  return a;
+}
+
+/* Gönderimden hemen önce çağrılır. /read ile gönderim arasında yerinde
+   değiştirilen (kesilen, üzerine yazılan) dosyanın eşlemi okunursa SIGBUS
+   alınabilir; böyle dosyaların güncel içeriği belleğe kopyalanır ve özeti
+   yenilenir. Taşınmış/silinmiş dosyanın eşlemi eski inode'u tuttuğu için
+   güvenlidir ve olduğu gibi kalır. */
+static void attach_settle(Attach *list) {
+  for (Attach *a = list; a; a = a->next) {
+    struct stat st;
+    if (!a->mapped || stat(a->path, &st) != 0 || st.st_dev != a->dev ||
+        st.st_ino != a->ino)
+      continue;
+    if ((size_t)st.st_size == a->size &&
+        st.st_mtim.tv_sec == a->mtime.tv_sec &&
+        st.st_mtim.tv_nsec == a->mtime.tv_nsec)
+      continue;
+    size_t len = 0;
+    char *content = read_file_len(a->path, &len);
+    munmap((void *)a->data, a->size);
+    a->mapped = 0;
+    a->data = content ? content : my_strdup("");
+    a->size = content ? len : 0;
+    Xxh64 x;
+    xxh64_init(&x);
+    xxh64_update(&x, a->data, a->size);
+    a->hash = xxh64_digest(&x);
+    fprintf(stderr, "%s[!] %s okunduktan sonra değişti; güncel hâli "
+                    "gönderiliyor.%s\n",
+            COLOR_ERROR, a->path, COLOR_RESET);
+  }
+}
+
+/* ---- Bağlamdaki dosyalar ---- */
+
+typedef struct {
+  char *path;
+  uint64_t hash;
+  size_t size;
+  uint64_t turn; /* dosyayı taşıyan turun kimliği */
+} CtxFile;
+
+static CtxFile *CTX_FILES = NULL;
+static size_t CTX_FILE_COUNT = 0, CTX_FILE_CAP = 0;
+
+/* Tur kimliğinin geçmişteki sırası; yoksa HIST.count */
+static size_t hist_index_of(uint64_t id) {
+  for (size_t i = 0; i < HIST.count; i++)
+    if (hist_at(i)->id == id)
+      return i;
+  return HIST.count;
+}
+
+/* Aynı içerik, gönderilecek en eski turdan (first) itibaren bağlamda mı? */
+static const char *ctx_lookup(const Attach *a, size_t first) {
+  for (size_t i = 0; i < CTX_FILE_COUNT; i++) {
+    const CtxFile *f = &CTX_FILES[i];
+    if (f->hash != a->hash || f->size != a->size)
+      continue;
+    size_t idx = hist_index_of(f->turn);
+    if (idx < HIST.count && idx >= first)
+      return f->path;
+  }
+  return NULL;
+}
+
+static void ctx_register(const Attach *a, uint64_t turn) {
+  /* Düşmüş turlara ait ve aynı yoldaki eski kayıtları at */
+  size_t w = 0;
+  for (size_t i = 0; i < CTX_FILE_COUNT; i++) {
+    CtxFile *f = &CTX_FILES[i];
+    if (hist_index_of(f->turn) == HIST.count || !strcmp(f->path, a->path)) {
+      free(f->path);
+      continue;
+    }
+    CTX_FILES[w++] = *f;
+  }
+  CTX_FILE_COUNT = w;
+  if (CTX_FILE_COUNT == CTX_FILE_CAP) {
+    size_t cap = CTX_FILE_CAP ? CTX_FILE_CAP * 2 : 32;
+    CtxFile *tmp = realloc(CTX_FILES, cap * sizeof(CtxFile));
+    if (!tmp)
+      return;
+    CTX_FILES = tmp;
+    CTX_FILE_CAP = cap;
+  }
+  char *path = my_strdup(a->path);
+  if (!path)
+    return;
+  CtxFile *f = &CTX_FILES[CTX_FILE_COUNT++];
+  f->path = path;
+  f->hash = a->hash;
+  f->size = a->size;
+  f->turn = turn;
+}
+
+static void ctx_free(void) {
+  for (size_t i = 0; i < CTX_FILE_COUNT; i++)
+    free(CTX_FILES[i].path);
+  free(CTX_FILES);
+  CTX_FILES = NULL;
+  CTX_FILE_COUNT = CTX_FILE_CAP = 0;
+}
+
+/* ---- Yol listesi: dizin ve glob açılımı ---- */
+
+typedef struct {
+  char **v;
+  size_t n, cap;
+  size_t ignored; /* .gitignore ile atlanan */
+  int truncated;  /* ATTACH_MAX_FILES aşıldı */
+} PathList;
+
+static void path_list_free(PathList *pl) {
+  for (size_t i = 0; i < pl->n; i++)
+    free(pl->v[i]);
+  free(pl->v);
+  memset(pl, 0, sizeof(*pl));
+}
+
+static void path_list_push(PathList *pl, const char *path) {
+  if (pl->n == pl->cap) {
+    size_t cap = pl->cap ? pl->cap * 2 : 64;
+    char **tmp = realloc(pl->v, cap * sizeof(char *));
+    if (!tmp)
+      return;
+    pl->v = tmp;
+    pl->cap = cap;
+  }
+  char *p = my_strdup(path);
+  if (p)
+    pl->v[pl->n++] = p;
+}
+
+/* Sonuç listesine ekler; ATTACH_MAX_FILES dolunca truncated işaretlenir */
+static void path_list_add(PathList *pl, const char *path) {
+  if (pl->n >= ATTACH_MAX_FILES) {
+    pl->truncated = 1;
+    return;
+  }
+  path_list_push(pl, path);
+}
+
+static int cmp_str(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+typedef struct {
+  char *base; /* .gitignore'un bulunduğu dizin (mutlak) */
+  char *pat;
+  int neg, dir_only, anchored;
+} IgnoreRule;
+
+typedef struct {
+  IgnoreRule *v;
+  size_t n, cap;
+} Ignore;
+
+static void ignore_truncate(Ignore *ig, size_t n) {
+  while (ig->n > n) {
+    ig->n--;
+    free(ig->v[ig->n].base);
+    free(ig->v[ig->n].pat);
+  }
+}
+
+/* dir/.gitignore satırlarını kurallara ekler (yorum, !, sonda /, başta /) */
+static void ignore_load(Ignore *ig, const char *dir) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/.gitignore", dir);
+  char *content = read_file(path);
+  if (!content)
+    return;
+  for (char *line = strtok(content, "\n"); line; line = strtok(NULL, "\n")) {
+    trim(line);
+    if (!line[0] || line[0] == '#')
+      continue;
+    IgnoreRule r = {0};
+    if (line[0] == '!') {
+      r.neg = 1;
+      line++;
+    }
+    size_t l = strlen(line);
+    if (l > 0 && line[l - 1] == '/') {
+      r.dir_only = 1;
+      line[--l] = '\0';
+    }
+    if (line[0] == '/') {
+      r.anchored = 1;
+      line++;
+    } else if (strchr(line, '/')) {
+      r.anchored = 1;
+    }
+    if (!line[0])
+      continue;
+    if (ig->n == ig->cap) {
+      size_t cap = ig->cap ? ig->cap * 2 : 32;
+      IgnoreRule *tmp = realloc(ig->v, cap * sizeof(IgnoreRule));
+      if (!tmp)
+        break;
+      ig->v = tmp;
+      ig->cap = cap;
+    }
+    r.base = my_strdup(dir);
+    r.pat = my_strdup(line);
+    if (!r.base || !r.pat) {
+      free(r.base);
+      free(r.pat);
+      continue;
+    }
+    ig->v[ig->n++] = r;
+  }
+  free(content);
+}
+
+/* Son uyan kural kazanır (git'teki gibi); abs mutlak yoldur */
+static int ignore_match(const Ignore *ig, const char *abs, int is_dir) {
+  int ignored = 0;
+  const char *name = strrchr(abs, '/');
+  name = name ? name + 1 : abs;
+  for (size_t i = 0; i < ig->n; i++) {
+    const IgnoreRule *r = &ig->v[i];
+    if (r->dir_only && !is_dir)
+      continue;
+    size_t bl = strlen(r->base);
+    if (strncmp(abs, r->base, bl) != 0 || (abs[bl] != '/' && bl > 1))
+      continue;
+    const char *rel = abs + bl + (bl > 1);
+    int hit;
+    if (r->anchored)
+      hit = fnmatch(r->pat, rel, strstr(r->pat, "**") ? 0 : FNM_PATHNAME) == 0;
+    else
+      hit = fnmatch(r->pat, name, 0) == 0;
+    if (hit)
+      ignored = !r->neg;
+  }
+  return ignored;
+}
+
+static void join_path(char *out, size_t size, const char *dir, const char *name) {
+  if (!dir[0] || !strcmp(dir, "."))
+    snprintf(out, size, "%s", name);
+  else if (dir[strlen(dir) - 1] == '/')
+    snprintf(out, size, "%s%s", dir, name);
+  else
+    snprintf(out, size, "%s/%s", dir, name);
+}
+
+/* segs[i..] desenini disp (gösterilen) / abs (mutlak) dizininde arar.
+   "**" sıfır ya da daha fazla dizine uyar. */
+static void glob_walk(PathList *pl, Ignore *ig, const char *disp,
+                      const char *abs, char **segs, int nseg, int i) {
+  if (pl->truncated)
+    return;
+  size_t mark = ig->n;
+  ignore_load(ig, abs);
+
+  int star2 = !strcmp(segs[i], "**");
+  if (star2)
+    glob_walk(pl, ig, disp, abs, segs, nseg, i + 1);
+
+  DIR *d = opendir(abs);
+  if (d) {
+    /* Sıra dosya sisteminden bağımsız olsun: desene uyan adların hepsi
+       toplanıp sıralanır, sınır ancak sonuç listesinde uygulanır. */
+    PathList names = {0};
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+      const char *name = e->d_name;
+      if (!strcmp(name, ".") || !strcmp(name, "..") || !strcmp(name, ".git"))
+        continue;
+      if (star2 ? name[0] == '.' : fnmatch(segs[i], name, FNM_PERIOD) != 0)
+        continue;
+      path_list_push(&names, name);
+    }
+    closedir(d);
+    qsort(names.v, names.n, sizeof(char *), cmp_str);
+
+    for (size_t k = 0; k < names.n && !pl->truncated; k++) {
+      const char *name = names.v[k];
+      char cdisp[4096], cabs[4096];
+      join_path(cdisp, sizeof(cdisp), disp, name);
+      join_path(cabs, sizeof(cabs), abs, name);
+      struct stat st;
+      if (stat(cabs, &st) != 0)
+        continue;
+      int is_dir = S_ISDIR(st.st_mode);
+      if (star2 && !is_dir)
+        continue;
+      /* "**" dizine bağlı sembolik bağlara inmez: "sub/loop -> .." gibi bir
+         bağ aynı ağacı ELOOP'a kadar tekrar tekrar gezdirirdi */
+      struct stat lst;
+      if (star2 && (lstat(cabs, &lst) != 0 || S_ISLNK(lst.st_mode)))
+        continue;
+      if (ignore_match(ig, cabs, is_dir)) {
+        pl->ignored++;
+        continue;
+      }
+      if (star2) {
+        glob_walk(pl, ig, cdisp, cabs, segs, nseg, i);
+      } else if (i + 1 == nseg) {
+        if (S_ISREG(st.st_mode))
+          path_list_add(pl, cdisp);
+      } else if (is_dir) {
+        glob_walk(pl, ig, cdisp, cabs, segs, nseg, i + 1);
+      }
+    }
+    path_list_free(&names);
+  }
+  ignore_truncate(ig, mark);
+}
+
+/* /read argümanını dosya listesine açar. Tek dosya olduğu gibi kalır (1
+   döner); dizin altındaki tüm dosyalar (** ve *) olarak, glob ise joker
+   içermeyen önekinden itibaren aranır (0). Hata: -1. */
+static int attach_expand(const char *arg, PathList *pl) {
+  char pat[4096];
+  snprintf(pat, sizeof(pat), "%s", arg);
+  size_t l = strlen(pat);
+  while (l > 1 && pat[l - 1] == '/')
+    pat[--l] = '\0';
+
+  char *segs[64];
+  int nseg = 0;
+  char root[4096];
+  struct stat st;
+  if (!strpbrk(pat, "*?[")) {
+    if (stat(pat, &st) != 0)
+      return -1;
+    if (!S_ISDIR(st.st_mode)) {
+      path_list_add(pl, pat);
+      return 1;
+    }
+    snprintf(root, sizeof(root), "%s", pat);
+    segs[nseg++] = "**";
+    segs[nseg++] = "*";
+  } else {
+    /* Joker içermeyen baştaki bölümler kök dizindir */
+    root[0] = '\0';
+    char *p = pat;
+    if (*p == '/') {
+      snprintf(root, sizeof(root), "/");
+      p++;
+    }
+    for (char *s = strtok(p, "/"); s && nseg < 64; s = strtok(NULL, "/")) {
+      if (nseg == 0 && !strpbrk(s, "*?[")) {
+        size_t rl = strlen(root);
+        snprintf(root + rl, sizeof(root) - rl, "%s%s",
+                 rl && root[rl - 1] != '/' ? "/" : "", s);
+        continue;
+      }
+      segs[nseg++] = s;
+    }
+    if (nseg == 0)
+      return -1;
+    if (!root[0])
+      snprintf(root, sizeof(root), ".");
+  }
+
+  char abs[4096];
+  if (!realpath(root, abs))
+    return -1;
+
+  /* Üst dizinlerdeki .gitignore'lar: depo köküne (.git) kadar, dıştan
+     içe. Kök dizinin kendi dosyası yürüyüşte okunur. */
+  Ignore ig = {0};
+  char *chain[64];
+  int depth = 0;
+  char dir[4096], git[4200];
+  snprintf(dir, sizeof(dir), "%s", abs);
+  for (;;) {
+    snprintf(git, sizeof(git), "%s/.git", dir);
+    char *slash = strrchr(dir, '/');
+    if (access(git, F_OK) == 0 || !slash || !strcmp(dir, "/") || depth == 64)
+      break;
+    slash[slash == dir] = '\0';
+    chain[depth++] = my_strdup(dir);
+  }
+  for (int k = depth - 1; k >= 0; k--) {
+    if (chain[k])
+      ignore_load(&ig, chain[k]);
+    free(chain[k]);
+  }
+
+  glob_walk(pl, &ig, strcmp(root, ".") ? root : "", abs, segs, nseg, 0);
+  ignore_truncate(&ig, 0);
+  free(ig.v);
+  return 0;
+}
+
+/* ---- Paralel okuma ---- */
+
+typedef struct {
+  PathList *paths;
+  Attach **out;
+  size_t next;
+  int filter_binary;
+  pthread_mutex_t lock;
+} ReadPool;
+
+static void *read_worker(void *arg) {
+  ReadPool *rp = (ReadPool *)arg;
+  for (;;) {
+    pthread_mutex_lock(&rp->lock);
+    size_t i = rp->next++;
+    pthread_mutex_unlock(&rp->lock);
+    if (i >= rp->paths->n)
+      break;
+    Attach *a = attach_open(rp->paths->v[i], NULL);
+    if (!a)
+      continue;
+    size_t probe = a->size < ATTACH_BINARY_PROBE ? a->size : ATTACH_BINARY_PROBE;
+    if (rp->filter_binary && memchr(a->data, '\0', probe)) {
+      attach_free(a);
+      continue;
+    }
+    Xxh64 x;
+    xxh64_init(&x);
+    xxh64_update(&x, a->data, a->size);
+    a->hash = xxh64_digest(&x);
+    rp->out[i] = a;
+  }
+  return NULL;
+}
+
+/* Listedeki dosyaları havuzda eşler ve özetler; sıra korunur. Okunamayan
+   ve (filter_binary ise) ikili dosyalar listeye girmez. */
+static Attach *attach_load(PathList *pl, int filter_binary, size_t *skipped) {
+  *skipped = 0;
+  if (pl->n == 0)
+    return NULL;
+  ReadPool rp = {.paths = pl, .filter_binary = filter_binary};
+  rp.out = calloc(pl->n, sizeof(Attach *));
+  if (!rp.out)
+    return NULL;
+  pthread_mutex_init(&rp.lock, NULL);
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t nthreads = cpus > 0 ? (size_t)cpus : 1;
+  if (nthreads > ATTACH_THREADS)
+    nthreads = ATTACH_THREADS;
+  if (nthreads > pl->n)
+    nthreads = pl->n;
+  pthread_t tids[ATTACH_THREADS];
+  size_t started = 0;
+  for (size_t t = 1; t < nthreads; t++)
+    if (pthread_create(&tids[started], NULL, read_worker, &rp) == 0)
+      started++;
+  read_worker(&rp);
+  for (size_t t = 0; t < started; t++)
+    pthread_join(tids[t], NULL);
+  pthread_mutex_destroy(&rp.lock);
+
+  Attach *head = NULL, **tail = &head;
+  for (size_t i = 0; i < pl->n; i++) {
+    if (!rp.out[i]) {
+      (*skipped)++;
+      continue;
+    }
+    *tail = rp.out[i];
+    tail = &rp.out[i]->next;
+  }
+  free(rp.out);
+  return head;
+}
+
+/* Bekleyen eklere ekler; aynı yol tekrar okunduysa eskisinin yerini alır */
+static void attach_push(Attach **list, Attach *add) {
+  while (add) {
+    Attach *next = add->next;
+    add->next = NULL;
+    Attach **p = list;
+    while (*p && strcmp((*p)->path, add->path) != 0)
+      p = &(*p)->next;
+    if (*p) {
+      add->next = (*p)->next;
+      (*p)->next = NULL;
+      attach_free(*p);
+    }
+    *p = add;
+    add = next;
+  }
+}
+
+/* ---- Örnekleme ---- */
+
+/* Satır sınırına hizalama: pos'tan önceki son satır başı; satır yoksa
+   UTF-8 karakter sınırı */
+static size_t attach_floor(const Attach *a, size_t lo, size_t pos) {
+  if (pos >= a->size)
+    return a->size;
+  for (size_t i = pos; i > lo; i--)
+    if (a->data[i - 1] == '\n')
+      return i;
+  while (pos > lo && ((unsigned char)a->data[pos] & 0xC0) == 0x80)
+    pos--;
+  return pos;
+}
+
+/* pos'tan sonraki ilk satır başı; satır yoksa `hi` */
+static size_t attach_eol(const Attach *a, size_t pos, size_t hi) {
+  const char *nl = memchr(a->data + pos, '\n', hi - pos);
+  return nl ? (size_t)(nl - a->data) + 1 : hi;
+}
+
+static size_t attach_ceil(const Attach *a, size_t pos) {
+  size_t e = attach_eol(a, pos, a->size);
+  if (e < a->size || (e > pos && a->data[e - 1] == '\n'))
+    return e;
+  while (pos < a->size && ((unsigned char)a->data[pos] & 0xC0) == 0x80)
+    pos++;
+  return pos;
+}
+
+static int attach_add_win(Attach *a, size_t off, size_t len) {
+  if (len == 0)
+    return 0;
+  if (a->win_count > 0) {
+    AttachWin *last = &a->wins[a->win_count - 1];
+    if (off <= last->off + last->len) {
+      if (off + len > last->off + last->len)
+        last->len = off + len - last->off;
+      return 0;
+    }
+  }
+  if (a->win_count == a->win_cap) {
+    size_t cap = a->win_cap ? a->win_cap * 2 : 16;
+    AttachWin *tmp = realloc(a->wins, cap * sizeof(AttachWin));
+    if (!tmp)
+      return -1;
+    a->wins = tmp;
+    a->win_cap = cap;
+  }
+  AttachWin *w = &a->wins[a->win_count++];
+  memset(w, 0, sizeof(*w));
+  w->off = off;
+  w->len = len;
+  return 0;
+}
+
+/* [lo, hi) aralığında desene uyan satırları, çevresindeki birkaç satırla
+   birlikte toplam en fazla `budget` bayt olacak şekilde ekler. Desenler
+   tek geçişte aranır; ilk harf tablosu aday olmayan baytları eler. */
+static void attach_grep(Attach *a, size_t lo, size_t hi, size_t budget) {
+  char pats[256];
+  snprintf(pats, sizeof(pats), "%s", a->grep ? a->grep : ATTACH_DEFAULT_GREP);
+  const char *pat[16];
+  size_t pat_len[16];
+  int np = 0;
+  unsigned char first[256] = {0};
+  for (char *tok = strtok(pats, "|"); tok && np < 16; tok = strtok(NULL, "|")) {
+    pat[np] = tok;
+    pat_len[np] = strlen(tok);
+    unsigned char c = (unsigned char)tok[0];
+    first[c] = 1;
+    if (c >= 'a' && c <= 'z')
+      first[c - 32] = 1;
+    else if (c >= 'A' && c <= 'Z')
+      first[c + 32] = 1;
+    np++;
+  }
+
+  size_t used = 0;
+  size_t i = lo;
+  while (np > 0 && i < hi && used + 64 < budget) {
+    if (!first[(unsigned char)a->data[i]]) {
+      i++;
+      continue;
+    }
+    int hit = 0;
+    for (int k = 0; k < np && !hit; k++)
+      hit = pat_len[k] <= hi - i &&
+            strncasecmp(a->data + i, pat[k], pat_len[k]) == 0;
+    if (!hit) {
+      i++;
+      continue;
+    }
+    /* Eşleşen satır ve çevresi; çok uzun satırlardan sadece bir dilim */
+    size_t start = attach_floor(a, lo, i);
+    size_t end = attach_eol(a, i, hi);
+    if (end - start > 1024) {
+      if (i - start > 256)
+        start = attach_floor(a, i - 256, i - 256);
+      if (end - i > 768)
+        end = attach_floor(a, i, i + 768);
+    } else {
+      for (int n = 0; n < ATTACH_CONTEXT_LINES && start > lo; n++)
+        start = attach_floor(a, lo, start - 1);
+      for (int n = 0; n < ATTACH_CONTEXT_LINES && end < hi; n++)
+        end = attach_eol(a, end, hi);
+    }
+    size_t prev = a->win_count ? a->wins[a->win_count - 1].off +
+                                     a->wins[a->win_count - 1].len
+                               : 0;
+    size_t add = end - (start > prev ? start : prev);
+    if (used + add <= budget) {
+      attach_add_win(a, start, end - start);
+      used += add;
+    }
+    i = end > i ? end : i + 1;
+  }
+}
+
+static void attach_text(Attach *a, const char *s) {
+  sb_append(&a->text, s);
+}
+
+static void attach_omitted(Attach *a, size_t bytes) {
+  char msg[64];
+  snprintf(msg, sizeof(msg), "[... %zu bytes omitted ...]\n", bytes);
+  attach_text(a, msg);
+}
+
+/* Dosya kapanışı; listenin sonuncusu kullanıcıya yönelik notu da taşır */
+static void attach_close(Attach *a, size_t pos, int many) {
+  if (pos > 0 && pos <= a->size && a->data[pos - 1] != '\n')
+    attach_text(a, "\n");
+  attach_text(a, "----------------\n");
+  if (!a->next)
+    attach_text(a, many ? "User instruction: I have attached files above. "
+                          "Please acknowledge them and wait for my "
+                          "question.\n"
+                        : "User instruction: I have attached a file above. "
+                          "Please acknowledge it and wait for my "
+                          "question.\n");
+}
+
+/* Bağlamda zaten duran dosya: içerik yerine sadece adı */
+static void attach_plan_ref(Attach *a, int many) {
+  a->win_count = 0;
+  a->text.len = 0;
+  a->sent = 0;
+  attach_text(a, "\n\n--- FILE: ");
+  attach_text(a, a->path);
+  if (strcmp(a->ref, a->path) != 0) {
+    attach_text(a, " (identical to ");
+    attach_text(a, a->ref);
+    attach_text(a, ", content above)");
+  } else {
+    attach_text(a, " (unchanged, content above)");
+  }
+  attach_text(a, " ---\n");
+  a->post_off = 0;
+  attach_close(a, 0, many);
+  a->post_len = a->text.len;
+  a->tokens = (a->text.len + 3) / 4;
+}
+
+/* Pencereleri seçer ve gövdede araya girecek metinleri hazırlar. Sonuç
+   (başlık ve ayraçlar dahil) yaklaşık en fazla `limit` token tutar. */
+static int attach_plan(Attach *a, size_t limit, int many) {
+  a->win_count = 0;
+  a->text.len = 0;
+  size_t whole = 0;
+  if (a->size <= limit * 8)
+    whole = count_tokens(a->data, a->size);
+  if (a->size <= limit * 8 && whole + 64 <= limit) {
+    attach_add_win(a, 0, a->size);
+  } else if (limit > 128) {
+    /* Token başına bayt, dosyanın başından ölçülür */
+    size_t probe = a->size < 65536 ? a->size : 65536;
+    size_t pt = count_tokens(a->data, probe);
+    double ratio = pt ? (double)probe / (double)pt : 4.0;
+    double scale = 0.9;
+    for (int round = 0; round < 4; round++) {
+      a->win_count = 0;
+      size_t bytes = (size_t)((double)limit * ratio * scale);
+      if (bytes > a->size)
+        bytes = a->size;
+      size_t head = attach_floor(a, 0, bytes * 3 / 8);
+      size_t tail = attach_ceil(a, a->size - bytes * 3 / 8);
+      if (tail < head)
+        tail = head;
+      attach_add_win(a, 0, head);
+      size_t side = head + (a->size - tail);
+      if (tail > head && bytes > side)
+        attach_grep(a, head, tail, bytes - side);
+      attach_add_win(a, tail, a->size - tail);
+
+      size_t t = 64 + a->win_count * 16;
+      for (size_t i = 0; i < a->win_count; i++)
+        t += count_tokens(a->data + a->wins[i].off, a->wins[i].len);
+      if (t <= limit)
+        break;
+      scale *= (double)limit / (double)t * 0.9;
+    }
+  }
+
+  /* Araya girecek metinler: başlık, atlanan bölümler, kapanış */
+  size_t sent = 0;
+  for (size_t i = 0; i < a->win_count; i++)
+    sent += a->wins[i].len;
+  a->sent = sent;
+  attach_text(a, "\n\n--- FILE: ");
+  attach_text(a, a->path);
+  if (sent < a->size) {
+    char msg[128];
+    snprintf(msg, sizeof(msg),
+             " (excerpts: %zu of %zu bytes; head, tail and matching lines)",
+             sent, a->size);
+    attach_text(a, msg);
+  }
+  attach_text(a, " ---\n");
+  size_t pos = 0;
+  for (size_t i = 0; i < a->win_count; i++) {
+    AttachWin *w = &a->wins[i];
+    if (i > 0)
+      w->pre_off = a->text.len;
+    if (w->off > pos) {
+      if (pos > 0 && a->data[pos - 1] != '\n')
+        attach_text(a, "\n");
+      attach_omitted(a, w->off - pos);
+    }
+    w->pre_len = a->text.len - w->pre_off;
+    w->esc_len = json_escaped_len(a->data + w->off, w->len);
+    pos = w->off + w->len;
+  }
+  a->post_off = a->win_count ? a->text.len : 0;
+  if (pos < a->size) {
+    if (pos > 0 && a->data[pos - 1] != '\n')
+      attach_text(a, "\n");
+    attach_omitted(a, a->size - pos);
+    pos = 0;
+  }
+  attach_close(a, pos, many);
+  a->post_len = a->text.len - a->post_off;
+  if (!a->text.data)
+    return -1;
+
+  a->tokens = (a->text.len + 3) / 4;
+  for (size_t i = 0; i < a->win_count; i++)
+    a->tokens += count_tokens(a->data + a->wins[i].off, a->wins[i].len);
+  return 0;
+}
+
+static int cmp_attach_size(const void *x, const void *y) {
+  const Attach *a = *(Attach *const *)x, *b = *(Attach *const *)y;
+  return a->size < b->size ? -1 : a->size > b->size;
+}
+
+/* Tüm ekleri planlar. Bağlamda (first ve sonrası turlarda) ya da bu
+   mesajda daha önce aynı içerikle duran dosyalar anılmakla yetinilir.
+   Gönderilecekler bütçeyi küçükten büyüğe paylaşır: küçük dosyalar tam
+   gider, artan pay büyüklere kalır. Toplam tokenı döner. */
+static int attach_plan_all(Attach *list, size_t limit, size_t first,
+                           size_t *tokens) {
+  size_t n = 0, nsend = 0, used = 0;
+  for (Attach *a = list; a; a = a->next)
+    n++;
+  int many = n > 1;
+  Attach **send = malloc((n ? n : 1) * sizeof(Attach *));
+  if (!send)
+    return -1;
+  for (Attach *a = list; a; a = a->next) {
+    a->ref = ctx_lookup(a, first);
+    for (Attach *b = list; b != a && !a->ref; b = b->next)
+      if (!b->ref && b->hash == a->hash && b->size == a->size)
+        a->ref = b->path;
+    if (a->ref) {
+      attach_plan_ref(a, many);
+      used += a->tokens;
+    } else {
+      send[nsend++] = a;
+    }
+  }
+  qsort(send, nsend, sizeof(Attach *), cmp_attach_size);
+  for (size_t i = 0; i < nsend; i++) {
+    size_t left = limit > used ? limit - used : 0;
+    if (attach_plan(send[i], left / (nsend - i), many) != 0) {
+      free(send);
+      return -1;
+    }
+    used += send[i]->tokens;
+  }
+  free(send);
+  *tokens = used;
+  return 0;
+}
+
+/* Planlanan ekler, kullanıcı mesajının içeriğine (tırnaklar arasına) */
+static void body_add_attach(Body *b, const Attach *list) {
+  for (const Attach *a = list; a; a = a->next) {
+    for (size_t i = 0; i < a->win_count; i++) {
+      const AttachWin *w = &a->wins[i];
+      const char *pre = a->text.data + w->pre_off;
+      body_add_escaped(b, pre, w->pre_len, json_escaped_len(pre, w->pre_len));
+      body_add_escaped(b, a->data + w->off, w->len, w->esc_len);
+    }
+    const char *post = a->text.data + a->post_off;
+    body_add_escaped(b, post, a->post_len, json_escaped_len(post, a->post_len));
+  }
+}
+
+/* Gönderilen metnin aynısı (geçmişe girecek kullanıcı mesajı için) */
+static void attach_render(const Attach *list, StrBuf *out) {
+  for (const Attach *a = list; a; a = a->next) {
+    for (size_t i = 0; i < a->win_count; i++) {
+      const AttachWin *w = &a->wins[i];
+      sb_append_n(out, a->text.data + w->pre_off, w->pre_len);
+      sb_append_n(out, a->data + w->off, w->len);
+    }
+    sb_append_n(out, a->text.data + a->post_off, a->post_len);
+  }
+}
+
+/* Ekleri taşıyan tur geçmişe girdi: gönderilen dosyaları o tura bağla */
+static void attach_commit(const Attach *list, uint64_t turn) {
+  for (const Attach *a = list; a; a = a->next)
+    if (!a->ref && a->win_count > 0)
+      ctx_register(a, turn);
+}
+
+/* ===== Hız sınırlayıcı =====
+   Sunucunun bildirdiği sınırlar (x-ratelimit-limit/remaining/reset-*)
+   ve 429 cevaplarındaki Retry-After, istek ve token için iki kovalı bir
+   token-bucket'ı besler. Kova durumu önbellek dizinindeki küçük bir
+   dosyada (mmap + flock) tutulur; böylece aynı makinedeki tüm chatgpt
+   süreçleri tek bir bütçeyi paylaşır ve 429 gelince hepsi birlikte geri
+   çekilir. Sınırlar henüz bilinmiyorsa (ilk istek, CHATGPT_RPM/TPM yok)
+   kova sınırsız davranır. */
+
+#define RATE_MAGIC 0x31544c52u /* "RLT1" */
+#define RATE_MAX_ATTEMPTS 5
+#define RATE_BACKOFF_BASE_MS 500
+#define RATE_BACKOFF_MAX_MS 30000
+
+typedef struct {
+  uint32_t magic;
+  uint32_t failures;  /* art arda gelen 429 sayısı (tüm süreçler) */
+  double req_tokens;  /* kovada kalan istek hakkı */
+  double req_cap;     /* dakikalık istek sınırı; 0 = bilinmiyor */
+  double tok_tokens;  /* kovada kalan token hakkı */
+  double tok_cap;     /* dakikalık token sınırı; 0 = bilinmiyor */
+  int64_t last_ms;    /* son dolum zamanı (duvar saati, ms) */
+  int64_t blocked_ms; /* bu zamana kadar kimse istek atmaz */
+} RateShared;
+
+/* Bir cevabın hız sınırı başlıkları; -1 = başlık yoktu */
+typedef struct {
+  long retry_after_ms;
+  long limit_requests, limit_tokens;
+  long remaining_requests, remaining_tokens;
+  long reset_requests_ms, reset_tokens_ms;
+} RateHeaders;
+
+static RateShared *RATE;
+static int RATE_FD = -1;
+static uint64_t RATE_SEED;
+
+/* Süreçler arası paylaşılan zaman: monoton saat yeniden başlatmada sıfırlanır */
+static int64_t wall_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Ctrl-C bağlıyken (cancel_arm) iptal borusu beklenir; basılınca erken
+   döner, çağıran CANCEL_REQUESTED'a bakar */
+static void sleep_ms(long ms) {
+  if (CANCEL_ARMED && CANCEL_PIPE[0] >= 0) {
+    double end = mono_now() + (double)ms / 1000;
+    struct pollfd pfd = {CANCEL_PIPE[0], POLLIN, 0};
+    double left;
+    while (!CANCEL_REQUESTED && (left = end - mono_now()) > 0)
+      poll(&pfd, 1, (int)(left * 1000) + 1);
+    return;
+  }
+  struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    ;
+}
+
+/* xorshift64*: jitter için yeterli, süreç başına farklı tohum */
+static uint64_t rate_random(void) {
+  if (RATE_SEED == 0)
+    RATE_SEED = ((uint64_t)getpid() << 32) ^ (uint64_t)wall_ms() ^
+                (uint64_t)(mono_now() * 1e9);
+  RATE_SEED ^= RATE_SEED >> 12;
+  RATE_SEED ^= RATE_SEED << 25;
+  RATE_SEED ^= RATE_SEED >> 27;
+  return RATE_SEED * 0x2545F4914F6CDD1DULL;
+}
+
+static void rate_headers_init(RateHeaders *h) {
+  h->retry_after_ms = -1;
+  h->limit_requests = h->limit_tokens = -1;
+  h->remaining_requests = h->remaining_tokens = -1;
+  h->reset_requests_ms = h->reset_tokens_ms = -1;
+}
+
+/* "1s", "6m0s", "20ms", "1.5s", "2h3m" gibi süreleri ms'ye çevirir */
+static long parse_duration_ms(const char *s, const char *end) {
+  double total = 0;
+  int any = 0;
+  while (s < end) {
+    char *num_end;
+    double v = strtod(s, &num_end);
+    if (num_end == s || num_end > end)
+      break;
+    s = num_end;
+    if (s + 1 < end && s[0] == 'm' && s[1] == 's') {
+      total += v;
+      s += 2;
+    } else if (s < end && *s == 'h') {
+      total += v * 3600000;
+      s++;
+    } else if (s < end && *s == 'm') {
+      total += v * 60000;
+      s++;
+    } else if (s < end && *s == 's') {
+      total += v * 1000;
+      s++;
+    } else {
+      total += v * 1000; /* birimsiz: saniye */
+    }
+    any = 1;
+  }
+  return any ? (long)total : -1;
+}
+
+static size_t rate_header_cb(char *buf, size_t size, size_t nitems,
+                             void *userp) {
+  size_t len = size * nitems;
+  RateHeaders *h = (RateHeaders *)userp;
+  const char *end = buf + len;
+  while (end > buf && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' '))
+    end--;
+
+  /* Yönlendirme ya da 100-continue sonrası yeni bir durum satırı gelir */
+  if (len >= 5 && strncmp(buf, "HTTP/", 5) == 0) {
+    rate_headers_init(h);
+    return len;
+  }
+  const char *colon = memchr(buf, ':', (size_t)(end - buf));
+  if (!colon)
+    return len;
+  size_t name_len = (size_t)(colon - buf);
+  const char *v = colon + 1;
+  while (v < end && (*v == ' ' || *v == '\t'))
+    v++;
+  char val[128];
+  size_t vlen = (size_t)(end - v) < sizeof(val) - 1 ? (size_t)(end - v)
+                                                    : sizeof(val) - 1;
+  memcpy(val, v, vlen);
+  val[vlen] = '\0';
+
+#define HDR_IS(lit) \
+  (name_len == sizeof(lit) - 1 && strncasecmp(buf, lit, name_len) == 0)
+  if (HDR_IS("retry-after-ms")) {
+    h->retry_after_ms = strtol(val, NULL, 10);
+  } else if (HDR_IS("retry-after") && h->retry_after_ms < 0) {
+    char *num_end;
+    double secs = strtod(val, &num_end);
+    if (num_end != val) {
+      h->retry_after_ms = (long)(secs * 1000);
+    } else {
+      /* HTTP tarihi biçimi */
+      time_t at = curl_getdate(val, NULL);
+      if (at > 0)
+        h->retry_after_ms = at > time(NULL) ? (long)(at - time(NULL)) * 1000
+                                            : 0;
+    }
+  } else if (HDR_IS("x-ratelimit-limit-requests")) {
+    h->limit_requests = strtol(val, NULL, 10);
+  } else if (HDR_IS("x-ratelimit-limit-tokens")) {
+    h->limit_tokens = strtol(val, NULL, 10);
+  } else if (HDR_IS("x-ratelimit-remaining-requests")) {
+    h->remaining_requests = strtol(val, NULL, 10);
+  } else if (HDR_IS("x-ratelimit-remaining-tokens")) {
+    h->remaining_tokens = strtol(val, NULL, 10);
+  } else if (HDR_IS("x-ratelimit-reset-requests")) {
+    h->reset_requests_ms = parse_duration_ms(val, val + vlen);
+  } else if (HDR_IS("x-ratelimit-reset-tokens")) {
+    h->reset_tokens_ms = parse_duration_ms(val, val + vlen);
+  }
+#undef HDR_IS
+  return len;
+}
+
+static void rate_attach(CURL *curl, RateHeaders *h) {
+  rate_headers_init(h);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, rate_header_cb);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)h);
+}
+
+/* Paylaşılan kova dosyasını açar; olmazsa sınırlayıcı süreç içinde
+   devre dışı kalır (istekler yine de yeniden denenir). */
+static void rate_open(void) {
+  if (RATE || RATE_FD == -2)
+    return;
+  RATE_FD = -2;
+  char *dir = get_cache_dir();
+  if (!dir)
+    return;
+  make_cache_dir(dir);
+  size_t len = strlen(dir) + strlen("/ratelimit") + 1;
+  char *path = malloc(len);
+  if (path) {
+    snprintf(path, len, "%s/ratelimit", dir);
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (fd >= 0) {
+      flock(fd, LOCK_EX);
+      struct stat st;
+      void *m = MAP_FAILED;
+      if (fstat(fd, &st) == 0 &&
+          (st.st_size >= (off_t)sizeof(RateShared) ||
+           ftruncate(fd, sizeof(RateShared)) == 0))
+        m = mmap(NULL, sizeof(RateShared), PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+      if (m != MAP_FAILED) {
+        RATE = m;
+        if (RATE->magic != RATE_MAGIC) {
+          memset(RATE, 0, sizeof(*RATE));
+          RATE->magic = RATE_MAGIC;
+          RATE->last_ms = wall_ms();
+        }
+        /* Sunucu başlıkları gelene kadar kullanıcı sınırları */
+        long rpm = env_long("CHATGPT_RPM", 0);
+        long tpm = env_long("CHATGPT_TPM", 0);
+        if (rpm > 0 && RATE->req_cap == 0)
+          RATE->req_cap = RATE->req_tokens = (double)rpm;
+        if (tpm > 0 && RATE->tok_cap == 0)
+          RATE->tok_cap = RATE->tok_tokens = (double)tpm;
+        RATE_FD = fd;
+      }
+      flock(fd, LOCK_UN);
+      if (!RATE)
+        close(fd);
+    }
+    free(path);
+  }
+  free(dir);
+}
+
+static void rate_close(void) {
+  if (RATE) {
+    munmap(RATE, sizeof(RateShared));
+    RATE = NULL;
+  }
+  if (RATE_FD >= 0)
+    close(RATE_FD);
+  RATE_FD = -1;
+}
+
+/* Kilit altında çağrılır: geçen süre kadar kovaları doldurur.
+   Sınırlar dakikalıktır, dolum hızı sınır/60 sn. */
+static void rate_refill(int64_t now) {
+  int64_t elapsed = now - RATE->last_ms;
+  if (elapsed <= 0)
+    return; /* saat geri gittiyse dolum yok */
+  RATE->last_ms = now;
+  if (RATE->req_cap > 0) {
+    RATE->req_tokens += RATE->req_cap * (double)elapsed / 60000.0;
+    if (RATE->req_tokens > RATE->req_cap)
+      RATE->req_tokens = RATE->req_cap;
+  }
+  if (RATE->tok_cap > 0) {
+    RATE->tok_tokens += RATE->tok_cap * (double)elapsed / 60000.0;
+    if (RATE->tok_tokens > RATE->tok_cap)
+      RATE->tok_tokens = RATE->tok_cap;
+  }
+}
+
+/* Bir istek ve tahmini token sayısı için hak ayırır. Hak varsa düşer ve
+   0 döner; yoksa hiçbir şey düşmeden beklenmesi gereken ms'yi döner. */
+static long rate_reserve(double est_tokens) {
+  rate_open();
+  if (!RATE)
+    return 0;
+  flock(RATE_FD, LOCK_EX);
+  int64_t now = wall_ms();
+  rate_refill(now);
+
+  long wait = 0;
+  if (RATE->blocked_ms > now)
+    wait = (long)(RATE->blocked_ms - now);
+  if (RATE->req_cap > 0 && RATE->req_tokens < 1) {
+    long w = (long)((1 - RATE->req_tokens) * 60000.0 / RATE->req_cap) + 1;
+    if (w > wait)
+      wait = w;
+  }
+  if (RATE->tok_cap > 0) {
+    /* Sınırdan büyük tek istek sonsuza kadar beklemesin */
+    double need = est_tokens < RATE->tok_cap ? est_tokens : RATE->tok_cap;
+    if (RATE->tok_tokens < need) {
+      long w = (long)((need - RATE->tok_tokens) * 60000.0 / RATE->tok_cap) + 1;
+      if (w > wait)
+        wait = w;
+    }
+  }
+  if (wait == 0) {
+    if (RATE->req_cap > 0)
+      RATE->req_tokens -= 1;
+    if (RATE->tok_cap > 0)
+      RATE->tok_tokens -= est_tokens;
+  }
+  flock(RATE_FD, LOCK_UN);
+  return wait;
+}
+
+/* rate_reserve ile alınan ama kullanılmayan hakkı kovaya geri koyar */
+static void rate_refund(double est_tokens) {
+  if (!RATE)
+    return;
+  flock(RATE_FD, LOCK_EX);
+  rate_refill(wall_ms());
+  if (RATE->req_cap > 0 && (RATE->req_tokens += 1) > RATE->req_cap)
+    RATE->req_tokens = RATE->req_cap;
+  if (RATE->tok_cap > 0 && (RATE->tok_tokens += est_tokens) > RATE->tok_cap)
+    RATE->tok_tokens = RATE->tok_cap;
+  flock(RATE_FD, LOCK_UN);
+}
+
+/* Hak açılana kadar bekler (etkileşimli ve tek seferlik mod için). Ctrl-C
+   bağlıyken basılırsa hak almadan döner. */
+static void rate_wait(double est_tokens) {
+  long wait;
+  int told = 0;
+  while (!(CANCEL_ARMED && CANCEL_REQUESTED) &&
+         (wait = rate_reserve(est_tokens)) > 0) {
+    if (!told && wait >= 1000) {
+      char msg[96];
+      snprintf(msg, sizeof(msg), "Hız sınırı: %.1f sn bekleniyor...",
+               (double)wait / 1000);
+      log_msg(msg);
+      told = 1;
+    }
+    sleep_ms(wait);
+  }
+}
+
+/* Cevap sonrası: sunucunun bildirdiği kalan hakları kovaya yansıtır,
+   tahmini token sayısını gerçek kullanımla düzeltir, 429'da tüm
+   süreçleri verilen süre boyunca durdurur. */
+static void rate_update(const RateHeaders *h, long status, double est_tokens,
+                        long used_tokens, long backoff_ms) {
+  rate_open();
+  if (!RATE)
+    return;
+  flock(RATE_FD, LOCK_EX);
+  int64_t now = wall_ms();
+  rate_refill(now);
+
+  if (h->limit_requests > 0)
+    RATE->req_cap = (double)h->limit_requests;
+  if (h->limit_tokens > 0)
+    RATE->tok_cap = (double)h->limit_tokens;
+  if (h->remaining_requests >= 0 && RATE->req_cap > 0 &&
+      h->remaining_requests < RATE->req_tokens)
+    RATE->req_tokens = (double)h->remaining_requests;
+  if (h->remaining_tokens >= 0 && RATE->tok_cap > 0 &&
+      h->remaining_tokens < RATE->tok_tokens)
+    RATE->tok_tokens = (double)h->remaining_tokens;
+
+  /* Hak bitti: sıfırlanma zamanına kadar kimse denemesin */
+  int64_t until = 0;
+  if (h->remaining_requests == 0 && h->reset_requests_ms > 0)
+    until = now + h->reset_requests_ms;
+  if (h->remaining_tokens == 0 && h->reset_tokens_ms > 0 &&
+      now + h->reset_tokens_ms > until)
+    until = now + h->reset_tokens_ms;
+
+  if (status == 429) {
+    RATE->failures++;
+    if (now + backoff_ms > until)
+      until = now + backoff_ms;
+  } else if (status >= 200 && status < 300) {
+    RATE->failures = 0;
+    if (RATE->tok_cap > 0 && used_tokens > 0)
+      RATE->tok_tokens -= (double)used_tokens - est_tokens;
+  }
+  if (until > RATE->blocked_ms)
+    RATE->blocked_ms = until;
+  flock(RATE_FD, LOCK_UN);
+}
+
+/* Yeniden deneme öncesi bekleme. Retry-After varsa ona küçük bir jitter
+   eklenir (süreçler aynı anda uyanmasın); yoksa üstel bekleme, üst
+   sınırın yarısı sabit + yarısı rastgele ("equal jitter"). */
+static long rate_backoff_ms(int attempt, long retry_after_ms) {
+  if (retry_after_ms >= 0)
+    return retry_after_ms + (long)(rate_random() % 250);
+  int fails = RATE ? (int)RATE->failures : 0;
+  int exp = attempt > fails ? attempt : fails;
+  long cap = RATE_BACKOFF_BASE_MS;
+  while (exp-- > 0 && cap < RATE_BACKOFF_MAX_MS)
+    cap *= 2;
+  if (cap > RATE_BACKOFF_MAX_MS)
+    cap = RATE_BACKOFF_MAX_MS;
+  return cap / 2 + (long)(rate_random() % (uint64_t)(cap / 2 + 1));
+}
+
+/* Yeniden denenebilir mi: ağ hatası, 429 ve 5xx */
+static int rate_retryable(CURLcode res, long status) {
+  if (res != CURLE_OK)
+    return res != CURLE_ABORTED_BY_CALLBACK;
+  return status == 429 || status >= 500;
+}
+
+/* Sistem mesajının token sayısı; metin ya da kodlama değişmedikçe
+   yeniden sayılmaz. bpe_select() sonrası çağrılmalı. */
+static size_t config_sys_tokens(void) {
+  config_sys_frag();
+  if (!CFG.sys_tokens_enc[0] || CFG.sys_tokens_state != BPE.state ||
+      strcmp(CFG.sys_tokens_enc, BPE.encoding) != 0) {
+    const char *text = config_system_prompt();
+    CFG.sys_tokens = count_tokens(text, strlen(text)) + BPE_MSG_OVERHEAD;
+    snprintf(CFG.sys_tokens_enc, sizeof(CFG.sys_tokens_enc), "%s",
+             BPE.encoding[0] ? BPE.encoding : "-");
+    CFG.sys_tokens_state = BPE.state;
+  }
+  return CFG.sys_tokens;
+}
+
+/* Gövdenin sabit baş ve son parçaları */
+static void body_begin(Body *b, const char *model) {
+  body_add_str(b, "{\"model\":\"");
+  body_add_str(b, model);
+  /* Streaming özelliğini açıyoruz + Usage info istiyoruz */
+  body_add_str(b, "\",\"stream\":true,\"stream_options\":{"
+                  "\"include_usage\":true},\"messages\":[");
+}
+
+static void body_end(Body *b) { body_add_str(b, "],\"temperature\":0.3}"); }
+
+static struct curl_slist *request_headers(const char *api_key) {
+  struct curl_slist *headers = NULL;
+  headers = curl_slist_append(headers, "Content-Type: application/json");
+  char auth_header[512];
+  snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s",
+           api_key);
+  headers = curl_slist_append(headers, auth_header);
+  /* Büyük gövdelerde 100-continue beklemesini kapat */
+  headers = curl_slist_append(headers, "Expect:");
+  return headers;
+}
+
+/* Ctrl-C ile kesilen cevabın geçmişe giden sonu (modele de gider) */
+#define TRUNCATED_MARK "\n\n[answer truncated: cancelled by the user]"
+
+/* OpenAI çağrısı. att: mesajın önüne eklenecek dosya, in: mesajın önüne
+   akıtılacak stdin (NULL = yok) */
+static char *call_openai(const char *api_key, const char *model,
+                         const char *prompt, Attach *att, BodyStream *in) {
+  CURL *curl;
+  CURLcode res;
+  struct curl_slist *headers = NULL;
+
+  curl = http_acquire();
+  if (!curl) {
+    log_msg("HTTP handle hazır değil.");
+    return NULL;
+  }
+
+  /* JSON Payload Oluşturma (Geçmiş dahil). Sadece yeni mesaj kaçırılır;
+     sistem mesajı ayarlarda, geçmiş turlar kendi parçalarıyla hazır
+     durur ve gövdeye referans olarak eklenir. */
+
+  const StrBuf *sys_frag = config_sys_frag();
+  StrBuf user_frag;
+  sb_init(&user_frag);
+
+  /* Token bütçesi: sistem + yeni mesaj (+ ekler) sabit; geçmişten en yeni
+     turlar sığdığı kadar gönderilir, en eskiler düşer. */
+  bpe_select(model);
+  size_t budget = model_token_budget(model);
+  size_t sys_tokens = config_sys_tokens();
+  size_t prompt_tokens = count_tokens(prompt, strlen(prompt)) + BPE_MSG_OVERHEAD;
+
+  /* Ekler kalan bütçeye (ve CHATGPT_READ_TOKENS'a) sığacak kadar. Bağlamda
+     duran dosyalar sadece anılır; bu da hangi eski turların gideceğine
+     bağlı olduğundan plan, gönderilecek en eski tur sabitlenene kadar
+     yinelenir (o sınır sadece ileri gider, döngü biter). */
+  size_t limit = 0;
+  if (att) {
+    attach_settle(att);
+    limit = attach_limit();
+    size_t room = budget > sys_tokens + prompt_tokens
+                      ? budget - sys_tokens - prompt_tokens
+                      : 0;
+    if (limit > room)
+      limit = room;
+  }
+
+  size_t att_tokens = 0;
+  size_t hist_tokens = 0;
+  size_t first = 0;
+  for (;;) {
+    if (att && (limit < ATTACH_MIN_TOKENS ||
+                attach_plan_all(att, limit, first, &att_tokens) != 0)) {
+      fprintf(stderr,
+              "%s[!] Eklenen dosyalar bağlam bütçesine sığmıyor, "
+              "gönderilmedi.%s\n",
+              COLOR_ERROR, COLOR_RESET);
+      sb_free(&user_frag);
+      return NULL;
+    }
+    size_t fixed = sys_tokens + prompt_tokens + att_tokens;
+    if (fixed > budget) {
+      fprintf(stderr,
+              "%s[!] Mesaj bağlam bütçesini aşıyor (%zu / %zu token), "
+              "gönderilmedi.%s\n",
+              COLOR_ERROR, fixed, budget, COLOR_RESET);
+      sb_free(&user_frag);
+      return NULL;
+    }
+    size_t nf = HIST.count;
+    hist_tokens = 0;
+    while (nf > 0 && fixed + hist_tokens + hist_at(nf - 1)->tokens <= budget) {
+      nf--;
+      hist_tokens += hist_at(nf)->tokens;
+    }
+    int stable = !att || nf <= first;
+    first = nf;
+    if (stable)
+      break;
+  }
+  prompt_tokens += att_tokens;
+  /* stdin'e geçmişten sonra kalan bütçe; aşılırsa okuma sırasında kesilir */
+  if (in) {
+    size_t used = sys_tokens + hist_tokens + prompt_tokens;
+    in->max_tokens = budget > used ? budget - used : 0;
+  }
+
+  if (att) {
+    size_t refs = 0, cut = 0, size = 0, sent = 0;
+    for (const Attach *a = att; a; a = a->next) {
+      if (a->ref) {
+        refs++;
+      } else if (a->sent < a->size) {
+        cut++;
+        size += a->size;
+        sent += a->sent;
+      }
+    }
+    char msg[256];
+    if (refs > 0) {
+      snprintf(msg, sizeof(msg),
+               "%zu dosya bağlamda aynı içerikle duruyor, tekrar "
+               "gönderilmedi.",
+               refs);
+      log_msg(msg);
+    }
+    if (cut > 0) {
+      snprintf(msg, sizeof(msg),
+               "%zu dosya bütçeden büyük: %zu bayttan %zu bayt (baş, son ve "
+               "eşleşen satırlar) gönderiliyor.",
+               cut, size, sent);
+      log_msg(msg);
+    }
+  }
+  if (first > 0) {
+    char msg[128];
+    snprintf(msg, sizeof(msg),
+             "Bağlam bütçesi: en eski %zu tur bu isteğe eklenmedi.", first);
+    log_msg(msg);
+  }
+
+  /* Yeni Mesaj; ek dosya içeriğin başına, eşlemeden kaçırılarak girer */
+  sb_append(&user_frag, "{\"role\":\"user\",\"content\":\"");
+  size_t user_head = user_frag.len;
+  json_escape_append(&user_frag, prompt, strlen(prompt));
+  sb_append(&user_frag, "\"}");
+
+  if (!sys_frag->data || !user_frag.data) {
+    log_msg("Payload oluşturulamadı.");
+    sb_free(&user_frag);
+    return NULL;
+  }
+
+  Body body;
+  body_init(&body);
+  body_begin(&body, model);
+  body_add(&body, sys_frag->data, sys_frag->len);
+  /* Geçmiş Mesajlar */
+  for (size_t i = first; i < HIST.count; i++)
+    body_add(&body, hist_at(i)->frag, hist_at(i)->frag_len);
+  body_add(&body, user_frag.data, user_head);
+  if (att)
+    body_add_attach(&body, att);
+  if (in) {
+    body_add_stream(&body, in);
+    body_add_str(&body, "\\n\\n");
+  }
+  body_add(&body, user_frag.data + user_head, user_frag.len - user_head);
+  body_end(&body);
+
+  Reply reply;
+  reply_init(&reply);
+  md_begin();
+
+  /* Önbellek: anahtar gövdenin kendisi; --refresh aramayı atlar ama yazar.
+     stdin akışı gönderilmeden özetlenemez, o istekler önbelleğe girmez. */
+  uint64_t cache_key = 0;
+  int cached = 0;
+  int use_cache = CACHE_MODE != CACHE_OFF && !in;
+  if (use_cache) {
+    cache_key = body_hash(&body);
+    if (CACHE_MODE == CACHE_ON && cache_lookup(cache_key, &reply)) {
+      cached = 1;
+      reply.seen = reply.text.len;
+      if (reply.text.len)
+        reply.last = reply.text.data[reply.text.len - 1];
+      emit_delta(reply.text.data, reply.text.len);
+      if (OUTPUT_MODE == OUTPUT_NDJSON && reply.finish_reason[0])
+        ndjson_finish(reply.finish_reason);
+      emit_usage(&reply);
+      fflush(stdout);
+      log_msg("Cevap önbellekten geldi.");
+    }
+  }
+
+  /* Boruya akarken geçmiş/önbellek istemiyorsa cevap biriktirilmez */
+  reply.discard = PLAIN_OUTPUT == PLAIN_NO_COPY && !use_cache;
+
+  res = CURLE_OK;
+  long status = 200;
+  Timing timing;
+  int have_timing = 0;
+  double est = 0, t_start = 0, t_first = 0;
+  int in_flight = 0; /* Ctrl-C aktarım sırasında geldi (bekleme değil) */
+  StrBuf api_err;
+  sb_init(&api_err);
+  if (!cached) {
+    /* log_msg("API isteği gönderiliyor..."); (Streaming olduğu için log
+     * basmayalım, araya girmesin) */
+
+    curl_easy_setopt(curl, CURLOPT_URL, api_url());
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT,
+                     120L); /* Streaming için süreyi uzatalım */
+
+    headers = request_headers(api_key);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, stream_callback);
+
+    RateHeaders rh;
+    rate_attach(curl, &rh);
+    have_timing = 0;
+    est = (double)(sys_tokens + hist_tokens + prompt_tokens);
+
+    /* 429/5xx ve ağ hataları hız sınırlayıcı üzerinden yeniden denenir;
+       ekrana bir şey basıldıktan sonra tekrar denemek cevabı çiftler.
+       Ctrl-C, hız sınırı ve yeniden deneme beklemeleri dahil bütün isteği
+       keser; beklerken basılırsa prompt'a dönülür. */
+    cancel_arm();
+    for (int attempt = 0;; attempt++) {
+      rate_wait(est);
+      if (CANCEL_REQUESTED) {
+        res = CURLE_ABORTED_BY_CALLBACK;
+        HTTP_CANCELLED = 1;
+        in_flight = 0;
+        break;
+      }
+      body_attach(curl, &body);
+      rate_headers_init(&rh);
+
+      SseParser parser;
+      sse_init(&parser, &reply);
+      parser.easy = curl;
+      curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&parser);
+
+      t_start = mono_now();
+      res = http_perform(curl);
+      in_flight = 1;
+      sse_finish(&parser);
+      t_first = parser.t_first_token;
+      status = 0;
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+      if (res == CURLE_OK) {
+        latency_finish(model, curl, &parser, t_start, status, &timing);
+        have_timing = 1;
+      }
+
+      long backoff = rate_backoff_ms(attempt, rh.retry_after_ms);
+      rate_update(&rh, status, est, reply.total_tokens, backoff);
+
+      int retry = rate_retryable(res, status) && reply.seen == 0 &&
+                  attempt + 1 < RATE_MAX_ATTEMPTS && !(in && in->started);
+      sb_free(&api_err);
+      sb_init(&api_err);
+      if (res == CURLE_OK && status >= 300)
+        sse_error_message(&parser, &api_err);
+      sse_free(&parser);
+      if (!retry)
+        break;
+
+      char msg[256];
+      snprintf(msg, sizeof(msg), "%s, %.1f sn sonra yeniden deneniyor (%d/%d).",
+               res != CURLE_OK ? curl_easy_strerror(res)
+                               : status == 429 ? "Hız sınırı (429)"
+                                               : "Sunucu hatası",
+               (double)backoff / 1000, attempt + 2, RATE_MAX_ATTEMPTS);
+      log_msg(msg);
+      /* Paylaşılan kova 429'da zaten durduruldu; 5xx/ağ hatası için bekle */
+      if (status != 429 || !RATE)
+        sleep_ms(backoff);
+    }
+    cancel_disarm();
+    if (res == CURLE_OK && status < 300) {
+      http_report(curl);
+      if (use_cache && reply.text.len > 0)
+        cache_store(cache_key, &reply);
+    }
+  }
+  md_end();
+  out_flush();
+
+  /* Payload artık gerekli değil */
+  body_free(&body);
+  sb_free(&user_frag);
+  curl_slist_free_all(headers);
+  /* Handle temizlenmez: bağlantı havuzu sonraki tur için açık kalır */
+
+  /* Ctrl-C: gelen kısım cevap olarak kalır, geçmişte kesik diye işaretlenir.
+     Kullanım bilgisi gelmediğinden deftere tahmini token yazılır; ilk
+     tokendan önce kesilse de gönderilen istem faturalanır, o da yazılır.
+     Bekleme sırasında kesilen denemede istek gitmemiştir. */
+  int truncated = 0;
+  if (res == CURLE_ABORTED_BY_CALLBACK && HTTP_CANCELLED) {
+    printf("\n%s[Cevap kesildi (Ctrl-C).]%s", COLOR_INFO, COLOR_RESET);
+    fflush(stdout);
+    if (in_flight)
+      ledger_append(model, status,
+                    t_first > 0 ? (int64_t)((t_first - t_start) * 1e6) : -1,
+                    (int64_t)((mono_now() - t_start) * 1e6), (long)est,
+                    reply.seen ? (long)count_tokens(reply.text.data,
+                                                    reply.text.len)
+                               : 0,
+                    0);
+    if (reply.seen == 0) {
+      sb_free(&api_err);
+      sb_free(&reply.text);
+      return NULL;
+    }
+    truncated = 1;
+    res = CURLE_OK;
+  }
+
+  if (res != CURLE_OK) {
+    if (in && in->error[0])
+      fprintf(stderr, "\n%s[!] %s%s\n", COLOR_ERROR, in->error, COLOR_RESET);
+    else if (!HTTP_ABORTED) /* istemci gitti: yazacak kimse yok */
+      fprintf(stderr, "\n%schatgpt-cli: curl hatası:%s %s\n", COLOR_ERROR,
+              COLOR_RESET, curl_easy_strerror(res));
+    if (OUTPUT_MODE == OUTPUT_NDJSON)
+      ndjson_summary(model, &reply, NULL, 0, status,
+                     in && in->error[0] ? in->error : curl_easy_strerror(res));
+    sb_free(&api_err);
+    sb_free(&reply.text);
+    return NULL;
+  }
+  if (status >= 300) {
+    fprintf(stderr, "\n%schatgpt-cli: API hatası (HTTP %ld):%s %s\n",
+            COLOR_ERROR, status, COLOR_RESET,
+            api_err.data ? api_err.data : "");
+    if (OUTPUT_MODE == OUTPUT_NDJSON)
+      ndjson_summary(model, &reply, have_timing ? &timing : NULL, 0, status,
+                     api_err.data ? api_err.data : "API hatası");
+    sb_free(&api_err);
+    sb_free(&reply.text);
+    return NULL;
+  }
+  sb_free(&api_err);
+
+  /* Cevap metni akış sırasında zaten çözülerek biriktirildi */
+  char *full_text = reply.text.data;
+
+  if (in)
+    prompt_tokens += in->tokens;
+  if (OUTPUT_MODE == OUTPUT_NDJSON)
+    ndjson_summary(model, &reply, have_timing ? &timing : NULL, cached,
+                   status, NULL);
+  if (STATS_MODE) {
+    fprintf(stderr,
+            "\n%s[Token: sistem %zu + geçmiş %zu (%zu tur, %zu atlandı) + "
+            "mesaj %zu = %zu / bütçe %zu]%s\n",
+            COLOR_INFO, sys_tokens, hist_tokens, HIST.count - first, first,
+            prompt_tokens, sys_tokens + hist_tokens + prompt_tokens, budget,
+            COLOR_RESET);
+    if (have_timing)
+      print_timing(&timing);
+  }
+
+  /* /copy için cevabı global değişkende sakla (tek seferlik boru modunda
+     /copy yok, kopya da tutulmaz) */
+  if (!PLAIN_OUTPUT) {
+    if (LAST_RESPONSE)
+      free(LAST_RESPONSE);
+    LAST_RESPONSE = full_text ? my_strdup(full_text) : NULL;
+    md_commit();
+  }
+  REPLY_LAST = reply.last;
+  if (truncated) {
+    sb_append(&reply.text, TRUNCATED_MARK);
+    full_text = reply.text.data;
+  }
+
+  return full_text;
+}
+
+/* ===== Arka plan sıkıştırma =====
+   İsteğe bağlı (--compact / CHATGPT_COMPACT). Geçmiş eşiği aşınca en eski
+   turlar, kullanıcı bir sonraki mesajını yazarken ayrı bir thread ve ayrı
+   bir easy handle üzerinden (bağlantılar CURLSH ile paylaşılır) tek bir
+   özet tura indirgenir. İstek gövdesi ana thread'de kopyalanır; thread
+   geçmişe dokunmaz. Sonuç ana thread'de, istekler arasında ve sadece
+   özetlenen turlar hâlâ geçmişin başındaysa tek adımda yerine konur.
+   Oturum günlüğü tam kaydı tutmaya devam eder. */
+
+#define COMPACT_DEFAULT_TOKENS 16000
+#define COMPACT_KEEP_TURNS 4 /* en yeni turlar hep olduğu gibi kalır */
+#define COMPACT_ASK "Summarize our conversation so far."
+
+typedef struct {
+  size_t threshold; /* 0 = kapalı */
+  pthread_t tid;
+  int running;      /* thread başlatıldı, henüz toplanmadı */
+  int done;         /* thread bitti (__atomic) */
+  int cancel;       /* çıkışta aktarımı kes (__atomic) */
+  uint64_t first_id, last_id;
+  size_t turns, tokens;
+  char *api_key;
+  char *model;
+  StrBuf body;
+  StrBuf resp;
+  StrBuf summary;
+  long status;
+} Compact;
+
+static Compact COMPACT;
+
+/* "1" varsayılan eşik, daha büyük sayılar token eşiğidir */
+static void compact_configure(const char *value) {
+  if (!value || !value[0] || !strcmp(value, "0"))
+    return;
+  size_t n = (size_t)strtoul(value, NULL, 10);
+  COMPACT.threshold = n > 1 ? n : COMPACT_DEFAULT_TOKENS;
+}
+
+static size_t compact_write_cb(void *ptr, size_t size, size_t nmemb,
+                               void *userp) {
+  sb_append_n((StrBuf *)userp, ptr, size * nmemb);
+  return size * nmemb;
+}
+
+static int compact_xfer_cb(void *p, curl_off_t dt, curl_off_t dn,
+                           curl_off_t ut, curl_off_t un) {
+  (void)p;
+  (void)dt;
+  (void)dn;
+  (void)ut;
+  (void)un;
+  return __atomic_load_n(&COMPACT.cancel, __ATOMIC_RELAXED);
+}
+
+static void *compact_worker(void *arg) {
+  (void)arg;
+  CURL *h = curl_easy_init();
+  if (h) {
+    http_setup(h);
+    struct curl_slist *headers = request_headers(COMPACT.api_key);
+    curl_easy_setopt(h, CURLOPT_URL, api_url());
+    curl_easy_setopt(h, CURLOPT_TIMEOUT, 120L);
+    curl_easy_setopt(h, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(h, CURLOPT_POSTFIELDS, COMPACT.body.data);
+    curl_easy_setopt(h, CURLOPT_POSTFIELDSIZE_LARGE,
+                     (curl_off_t)COMPACT.body.len);
+    curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, compact_write_cb);
+    curl_easy_setopt(h, CURLOPT_WRITEDATA, (void *)&COMPACT.resp);
+    curl_easy_setopt(h, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(h, CURLOPT_XFERINFOFUNCTION, compact_xfer_cb);
+    curl_off_t total = 0;
+    if (curl_easy_perform(h) == CURLE_OK) {
+      curl_easy_getinfo(h, CURLINFO_RESPONSE_CODE, &COMPACT.status);
+      curl_easy_getinfo(h, CURLINFO_TOTAL_TIME_T, &total);
+    }
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(h);
+
+    /* Özet de kullanım defterine girer (akış yok: ilk token ölçülmez) */
+    const char *u = COMPACT.resp.data, *ue = u ? u + COMPACT.resp.len : NULL;
+    const char *usage, *d;
+    if (COMPACT.status && u && json_obj_get(u, ue, "usage", &usage))
+      ledger_append(COMPACT.model, COMPACT.status, -1, (int64_t)total,
+                    json_get_long(usage, ue, "prompt_tokens"),
+                    json_get_long(usage, ue, "completion_tokens"),
+                    json_obj_get(usage, ue, "prompt_tokens_details", &d)
+                        ? json_get_long(d, ue, "cached_tokens")
+                        : 0);
+  }
+
+  /* choices[0].message.content */
+  const char *p = COMPACT.resp.data;
+  const char *end = p ? p + COMPACT.resp.len : NULL;
+  const char *v, *msg, *content, *s, *e;
+  if (COMPACT.status == 200 && p && json_obj_get(p, end, "choices", &v)) {
+    const char *choice = json_arr_first(v, end);
+    if (choice && json_obj_get(choice, end, "message", &msg) &&
+        json_obj_get(msg, end, "content", &content) &&
+        json_string_span(content, end, &s, &e))
+      json_unescape_append(&COMPACT.summary, s, e);
+  }
+  __atomic_store_n(&COMPACT.done, 1, __ATOMIC_RELEASE);
+  return NULL;
+}
+
+static void compact_reset(void) {
+  free(COMPACT.api_key);
+  COMPACT.api_key = NULL;
+  free(COMPACT.model);
+  COMPACT.model = NULL;
+  sb_free(&COMPACT.body);
+  sb_free(&COMPACT.resp);
+  sb_free(&COMPACT.summary);
+  COMPACT.running = 0;
+  COMPACT.done = 0;
+  COMPACT.cancel = 0;
+  COMPACT.status = 0;
+}
+
+/* Bir tur eklendikten sonra çağrılır: eşik aşıldıysa en eski turları
+   (toplamın yarısına kadar, son COMPACT_KEEP_TURNS hariç) özetlemeye başlar */
+static void compact_maybe_start(const char *api_key, const char *model) {
+  if (!COMPACT.threshold || COMPACT.running)
+    return;
+  size_t total = 0;
+  for (size_t i = 0; i < HIST.count; i++)
+    total += hist_at(i)->tokens;
+  if (total <= COMPACT.threshold || HIST.count <= COMPACT_KEEP_TURNS)
+    return;
+
+  size_t n = 0, part = 0;
+  while (n < HIST.count - COMPACT_KEEP_TURNS && part < total / 2)
+    part += hist_at(n++)->tokens;
+
+  sb_init(&COMPACT.body);
+  sb_init(&COMPACT.resp);
+  sb_init(&COMPACT.summary);
+  COMPACT.api_key = my_strdup(api_key);
+  COMPACT.model = my_strdup(model);
+  StrBuf *b = &COMPACT.body;
+  sb_append(b, "{\"model\":\"");
+  json_escape_append(b, model, strlen(model));
+  sb_append(b, "\",\"messages\":[{\"role\":\"system\",\"content\":\"You "
+               "compact chat histories. Summarize the conversation you "
+               "are given so that it can replace it as context: keep "
+               "facts, decisions, names, file paths, code identifiers, "
+               "commands and open questions. Be concise. Write in the "
+               "language of the conversation.\"},");
+  for (size_t i = 0; i < n; i++)
+    sb_append_n(b, hist_at(i)->frag, hist_at(i)->frag_len);
+  sb_append(b, "{\"role\":\"user\",\"content\":\"" COMPACT_ASK
+               " Reply with the summary only.\"}],\"temperature\":0.2}");
+  if (!b->data || !COMPACT.resp.data || !COMPACT.summary.data ||
+      !COMPACT.api_key || !COMPACT.model) {
+    compact_reset();
+    return;
+  }
+
+  COMPACT.first_id = hist_at(0)->id;
+  COMPACT.last_id = hist_at(n - 1)->id;
+  COMPACT.turns = n;
+  COMPACT.tokens = part;
+  if (pthread_create(&COMPACT.tid, NULL, compact_worker, NULL) != 0) {
+    compact_reset();
+    return;
+  }
+  COMPACT.running = 1;
+}
+
+/* Biten özeti geçmişe uygular. İstekler arasında, ana thread'den */
+static void compact_poll(void) {
+  if (!COMPACT.running || !__atomic_load_n(&COMPACT.done, __ATOMIC_ACQUIRE))
+    return;
+  pthread_join(COMPACT.tid, NULL);
+
+  /* Özetlenen turlar hâlâ geçmişin başında mı (arada /clear, /load ya da
+     tur sınırıyla düşme olmadıysa)? */
+  size_t n = COMPACT.turns;
+  int intact = HIST.count > n && hist_at(0)->id == COMPACT.first_id &&
+               hist_at(n - 1)->id == COMPACT.last_id;
+  Turn t = {0};
+  if (COMPACT.summary.len == 0) {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Geçmiş özetlenemedi (HTTP %ld).",
+             COMPACT.status);
+    log_msg(msg);
+  } else if (intact && turn_build(&t, COMPACT_ASK, COMPACT.summary.data) == 0) {
+    t.id = ++HIST.next_id;
+    for (size_t i = 0; i < n; i++)
+      hist_pop_front();
+    HIST.head = (HIST.head + HIST.cap - 1) % HIST.cap;
+    HIST.ring[HIST.head] = t;
+    HIST.count++;
+    char msg[160];
+    snprintf(msg, sizeof(msg),
+             "En eski %zu tur özetlendi (%zu → %zu token).", n,
+             COMPACT.tokens, t.tokens);
+    log_msg(msg);
+  }
+  compact_reset();
+}
+
+/* Çıkışta süren özetleme beklenmez: aktarım kesilir */
+static void compact_stop(void) {
+  if (!COMPACT.running)
+    return;
+  __atomic_store_n(&COMPACT.cancel, 1, __ATOMIC_RELAXED);
+  pthread_join(COMPACT.tid, NULL);
+  compact_reset();
+}
+
+/* ===== Toplu iş modu (--batch) =====
+   JSONL dosyasındaki her satır ({"id":..,"prompt":"..","model":"..",
+   "system":".."}) bir istek olur. İstekler tek bir curl_multi döngüsünde,
+   en fazla BATCH.concurrency tanesi aynı anda uçuşta olacak şekilde
+   yürütülür; bağlantılar/TLS oturumları CURLSH üzerinden paylaşılır, HTTP/2
+   varsa tek bağlantıda çoğullanır. Dosya satır satır okunur, tamamı belleğe
+   alınmaz. Sonuçlar JSONL olarak girdi sırasıyla (varsayılan) ya da
+   tamamlanma sırasıyla yazılır. Yeniden denemeler tükenen satırlar
+   <girdi>.failed.jsonl dosyasına aynen yazılır; o dosya tekrar --batch ile
+   verilebilir. */
+
+#define BATCH_DEFAULT_CONCURRENCY 8
+
+typedef struct {
+  size_t seq; /* girdi satır sırası (0'dan) */
+  char *line; /* ham girdi satırı */
+  int attempt;
+  double due; /* yeniden deneme zamanı (monoton sn) */
+  StrBuf user_frag;
+  StrBuf sys_frag;
+  char *model;          /* çözülmüş ad (kayıt, histogram) */
+  StrBuf model_json;    /* gövde için kaçırılmış ad */
+  Body body;
+  Reply reply;
+  SseParser parser;
+  CURL *easy;
+  struct curl_slist *headers;
+  RateHeaders rate;
+  double est_tokens; /* hız sınırlayıcı için kaba tahmin */
+  double t_start;    /* son denemenin başlangıcı (monoton) */
+} BatchJob;
+
+typedef struct {
+  const char *api_key;
+  const char *model;
+  const char *in_path;
+  int concurrency;
+  int completion_order;
+  FILE *in;
+  FILE *out;
+  FILE *failed;
+  CURLM *multi;
+  CURL **idle; /* boşta bekleyen easy handle havuzu */
+  int idle_count;
+  /* başlamayı bekleyen işler: yeni satırlar ve yeniden denemeler */
+  BatchJob **queue;
+  size_t queue_count, queue_cap;
+  /* sıralı çıktı için bekleyen sonuçlar: pending[i] = seq (next_out + i) */
+  char **pending;
+  size_t pending_cap;
+  size_t next_out;
+  size_t next_seq;
+  int active;
+  int eof;
+  size_t ok, failed_count;
+} Batch;
+
+static void batch_job_free(BatchJob *job) {
+  if (!job)
+    return;
+  free(job->line);
+  free(job->model);
+  sb_free(&job->model_json);
+  sb_free(&job->user_frag);
+  sb_free(&job->sys_frag);
+  body_free(&job->body);
+  sb_free(&job->reply.text);
+  sse_free(&job->parser);
+  curl_slist_free_all(job->headers);
+  free(job);
+}
+
+/* Satırdaki bir string alanının ham (kaçırılmış) içeriğini döner */
+static int batch_field(const char *line, const char *end, const char *key,
+                       const char **s, const char **e) {
+  const char *v;
+  return json_obj_get(line, end, key, &v) && json_string_span(v, end, s, e);
+}
+
+/* Girdi satırından gövdeyi kurar. prompt/system değerleri zaten geçerli JSON
+   string içeriği olduğundan çözülüp yeniden kaçırılmadan aynen kullanılır. */
+static int batch_job_prepare(Batch *b, BatchJob *job) {
+  const char *p = job->line;
+  const char *end = p + strlen(p);
+  const char *s, *e;
+
+  if (!batch_field(p, end, "prompt", &s, &e))
+    return -1;
+  sb_init(&job->user_frag);
+  sb_append(&job->user_frag, "{\"role\":\"user\",\"content\":\"");
+  sb_append_n(&job->user_frag, s, (size_t)(e - s));
+  sb_append(&job->user_frag, "\"}");
+
+  sb_init(&job->sys_frag);
+  if (batch_field(p, end, "system", &s, &e)) {
+    sb_append(&job->sys_frag, "{\"role\":\"system\",\"content\":\"");
+    sb_append_n(&job->sys_frag, s, (size_t)(e - s));
+    sb_append(&job->sys_frag, "\"},");
+  }
+
+  /* Model adı bir kez çözülür; gövdeye ve sonuç satırına ayrı ayrı birer
+     kez kaçırılarak yazılır. */
+  if (batch_field(p, end, "model", &s, &e) && e > s) {
+    StrBuf name;
+    sb_init(&name);
+    json_unescape_append(&name, s, e);
+    job->model = name.data;
+  }
+  if (!job->model)
+    job->model = my_strdup(b->model);
+  sb_init(&job->model_json);
+  if (job->model)
+    json_escape_append(&job->model_json, job->model, strlen(job->model));
+
+  body_init(&job->body);
+  body_begin(&job->body, job->model_json.data ? job->model_json.data : "");
+  /* Satırda system yoksa ayarlardaki hazır parça paylaşılır */
+  const StrBuf *sys = job->sys_frag.len ? &job->sys_frag : config_sys_frag();
+  body_add(&job->body, sys->data, sys->len);
+  body_add(&job->body, job->user_frag.data, job->user_frag.len);
+  body_end(&job->body);
+  /* Kaba tahmin: İngilizce/JSON için ~4 bayt/token */
+  job->est_tokens = (double)job->body.total / 4;
+  return job->user_frag.data && sys->data && job->model &&
+                 job->model_json.data
+             ? 0
+             : -1;
+}
+
+/* Başlamayı bekleyenler kuyruğuna ekler */
+static int batch_enqueue(Batch *b, BatchJob *job) {
+  if (b->queue_count == b->queue_cap) {
+    size_t cap = b->queue_cap ? b->queue_cap * 2 : 16;
+    BatchJob **tmp = realloc(b->queue, cap * sizeof(BatchJob *));
+    if (!tmp)
+      return -1;
+    b->queue = tmp;
+    b->queue_cap = cap;
+  }
+  b->queue[b->queue_count++] = job;
+  return 0;
+}
+
+static int batch_start(Batch *b, BatchJob *job) {
+  CURL *h = b->idle_count > 0 ? b->idle[--b->idle_count] : curl_easy_init();
+  if (!h)
+    return -1;
+  curl_easy_reset(h);
+  http_setup(h);
+  job->easy = h;
+
+  reply_init(&job->reply);
+  sse_init(&job->parser, &job->reply);
+  job->parser.echo = 0;
+  job->parser.easy = h;
+  job->headers = request_headers(b->api_key);
+
+  curl_easy_setopt(h, CURLOPT_URL, api_url());
+  body_attach(h, &job->body);
+  curl_easy_setopt(h, CURLOPT_TIMEOUT, 120L);
+  curl_easy_setopt(h, CURLOPT_HTTPHEADER, job->headers);
+  curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, stream_callback);
+  curl_easy_setopt(h, CURLOPT_WRITEDATA, (void *)&job->parser);
+  curl_easy_setopt(h, CURLOPT_PRIVATE, (void *)job);
+  rate_attach(h, &job->rate);
+  job->t_start = mono_now();
+  curl_multi_add_handle(b->multi, h);
+  b->active++;
+  return 0;
+}
+
+/* Sonucu çıktıya (sıralıysa yerine) koyar; sahiplik devralınır */
+static void batch_emit(Batch *b, size_t seq, char *result) {
+  if (b->completion_order) {
+    fputs(result, b->out);
+    free(result);
+    fflush(b->out);
+    return;
+  }
+  size_t slot = seq - b->next_out;
+  if (slot >= b->pending_cap) {
+    size_t cap = b->pending_cap ? b->pending_cap : 64;
+    while (cap <= slot)
+      cap *= 2;
+    char **tmp = realloc(b->pending, cap * sizeof(char *));
+    if (!tmp) {
+      fputs(result, b->out);
+      free(result);
+      return;
+    }
+    memset(tmp + b->pending_cap, 0, (cap - b->pending_cap) * sizeof(char *));
+    b->pending = tmp;
+    b->pending_cap = cap;
+  }
+  b->pending[slot] = result;
+
+  size_t ready = 0;
+  while (ready < b->pending_cap && b->pending[ready]) {
+    fputs(b->pending[ready], b->out);
+    free(b->pending[ready]);
+    ready++;
+  }
+  if (ready > 0) {
+    memmove(b->pending, b->pending + ready,
+            (b->pending_cap - ready) * sizeof(char *));
+    memset(b->pending + b->pending_cap - ready, 0, ready * sizeof(char *));
+    b->next_out += ready;
+    fflush(b->out);
+  }
+}
+
+static void batch_result_head(StrBuf *out, const BatchJob *job) {
+  const char *p = job->line;
+  const char *end = p + strlen(p);
+  const char *id = NULL;
+  char num[32];
+  snprintf(num, sizeof(num), "{\"line\":%zu,\"id\":", job->seq + 1);
+  sb_append(out, num);
+  const char *id_end = json_obj_get(p, end, "id", &id)
+                           ? json_skip_value(id, end)
+                           : NULL;
+  if (id_end)
+    sb_append_n(out, id, (size_t)(id_end - id));
+  else
+    sb_append(out, "null");
+  sb_append(out, ",\"model\":\"");
+  json_escape_append(out, job->model ? job->model : "",
+                     job->model ? strlen(job->model) : 0);
+  sb_append(out, "\"");
+}
+
+static void batch_fail(Batch *b, BatchJob *job, const char *why,
+                       long status) {
+  StrBuf out;
+  sb_init(&out);
+  batch_result_head(&out, job);
+  char num[64];
+  snprintf(num, sizeof(num), ",\"status\":\"error\",\"http_status\":%ld", status);
+  sb_append(&out, num);
+  sb_append(&out, ",\"error\":\"");
+  json_escape_append(&out, why, strlen(why));
+  sb_append(&out, "\"}\n");
+  batch_emit(b, job->seq, out.data);
+
+  if (!b->failed) {
+    size_t len = strlen(b->in_path) + 16;
+    char *path = malloc(len);
+    if (path) {
+      snprintf(path, len, "%s.failed.jsonl", b->in_path);
+      b->failed = fopen(path, "w");
+      if (b->failed)
+        fprintf(stderr, "%s[!] Başarısız satırlar: %s%s\n", COLOR_ERROR, path,
+                COLOR_RESET);
+      free(path);
+    }
+  }
+  if (b->failed) {
+    fputs(job->line, b->failed);
+    fputc('\n', b->failed);
+  }
+  b->failed_count++;
+}
+
+static void batch_succeed(Batch *b, BatchJob *job) {
+  StrBuf out;
+  sb_init(&out);
+  batch_result_head(&out, job);
+  sb_append(&out, ",\"status\":\"ok\",\"answer\":\"");
+  json_escape_append(&out, job->reply.text.data, job->reply.text.len);
+  char tail[160];
+  snprintf(tail, sizeof(tail),
+           "\",\"usage\":{\"prompt_tokens\":%ld,\"completion_tokens\":%ld,"
+           "\"total_tokens\":%ld}}\n",
+           job->reply.prompt_tokens, job->reply.completion_tokens,
+           job->reply.total_tokens);
+  sb_append(&out, tail);
+  batch_emit(b, job->seq, out.data);
+  b->ok++;
+}
+
+/* Bir transfer bitti: başarı, yeniden deneme ya da kalıcı hata */
+static void batch_done(Batch *b, BatchJob *job, CURLcode res) {
+  long status = 0;
+  curl_easy_getinfo(job->easy, CURLINFO_RESPONSE_CODE, &status);
+  sse_finish(&job->parser);
+  if (res == CURLE_OK) {
+    Timing t;
+    latency_finish(job->model, job->easy, &job->parser, job->t_start, status,
+                   &t);
+  }
+
+  curl_multi_remove_handle(b->multi, job->easy);
+  b->idle[b->idle_count++] = job->easy;
+  job->easy = NULL;
+  b->active--;
+
+  int ok = res == CURLE_OK && status == 200 && job->parser.done;
+  if (ok) {
+    rate_update(&job->rate, status, job->est_tokens, job->reply.total_tokens,
+                0);
+    batch_succeed(b, job);
+    batch_job_free(job);
+    return;
+  }
+
+  StrBuf why;
+  sb_init(&why);
+  if (res != CURLE_OK)
+    sb_append(&why, curl_easy_strerror(res));
+  else if (status >= 300)
+    sse_error_message(&job->parser, &why);
+  else
+    sb_append(&why, "akış tamamlanmadı");
+
+  /* Ağ hataları, 429, 5xx ve yarım kalan akışlar geçicidir; bekleme
+     süresi paylaşılan kovaya da yazılır ki diğer işler de beklesin. */
+  long backoff = rate_backoff_ms(job->attempt, job->rate.retry_after_ms);
+  rate_update(&job->rate, status, job->est_tokens, 0, backoff);
+  int transient = rate_retryable(res, status) || status == 200;
+  if (transient && job->attempt + 1 < RATE_MAX_ATTEMPTS) {
+    job->attempt++;
+    job->due = mono_now() + (double)backoff / 1000;
+    /* Önceki denemenin durumu ancak iş kuyruğa girince bırakılır; girmezse
+       batch_job_free hepsini bir kez serbest bırakır. */
+    if (batch_enqueue(b, job) == 0) {
+      sb_free(&job->reply.text);
+      sse_free(&job->parser);
+      curl_slist_free_all(job->headers);
+      job->headers = NULL;
+      sb_free(&why);
+      return;
+    }
+  }
+
+  batch_fail(b, job, why.data ? why.data : "hata", status);
+  sb_free(&why);
+  batch_job_free(job);
+}
+
+/* Sıradaki girdi satırını okuyup kuyruğa koyar; dosya bittiyse 0 döner */
+static int batch_next(Batch *b) {
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t n;
+  while ((n = getline(&line, &cap, b->in)) >= 0) {
+    while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+      line[--n] = '\0';
+    const char *p = json_ws(line, line + n);
+    if (p < line + n)
+      break; /* boş olmayan satır */
+  }
+  if (n < 0) {
+    free(line);
+    b->eof = 1;
+    return 0;
+  }
+
+  BatchJob *job = calloc(1, sizeof(BatchJob));
+  if (!job) {
+    free(line);
+    b->eof = 1;
+    return 0;
+  }
+  job->seq = b->next_seq++;
+  job->line = line;
+  if (batch_job_prepare(b, job) != 0) {
+    batch_fail(b, job, "geçersiz satır (\"prompt\" alanı yok)", 0);
+    batch_job_free(job);
+    return 1;
+  }
+  if (batch_enqueue(b, job) != 0) {
+    batch_fail(b, job, "bellek yetersiz", 0);
+    batch_job_free(job);
+  }
+  return 1;
+}
+
+static void batch_close(Batch *b) {
+  for (int i = 0; i < b->idle_count; i++)
+    curl_easy_cleanup(b->idle[i]);
+  if (b->multi)
+    curl_multi_cleanup(b->multi);
+  free(b->idle);
+  free(b->queue);
+  free(b->pending);
+  if (b->failed)
+    fclose(b->failed);
+  if (b->in != stdin)
+    fclose(b->in);
+}
+
+static int run_batch(const char *api_key, const char *model, const char *path,
+                     int concurrency, int completion_order) {
+  Batch b;
+  memset(&b, 0, sizeof(b));
+  b.api_key = api_key;
+  b.model = model;
+  b.in_path = path;
+  b.concurrency = concurrency > 0 ? concurrency : BATCH_DEFAULT_CONCURRENCY;
+  b.completion_order = completion_order;
+  b.out = stdout;
+  b.in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+  if (!b.in) {
+    fprintf(stderr, "%s[!] Dosya açılamadı: %s%s\n", COLOR_ERROR, path,
+            COLOR_RESET);
+    return 1;
+  }
+
+  b.multi = curl_multi_init();
+  b.idle = calloc((size_t)b.concurrency, sizeof(CURL *));
+  if (!b.multi || !b.idle) {
+    log_msg("curl_multi başlatılamadı.");
+    batch_close(&b);
+    return 1;
+  }
+  curl_multi_setopt(b.multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+  curl_multi_setopt(b.multi, CURLMOPT_MAX_HOST_CONNECTIONS,
+                    (long)b.concurrency);
+
+  double t0 = mono_now();
+  while (!b.eof || b.active > 0 || b.queue_count > 0) {
+    /* Uçuşta ya da beklemede en fazla concurrency iş olsun */
+    while (!b.eof && (size_t)b.active + b.queue_count < (size_t)b.concurrency)
+      batch_next(&b);
+
+    /* Zamanı gelmiş işlerden en eski satırı başlat; hız sınırı hak
+       vermezse bu tur başka iş başlatma. */
+    double now = mono_now();
+    double next_due = 0;
+    while (b.active < b.concurrency) {
+      size_t pick = b.queue_count;
+      for (size_t i = 0; i < b.queue_count; i++) {
+        BatchJob *job = b.queue[i];
+        if (job->due > now) {
+          if (next_due == 0 || job->due < next_due)
+            next_due = job->due;
+        } else if (pick == b.queue_count || job->seq < b.queue[pick]->seq) {
+          pick = i;
+        }
+      }
+      if (pick == b.queue_count)
+        break;
+      BatchJob *job = b.queue[pick];
+      long wait = rate_reserve(job->est_tokens);
+      if (wait > 0) {
+        double due = now + (double)wait / 1000;
+        if (next_due == 0 || due < next_due)
+          next_due = due;
+        break;
+      }
+      b.queue[pick] = b.queue[--b.queue_count];
+      if (batch_start(&b, job) != 0) {
+        rate_refund(job->est_tokens);
+        job->due = now + 1;
+        b.queue[b.queue_count++] = job; /* yer zaten vardı */
+        break;
+      }
+    }
+
+    int running = 0;
+    curl_multi_perform(b.multi, &running);
+
+    CURLMsg *msg;
+    int left;
+    while ((msg = curl_multi_info_read(b.multi, &left))) {
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+      BatchJob *job = NULL;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&job);
+      if (job)
+        batch_done(&b, job, msg->data.result);
+    }
+
+    int timeout = 1000;
+    if (next_due > 0) {
+      double wait = (next_due - mono_now()) * 1000;
+      timeout = wait < 0 ? 0 : wait < timeout ? (int)wait : timeout;
+    }
+    if (b.active > 0 || b.queue_count > 0)
+      curl_multi_poll(b.multi, NULL, 0, timeout, NULL);
+  }
+
+  /* Sırayı bekleyen kalmadıysa pending boştur; emniyet için boşalt */
+  for (size_t i = 0; i < b.pending_cap; i++) {
+    if (b.pending[i]) {
+      fputs(b.pending[i], b.out);
+      free(b.pending[i]);
+    }
+  }
+  fflush(b.out);
+
+  fprintf(stderr, "%s[Toplu iş: %zu satır, %zu başarılı, %zu hata, %.2f sn]%s\n",
+          COLOR_INFO, b.next_seq, b.ok, b.failed_count, mono_now() - t0,
+          COLOR_RESET);
+
+  batch_close(&b);
+  return b.failed_count > 0 ? 2 : 0;
+}
+
+/* ===== Model karşılaştırma (-m a,b,c / /compare) =====
+   Aynı soru (sistem + geçmiş + mesaj) birden çok modele tek bir curl_multi
+   döngüsünde aynı anda gönderilir; toplam süre en yavaş modelin süresi
+   kadardır. Cevaplar bittikçe sırayla basılır, sonda model başına TTFT,
+   token/sn ve kullanım tablosu gelir. Ölçümler /stats histogramlarına da
+   girer. Terminalde seçilen kazanan varsayılan model olarak kaydedilir.
+   Karşılaştırma ölçüm olduğu için istekler yeniden denenmez. */
+
+#define COMPARE_MAX_MODELS 8
+
+typedef struct {
+  char *model;
+  StrBuf model_json; /* gövde için kaçırılmış ad */
+  Body body;
+  Reply reply;
+  SseParser parser;
+  CURL *easy;
+  struct curl_slist *headers;
+  RateHeaders rate;
+  double est_tokens;
+  double t_start;
+  Timing timing;
+  long status;
+  int running;
+  int ok;
+  StrBuf error;
+} CompareJob;
+
+/* "a, b,a,c" -> {a, b, c}; boş ve tekrar eden adlar atlanır */
+static int compare_split(const char *list, char **out, int max) {
+  int n = 0;
+  const char *p = list;
+  while (*p && n < max) {
+    while (*p == ',' || *p == ' ')
+      p++;
+    const char *s = p;
+    while (*p && *p != ',')
+      p++;
+    const char *e = p;
+    while (e > s && e[-1] == ' ')
+      e--;
+    if (e == s)
+      continue;
+    int dup = 0;
+    for (int i = 0; i < n && !dup; i++)
+      dup = strlen(out[i]) == (size_t)(e - s) &&
+            memcmp(out[i], s, (size_t)(e - s)) == 0;
+    if (dup)
+      continue;
+    char *m = malloc((size_t)(e - s) + 1);
+    if (!m)
+      break;
+    memcpy(m, s, (size_t)(e - s));
+    m[e - s] = '\0';
+    out[n++] = m;
+  }
+  return n;
+}
+
+static void compare_job_free(CompareJob *job) {
+  free(job->model);
+  sb_free(&job->model_json);
+  body_free(&job->body);
+  sb_free(&job->reply.text);
+  sse_free(&job->parser);
+  curl_slist_free_all(job->headers);
+  sb_free(&job->error);
+  if (job->easy)
+    curl_easy_cleanup(job->easy);
+}
+
+/* Gövde modele göre kurulur: geçmişten o modelin bütçesine sığan en yeni
+   turlar. Parçalar paylaşılır, kopyalanmaz. */
+static int compare_prepare(CompareJob *job, const StrBuf *user_frag,
+                           size_t fixed) {
+  size_t budget = model_token_budget(job->model);
+  if (fixed > budget) {
+    char msg[128];
+    snprintf(msg, sizeof(msg),
+             "Mesaj bağlam bütçesini aşıyor (%zu / %zu token)", fixed, budget);
+    sb_append(&job->error, msg);
+    return -1;
+  }
+  size_t first = HIST.count, hist_tokens = 0;
+  while (first > 0 && fixed + hist_tokens + hist_at(first - 1)->tokens <= budget)
+    hist_tokens += hist_at(--first)->tokens;
+
+  /* Ad -m ya da /compare listesinden geldiği gibi; gövdeye kaçırılarak girer */
+  sb_init(&job->model_json);
+  json_escape_append(&job->model_json, job->model, strlen(job->model));
+  if (!job->model_json.data) {
+    sb_append(&job->error, "bellek yetersiz");
+    return -1;
+  }
+
+  const StrBuf *sys = config_sys_frag();
+  body_init(&job->body);
+  body_begin(&job->body, job->model_json.data);
+  body_add(&job->body, sys->data, sys->len);
+  for (size_t i = first; i < HIST.count; i++)
+    body_add(&job->body, hist_at(i)->frag, hist_at(i)->frag_len);
+  body_add(&job->body, user_frag->data, user_frag->len);
+  body_end(&job->body);
+  job->est_tokens = (double)(fixed + hist_tokens);
+  return 0;
+}
+
+static int compare_start(CURLM *multi, CompareJob *job, const char *api_key) {
+  CURL *h = curl_easy_init();
+  if (!h) {
+    sb_append(&job->error, "curl handle oluşturulamadı");
+    return -1;
+  }
+  http_setup(h);
+  job->easy = h;
+  reply_init(&job->reply);
+  sse_init(&job->parser, &job->reply);
+  job->parser.echo = 0;
+  job->parser.easy = h;
+  job->headers = request_headers(api_key);
+
+  curl_easy_setopt(h, CURLOPT_URL, api_url());
+  body_attach(h, &job->body);
+  curl_easy_setopt(h, CURLOPT_TIMEOUT, 120L);
+  curl_easy_setopt(h, CURLOPT_HTTPHEADER, job->headers);
+  curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, stream_callback);
+  curl_easy_setopt(h, CURLOPT_WRITEDATA, (void *)&job->parser);
+  curl_easy_setopt(h, CURLOPT_PRIVATE, (void *)job);
+  rate_attach(h, &job->rate);
+  rate_headers_init(&job->rate);
+  rate_wait(job->est_tokens);
+  curl_multi_add_handle(multi, h);
+  job->running = 1;
+  return 0;
+}
+
+static void compare_done(CURLM *multi, CompareJob *job, CURLcode res) {
+  curl_easy_getinfo(job->easy, CURLINFO_RESPONSE_CODE, &job->status);
+  sse_finish(&job->parser);
+  if (res == CURLE_OK) {
+    latency_finish(job->model, job->easy, &job->parser, job->t_start,
+                   job->status, &job->timing);
+  }
+  curl_multi_remove_handle(multi, job->easy);
+  job->running = 0;
+  rate_update(&job->rate, job->status, job->est_tokens,
+              job->reply.total_tokens, 0);
+
+  job->ok = res == CURLE_OK && job->status == 200 && job->parser.done;
+  if (job->ok)
+    return;
+  if (res != CURLE_OK)
+    sb_append(&job->error, curl_easy_strerror(res));
+  else if (job->status >= 300)
+    sse_error_message(&job->parser, &job->error);
+  else
+    sb_append(&job->error, "akış tamamlanmadı");
+}
+
+/* Biten cevabı başlığıyla basar (terminalde markdown ile) */
+static void compare_print(const CompareJob *job, int idx, int tty) {
+  const char *ca = tty ? COLOR_ASSIST : "", *ci = tty ? COLOR_INFO : "";
+  const char *ce = tty ? COLOR_ERROR : "", *cr = tty ? COLOR_RESET : "";
+  char a[16], b[16];
+  printf("\n%s➤ [%d] %s%s", ca, idx + 1, job->model, cr);
+  if (!job->ok) {
+    printf("\n%s[!] %s%s\n", ce, job->error.data ? job->error.data : "hata",
+           cr);
+    fflush(stdout);
+    return;
+  }
+  printf("  %s(ilk token %s, toplam %s, %.1f token/sn)%s\n", ci,
+         fmt_us(a, sizeof(a), job->timing.ttft),
+         fmt_us(b, sizeof(b), job->timing.total), job->timing.tokens_per_sec,
+         cr);
+  fflush(stdout);
+  md_begin();
+  md_feed(job->reply.text.data, job->reply.text.len);
+  md_end();
+  out_flush();
+  if (!job->reply.text.len ||
+      job->reply.text.data[job->reply.text.len - 1] != '\n')
+    putchar('\n');
+  fflush(stdout);
+}
+
+static void compare_table(const CompareJob *jobs, int n, double wall,
+                          int tty) {
+  const char *ci = tty ? COLOR_INFO : "", *cr = tty ? COLOR_RESET : "";
+  double sum = 0;
+  /* İ ve ç iki bayt: başlık genişlikleri bir fazla */
+  printf("\n%s  %-3s %-24s %11s %10s %10s %15s%s\n", ci, "#", "Model",
+         "İlk token", "Toplam", "Token/sn", "Token (g+ç)", cr);
+  for (int i = 0; i < n; i++) {
+    const CompareJob *j = &jobs[i];
+    char a[16], b[16], tok[32];
+    if (!j->ok) {
+      printf("  %-3d %-24s %s\n", i + 1, j->model, "hata");
+      continue;
+    }
+    snprintf(tok, sizeof(tok), "%ld+%ld", j->reply.prompt_tokens,
+             j->reply.completion_tokens);
+    printf("  %-3d %-24s %10s %10s %10.1f %14s\n", i + 1, j->model,
+           fmt_us(a, sizeof(a), j->timing.ttft),
+           fmt_us(b, sizeof(b), j->timing.total), j->timing.tokens_per_sec,
+           tok);
+    sum += (double)j->timing.total / 1e6;
+  }
+  printf("%s[Duvar saati %.2f sn; sırayla gönderilseydi ~%.2f sn]%s\n", ci,
+         wall, sum, cr);
+}
+
+/* Terminalde kazananı sorar ve varsayılan model yapar; seçilen işin
+   sırasını (yoksa -1) döner */
+static int compare_pick(const CompareJob *jobs, int n) {
+  int ok = 0;
+  for (int i = 0; i < n; i++)
+    ok += jobs[i].ok;
+  if (!ok || !isatty(STDIN_FILENO) || !isatty(STDOUT_FILENO))
+    return -1;
+  printf("\nVarsayılan yapılacak model numarası (Enter = geç): ");
+  fflush(stdout);
+  char line[32];
+  if (!fgets(line, sizeof(line), stdin))
+    return -1;
+  int idx = atoi(line) - 1;
+  if (idx < 0 || idx >= n || !jobs[idx].ok)
+    return -1;
+  if (config_write(CFG_MODEL, jobs[idx].model) == 0)
+    printf("%sVarsayılan model '%s' olarak ayarlandı.%s\n", COLOR_INFO,
+           jobs[idx].model, COLOR_RESET);
+  else
+    printf("%s[!] Varsayılan model kaydedilemedi.%s\n", COLOR_ERROR,
+           COLOR_RESET);
+  return idx;
+}
+
+/* models: virgüllü liste. Kazanan seçilirse cevabı geçmişe eklenir.
+   Hepsi başarılıysa 0 döner. */
+static int run_compare(const char *api_key, const char *models,
+                       const char *prompt) {
+  char *names[COMPARE_MAX_MODELS];
+  int n = compare_split(models, names, COMPARE_MAX_MODELS);
+  if (n < 2) {
+    fprintf(stderr, "%s[!] Karşılaştırma için en az iki model gerekli.%s\n",
+            COLOR_ERROR, COLOR_RESET);
+    for (int i = 0; i < n; i++)
+      free(names[i]);
+    return 1;
+  }
+
+  CompareJob jobs[COMPARE_MAX_MODELS];
+  memset(jobs, 0, sizeof(jobs));
+  StrBuf user_frag;
+  sb_init(&user_frag);
+  sb_append(&user_frag, "{\"role\":\"user\",\"content\":\"");
+  json_escape_append(&user_frag, prompt, strlen(prompt));
+  sb_append(&user_frag, "\"}");
+
+  bpe_select(names[0]);
+  size_t fixed = config_sys_tokens() + count_tokens(prompt, strlen(prompt)) +
+                 BPE_MSG_OVERHEAD;
+  CURLM *multi = curl_multi_init();
+  if (!multi || !user_frag.data) {
+    log_msg("curl_multi başlatılamadı.");
+    for (int i = 0; i < n; i++)
+      free(names[i]);
+    sb_free(&user_frag);
+    if (multi)
+      curl_multi_cleanup(multi);
+    return 1;
+  }
+  curl_multi_setopt(multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+
+  int tty = isatty(STDOUT_FILENO);
+  if (tty)
+    printf("\n%s➤ %d model karşılaştırılıyor...%s\n", COLOR_INFO, n,
+           COLOR_RESET);
+  fflush(stdout);
+
+  /* Ctrl-C hız sınırı beklemesini ve süren bütün istekleri keser, biten
+     cevaplar kalır */
+  cancel_arm();
+  int active = 0;
+  for (int i = 0; i < n; i++) {
+    jobs[i].model = names[i];
+    sb_init(&jobs[i].error);
+    if (compare_prepare(&jobs[i], &user_frag, fixed) == 0 &&
+        compare_start(multi, &jobs[i], api_key) == 0)
+      active++;
+  }
+  /* Aktarımlar ilk curl_multi_perform ile birlikte başlar: ilk token
+     süreleri aynı andan ölçülsün */
+  double t0 = mono_now();
+  for (int i = 0; i < n; i++)
+    jobs[i].t_start = t0;
+  /* Gönderilemeyenler hemen gösterilir */
+  for (int i = 0; i < n; i++)
+    if (!jobs[i].easy)
+      compare_print(&jobs[i], i, tty);
+
+  while (active > 0) {
+    if (CANCEL_REQUESTED) {
+      for (int i = 0; i < n; i++) {
+        if (!jobs[i].running)
+          continue;
+        curl_multi_remove_handle(multi, jobs[i].easy);
+        jobs[i].running = 0;
+        sb_append(&jobs[i].error, "iptal edildi (Ctrl-C)");
+        compare_print(&jobs[i], i, tty);
+      }
+      break;
+    }
+    int running = 0;
+    curl_multi_perform(multi, &running);
+    CURLMsg *msg;
+    int left;
+    while ((msg = curl_multi_info_read(multi, &left))) {
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+      CompareJob *job = NULL;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&job);
+      if (!job)
+        continue;
+      compare_done(multi, job, msg->data.result);
+      compare_print(job, (int)(job - jobs), tty);
+      active--;
+    }
+    struct curl_waitfd wake = {CANCEL_PIPE[0], CURL_WAIT_POLLIN, 0};
+    if (active > 0)
+      curl_multi_poll(multi, CANCEL_PIPE[0] >= 0 ? &wake : NULL,
+                      CANCEL_PIPE[0] >= 0 ? 1 : 0, 1000, NULL);
+  }
+  cancel_disarm();
+  double wall = mono_now() - t0;
+
+  compare_table(jobs, n, wall, tty);
+  int win = compare_pick(jobs, n);
+  if (win >= 0)
+    add_turn(prompt, jobs[win].reply.text.data);
+
+  int rc = 0;
+  for (int i = 0; i < n; i++) {
+    if (!jobs[i].ok)
+      rc = 1;
+    compare_job_free(&jobs[i]);
+  }
+  curl_multi_cleanup(multi);
+  sb_free(&user_frag);
+  return rc;
+}
+
+/* ===== Tek seferlik mod ve daemon (--daemon) =====
+   `chatgpt --daemon` API anahtarını, ayarları, ısıtılmış bağlantıları ve
+   adlı oturumları bellekte tutarak kullanıcıya özel bir Unix soketini
+   dinler. Tek seferlik çağrı daemon çalışıyorsa ayar/anahtar/libcurl
+   yüklemeden isteği sokete iletir. stdin, stdout ve stderr SCM_RIGHTS ile
+   devredilir: daemon boru ile gelen girdiyi doğrudan okur, cevabı
+   doğrudan istemcinin terminaline ya da borusuna yazar; istemci sadece
+   çıkış kodunu bekler. Her iki uçta da
+   karşı tarafın aynı kullanıcı olduğu SO_PEERCRED ile doğrulanır.
+   İstemciler sırayla işlenir. */
+
+#define DAEMON_MAGIC 0x32444743u /* "CGD2" */
+#define DAEMON_MAX_REQ (16u << 20)
+#define DAEMON_SESSIONS 8 /* bellekte tutulan adlı oturum sayısı */
 
-/* Dinamik String Buffer */
 typedef struct {
-  char *data;
-  size_t len;
-  size_t cap;
-} StrBuf;
+  uint32_t magic;
+  uint32_t len; /* model\0 env_model\0 oturum\0 soru\0 */
+  int32_t cache;
+  uint32_t stats;
+  uint32_t output; /* OUTPUT_TEXT / OUTPUT_NDJSON */
+} DaemonReq;
 
-static void sb_init(StrBuf *sb) {
-  sb->cap = 4096;
-  sb->len = 0;
-  sb->data = malloc(sb->cap);
-  if (sb->data)
-    sb->data[0] = '\0';
+typedef struct {
+  char name[64];
+  History hist;
+  Journal journal;
+  off_t seen; /* günlüğün bilinen boyu; başka süreç eklediyse yeniden yükle */
+  double used;
+} DaemonSession;
+
+static DaemonSession SESSIONS[DAEMON_SESSIONS];
+static int SESSION_CUR = -1; /* HIST/JOURNAL'daki oturum; -1 = adsız */
+
+static off_t session_journal_size(const char *name) {
+  char *path = session_file(name, ".journal");
+  struct stat st;
+  off_t size = path && stat(path, &st) == 0 ? st.st_size : 0;
+  free(path);
+  return size;
 }
 
-static void sb_append(StrBuf *sb, const char *s) {
-  if (!sb->data || !s)
+/* Tek seferlik modda --session: oturumu geçmişe alır. Daemon'da son
+   kullanılan oturumlar bellekte kalır; geçiş sadece durum takasıdır. */
+static void session_use(const char *name) {
+  off_t size = name ? session_journal_size(name) : 0;
+  if (SESSION_CUR >= 0 && name &&
+      strcmp(SESSIONS[SESSION_CUR].name, name) == 0 &&
+      SESSIONS[SESSION_CUR].seen == size)
     return;
-  size_t l = strlen(s);
-  while (sb->len + l + 1 >= sb->cap) {
-    sb->cap *= 2;
-    char *tmp = realloc(sb->data, sb->cap);
-    if (!tmp)
-      return;
-    sb->data = tmp;
+  if (SESSION_CUR < 0 && !name && HIST.count == 0)
+    return;
+
+  /* Etkin durumu park et (adsız geçmiş saklanmaz) */
+  if (SESSION_CUR >= 0) {
+    SESSIONS[SESSION_CUR].hist = HIST;
+    SESSIONS[SESSION_CUR].journal = JOURNAL;
+  } else {
+    free_history();
   }
-  memcpy(sb->data + sb->len, s, l);
-  sb->len += l;
-  sb->data[sb->len] = '\0';
-}
+  History empty = {0};
+  empty.max_turns = HIST.max_turns;
+  empty.next_id = HIST.next_id;
+  HIST = empty;
+  JOURNAL = (Journal){"", -1, -1, 0};
+  SESSION_CUR = -1;
+  if (!name)
+    return;
 
-static void sb_free(StrBuf *sb) {
-  if (sb->data)
-    free(sb->data);
+  int slot = -1, lru = 0;
+  for (int i = 0; i < DAEMON_SESSIONS; i++) {
+    if (SESSIONS[i].name[0] && strcmp(SESSIONS[i].name, name) == 0) {
+      slot = i;
+      break;
+    }
+    if (SESSIONS[i].used < SESSIONS[lru].used)
+      lru = i;
+  }
+  if (slot >= 0) {
+    HIST = SESSIONS[slot].hist;
+    HIST.next_id = empty.next_id;
+    JOURNAL = SESSIONS[slot].journal;
+    if (SESSIONS[slot].seen != size)
+      journal_load(name); /* günlüğe başka bir süreç yazmış */
+  } else {
+    slot = lru;
+    if (SESSIONS[slot].name[0]) {
+      /* En uzun süredir kullanılmayanı bırak */
+      HIST = SESSIONS[slot].hist;
+      JOURNAL = SESSIONS[slot].journal;
+      free_history();
+      journal_close();
+      HIST = empty;
+    }
+    snprintf(SESSIONS[slot].name, sizeof(SESSIONS[slot].name), "%s", name);
+    const char *journal_env = getenv("CHATGPT_JOURNAL");
+    if (!journal_env || strcmp(journal_env, "0") != 0)
+      journal_load(name);
+  }
+  SESSIONS[slot].seen = size;
+  SESSIONS[slot].used = mono_now();
+  SESSION_CUR = slot;
 }
 
-/* OpenAI çağrısı */
-static char *call_openai(const char *api_key, const char *model,
-                         const char *prompt) {
-  CURL *curl;
-  CURLcode res;
-  StreamBuffer stream_buf; // Changed from struct Memory chunk
-  struct curl_slist *headers = NULL;
-
-  stream_buf.full_response = malloc(1);
-  stream_buf.size = 0;
-  stream_buf.processed = 0;
-  if (!stream_buf.full_response) {
-    log_msg("Bellek hatası (stream_buf).");
-    return NULL;
+static void session_free_all(void) {
+  session_use(NULL);
+  for (int i = 0; i < DAEMON_SESSIONS; i++) {
+    if (!SESSIONS[i].name[0])
+      continue;
+    HIST = SESSIONS[i].hist;
+    JOURNAL = SESSIONS[i].journal;
+    free_history();
+    journal_close();
+    SESSIONS[i].name[0] = '\0';
   }
-  stream_buf.full_response[0] = 0; // Ensure it's null-terminated
+  HIST = (History){0};
+}
 
-  curl_global_init(CURL_GLOBAL_DEFAULT);
-  curl = curl_easy_init();
-  if (!curl) {
-    log_msg("curl_easy_init başarısız.");
-    free(stream_buf.full_response);
-    curl_global_cleanup();
-    return NULL;
+/* Tek seferlik soruyu çalıştırır; çıkış kodunu döner. in_fd boru ya da
+   dosyaysa içeriği mesaja akıtılır. stdout terminal değilse cevap akarken
+   bir kez, renksiz ve başlıksız yazılır; ikinci kez basılmaz. */
+static int run_oneshot(const char *api_key, const char *model,
+                       const char *prompt, const char *session, int in_fd) {
+  /* Estetik ve Sade Görünüm (Minimalist) */
+  /* Logları geçici olarak susturuyoruz */
+  int old_quiet = QUIET_MODE;
+  QUIET_MODE = 1;
+  /* NDJSON terminalde de ham akar: olaylar satır satır, gecikmesiz */
+  if (!isatty(STDOUT_FILENO) || OUTPUT_MODE == OUTPUT_NDJSON)
+    PLAIN_OUTPUT = session ? PLAIN_ON : PLAIN_NO_COPY;
+  OUT.init = 0;
+  NDJSON_SUMMARY_SENT = 0;
+
+  session_use(session);
+
+  if (!PLAIN_OUTPUT) {
+    printf("\n%s➤ Soru:%s %s\n", COLOR_USER, COLOR_RESET, prompt);
+    printf("\n%s➤ ChatGPT (%s):%s\n", COLOR_ASSIST, model, COLOR_RESET);
+    fflush(stdout);
   }
 
-  /* JSON Payload Oluşturma (Geçmiş dahil) */
-  StrBuf sb;
-  sb_init(&sb);
-
-  sb_append(&sb, "{");
-  sb_append(&sb, "\"model\":\"");
-  sb_append(&sb, model);
-  /* Streaming özelliğini açıyoruz + Usage info istiyoruz */
-  sb_append(&sb, "\",\"stream\":true,\"stream_options\":{\"include_usage\":"
-                 "true},\"messages\":[");
+  /* Bekleme efekti yerine basitçe işlem yapıldığını belirtelim ama log
+   * basmayalım */
+  /* call_openai içindeki loglar QUIET_MODE=1 olduğu için basılmayacak */
+
+  BodyStream *in = NULL;
+  if (stream_wanted(in_fd) && (in = malloc(sizeof(*in))) != NULL)
+    stream_init(in, in_fd);
+
+  char *answer = call_openai(api_key, model, prompt, NULL, in);
+  int rc = answer ? 0 : 1;
+  int in_error = in && in->error[0]; /* neden zaten yazıldı */
+  free(in);
+
+  if (answer) {
+    /* Cevap akarken zaten yazıldı; sadece satır sonunu tamamla */
+    if (OUTPUT_MODE == OUTPUT_NDJSON) {
+      /* her olay kendi satırında bitti */
+    } else if (PLAIN_OUTPUT) {
+      if (REPLY_LAST && REPLY_LAST != '\n')
+        putchar('\n');
+    } else {
+      printf("\n\n");
+    }
+    if (session) {
+      add_turn(prompt, answer);
+      SESSIONS[SESSION_CUR].seen = session_journal_size(session);
+    }
+    free(answer);
+  } else if (OUTPUT_MODE == OUTPUT_NDJSON) {
+    /* İstek hiç gönderilemediyse (bütçe vb.) özet olayı burada; neden
+       stderr'e yazıldı */
+    if (!NDJSON_SUMMARY_SENT)
+      ndjson_summary(model, NULL, NULL, 0, 0, "istek gönderilmedi");
+  } else if (PLAIN_OUTPUT) {
+    if (!HTTP_ABORTED && !in_error)
+      fprintf(stderr, "%s[!] Cevap alınamadı veya hata oluştu.%s\n",
+              COLOR_ERROR, COLOR_RESET);
+  } else if (!HTTP_ABORTED) {
+    printf("\n%s[!] Cevap alınamadı veya hata oluştu.%s\n", COLOR_ERROR,
+           COLOR_RESET);
+  }
 
-  /* System Prompt */
-  /* Öncelik: Config > Hardcoded */
-  char *config_sys = get_system_prompt_from_config();
-  const char *sys_text =
-      "Sen Linux terminalinden erişilen yardımcı bir asistansın. Türkçe konuş.";
+  fflush(stdout);
+  PLAIN_OUTPUT = PLAIN_OFF;
+  OUT.init = 0;
+  QUIET_MODE = old_quiet;
+  return rc;
+}
 
-  if (config_sys) {
-    sys_text = config_sys; /* Config'den gelen metni kullan */
-  } else if (CURRENT_LANG && strcmp(CURRENT_LANG, "en") == 0) {
-    sys_text = "You are a helpful assistant accessed from a Linux terminal.";
+/* $XDG_RUNTIME_DIR/chatgpt-cli-c.sock, yoksa /tmp/chatgpt-cli-c-<uid>/
+   daemon.sock. /tmp altındaki dizin sadece kullanıcıya ait ve 0700
+   olmalıdır; değilse kullanılmaz. */
+static int daemon_socket_path(char *out, size_t len, int create) {
+  const char *rt = getenv("XDG_RUNTIME_DIR");
+  int n;
+  if (rt && rt[0]) {
+    n = snprintf(out, len, "%s/chatgpt-cli-c.sock", rt);
+  } else {
+    char dir[64];
+    snprintf(dir, sizeof(dir), "/tmp/chatgpt-cli-c-%u", (unsigned)geteuid());
+    if (create && mkdir(dir, 0700) != 0 && errno != EEXIST)
+      return -1;
+    struct stat st;
+    if (lstat(dir, &st) != 0 || !S_ISDIR(st.st_mode) ||
+        st.st_uid != geteuid() || (st.st_mode & 077))
+      return -1;
+    n = snprintf(out, len, "%s/daemon.sock", dir);
   }
+  return n > 0 && (size_t)n < len ? 0 : -1;
+}
 
-  char *esc_sys = json_escape(sys_text);
-  if (esc_sys) {
-    sb_append(&sb, "{\"role\":\"system\",\"content\":\"");
-    sb_append(&sb, esc_sys);
-    sb_append(&sb, "\"},");
-    free(esc_sys);
-  }
-  if (config_sys)
-    free(config_sys);
+static int peer_is_self(int fd) {
+  struct ucred cr;
+  socklen_t len = sizeof(cr);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cr, &len) != 0)
+    return 0;
+  return cr.uid == geteuid();
+}
 
-  /* Geçmiş Mesajlar */
-  for (int i = 0; i < TURN_COUNT; i++) {
-    char *u = json_escape(TURNS[i].user);
-    char *a = json_escape(TURNS[i].assistant);
-
-    if (u) {
-      sb_append(&sb, "{\"role\":\"user\",\"content\":\"");
-      sb_append(&sb, u);
-      sb_append(&sb, "\"},");
-      free(u);
-    }
-    if (a) {
-      sb_append(&sb, "{\"role\":\"assistant\",\"content\":\"");
-      sb_append(&sb, a);
-      sb_append(&sb, "\"},");
-      free(a);
+static int fd_write_all(int fd, const char *p, size_t len) {
+  while (len > 0) {
+    ssize_t w = write(fd, p, len);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
     }
+    p += w;
+    len -= (size_t)w;
   }
+  return 0;
+}
 
-  /* Yeni Mesaj */
-  char *esc_user = json_escape(prompt);
-  if (esc_user) {
-    sb_append(&sb, "{\"role\":\"user\",\"content\":\"");
-    sb_append(&sb, esc_user);
-    sb_append(&sb, "\"}");
-    free(esc_user);
+static int fd_read_all(int fd, char *p, size_t len) {
+  while (len > 0) {
+    ssize_t r = read(fd, p, len);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return -1;
+    p += r;
+    len -= (size_t)r;
   }
+  return 0;
+}
 
-  sb_append(&sb, "],\"temperature\":0.3}");
+/* İstemci tarafı: tek seferlik çağrı daemon'a iletilebiliyorsa iletir ve
+   çıkış kodunu döner. Daemon yoksa, bayraklar iletilemiyorsa ya da hiçbir
+   şey gönderilemediyse -1 döner ve çağrı süreç içinde çalışır. Argümanlar
+   main'deki ayrıştırmayla aynı şekilde yorumlanır. */
+static int daemon_forward(int argc, char **argv) {
+  const char *env = getenv("CHATGPT_DAEMON");
+  if (env && strcmp(env, "0") == 0)
+    return -1;
 
-  char *payload = sb.data;
-  if (!payload) {
-    log_msg("Payload oluşturulamadı.");
-    free(stream_buf.full_response);
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
-    return NULL;
+  const char *model = "", *session = "";
+  DaemonReq rq = {DAEMON_MAGIC, 0, CACHE_OFF, 0, OUTPUT_TEXT};
+  const char *cache_env = getenv("CHATGPT_CACHE");
+  if (cache_env && strcmp(cache_env, "1") == 0)
+    rq.cache = CACHE_ON;
+  int no_cache = 0, refresh = 0, first = argc;
+  for (int i = 1; i < argc && first == argc; i++) {
+    const char *a = argv[i];
+    if (!strcmp(a, "-m") || !strcmp(a, "--model") || !strcmp(a, "--session")) {
+      if (i + 1 >= argc)
+        return -1;
+      if (a[1] == 'm' || a[2] == 'm')
+        model = argv[++i];
+      else
+        session = argv[++i];
+    } else if (!strcmp(a, "-q") || !strcmp(a, "--no-log")) {
+      /* tek seferlik mod zaten sessiz */
+    } else if (!strcmp(a, "--stats")) {
+      rq.stats = 1;
+    } else if (!strcmp(a, "--output") || !strncmp(a, "--output=", 9)) {
+      const char *v = a[8] == '=' ? a + 9 : i + 1 < argc ? argv[++i] : "";
+      int mode = output_mode_parse(v);
+      if (mode < 0)
+        return -1; /* hatayı süreç içindeki ayrıştırma basar */
+      rq.output = (uint32_t)mode;
+    } else if (!strcmp(a, "--cache")) {
+      rq.cache = CACHE_ON;
+    } else if (!strcmp(a, "--no-cache")) {
+      no_cache = 1;
+    } else if (!strcmp(a, "--refresh")) {
+      refresh = 1;
+    } else if (!strcmp(a, "--set-default-model") || !strcmp(a, "-l") ||
+               !strcmp(a, "--list-models") || !strcmp(a, "--compact") ||
+               !strcmp(a, "--batch") || !strcmp(a, "--concurrency") ||
+               !strcmp(a, "--trace") || !strcmp(a, "--completion-order") ||
+               !strcmp(a, "--daemon") || !strcmp(a, "--usage") ||
+               !strcmp(a, "--since") || !strcmp(a, "--by-model") ||
+               !strcmp(a, "-h") ||
+               !strcmp(a, "--help")) {
+      return -1; /* süreç içinde ele alınır */
+    } else {
+      first = i;
+    }
+  }
+  if (first == argc || (session[0] && !session_name_ok(session)) ||
+      strchr(model, ','))
+    return -1; /* karşılaştırma süreç içinde, kendi multi döngüsüyle */
+  if (no_cache)
+    rq.cache = CACHE_OFF;
+  else if (refresh)
+    rq.cache = CACHE_REFRESH;
+
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  if (daemon_socket_path(path, sizeof(path), 0) != 0)
+    return -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  memcpy(addr.sun_path, path, strlen(path) + 1);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      !peer_is_self(fd)) {
+    close(fd);
+    return -1;
   }
 
-  /* log_msg("API isteği gönderiliyor..."); (Streaming olduğu için log
-   * basmayalım, araya girmesin) */
-
-  curl_easy_setopt(curl, CURLOPT_URL,
-                   "https://api.openai.com/v1/chat/completions");
-  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-  curl_easy_setopt(curl, CURLOPT_POST, 1L);
-  curl_easy_setopt(curl, CURLOPT_TIMEOUT,
-                   120L); /* Streaming için süreyi uzatalım */
+  char *prompt = join_args_from(first, argc, argv);
+  const char *model_env = getenv("CHATGPT_MODEL");
+  StrBuf body;
+  sb_init(&body);
+  sb_append_n(&body, model, strlen(model) + 1);
+  sb_append_n(&body, model_env ? model_env : "",
+              (model_env ? strlen(model_env) : 0) + 1);
+  sb_append_n(&body, session, strlen(session) + 1);
+  if (prompt)
+    sb_append_n(&body, prompt, strlen(prompt) + 1);
+  free(prompt);
+  if (!prompt || !body.data || body.len > DAEMON_MAX_REQ) {
+    sb_free(&body);
+    close(fd);
+    return -1;
+  }
+  rq.len = (uint32_t)body.len;
+
+  /* Başlıkla birlikte stdin, stdout ve stderr devredilir */
+  int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } ctl;
+  memset(&ctl, 0, sizeof(ctl));
+  struct iovec iov = {&rq, sizeof(rq)};
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = ctl.buf,
+                       .msg_controllen = sizeof(ctl.buf)};
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cm), fds, sizeof(fds));
 
-  /* SSL Güvenliği */
-  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-  curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L);
+  fflush(stdout);
+  ssize_t sent;
+  do
+    sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  while (sent < 0 && errno == EINTR);
+  if (sent < 0) {
+    sb_free(&body);
+    close(fd);
+    return -1; /* daemon hiçbir şey almadı */
+  }
+  int ok = fd_write_all(fd, (const char *)&rq + sent, sizeof(rq) - (size_t)sent) ==
+               0 &&
+           fd_write_all(fd, body.data, body.len) == 0;
+  sb_free(&body);
+
+  unsigned char status = 1;
+  if (!ok || fd_read_all(fd, (char *)&status, 1) != 0) {
+    fprintf(stderr, "%s[!] Daemon bağlantısı koptu.%s\n", COLOR_ERROR,
+            COLOR_RESET);
+    status = 1;
+  }
+  close(fd);
+  return status;
+}
 
-  headers = curl_slist_append(headers, "Content-Type: application/json");
-  char auth_header[512];
-  snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s",
-           api_key);
-  headers = curl_slist_append(headers, auth_header);
+static void daemon_on_signal(int sig) {
+  (void)sig;
+  STOP_REQUESTED = 1;
+}
 
-  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,
-                   stream_callback); // Changed callback
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA,
-                   (void *)&stream_buf); // Changed userp
+/* Bir istemciyi işler: isteği okur, istemcinin stdout/stderr'ini devralıp
+   tek seferlik soruyu çalıştırır, çıkış kodunu geri yollar */
+static void daemon_serve(int cfd, const char *api_key) {
+  if (!peer_is_self(cfd)) {
+    log_msg("Başka bir kullanıcının bağlantısı reddedildi.");
+    return;
+  }
+  struct timeval tv = {5, 0};
+  setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  DaemonReq rq;
+  int fds[3] = {-1, -1, -1}; /* stdin, stdout, stderr */
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    struct cmsghdr align;
+  } ctl;
+  struct iovec iov = {&rq, sizeof(rq)};
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = ctl.buf,
+                       .msg_controllen = sizeof(ctl.buf)};
+  ssize_t got;
+  do
+    got = recvmsg(cfd, &msg, MSG_CMSG_CLOEXEC);
+  while (got < 0 && errno == EINTR);
+  for (struct cmsghdr *cm = got > 0 ? CMSG_FIRSTHDR(&msg) : NULL; cm;
+       cm = CMSG_NXTHDR(&msg, cm)) {
+    if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS &&
+        cm->cmsg_len == CMSG_LEN(sizeof(fds)))
+      memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+  }
 
-  res = curl_easy_perform(curl);
+  char *body = NULL;
+  int ok = got > 0 && fds[0] >= 0 &&
+           fd_read_all(cfd, (char *)&rq + got, sizeof(rq) - (size_t)got) == 0 &&
+           rq.magic == DAEMON_MAGIC && rq.len > 0 && rq.len <= DAEMON_MAX_REQ &&
+           rq.output <= OUTPUT_NDJSON &&
+           (body = malloc(rq.len)) != NULL &&
+           fd_read_all(cfd, body, rq.len) == 0;
+
+  /* model\0 env_model\0 oturum\0 soru\0 */
+  const char *field[4] = {NULL, NULL, NULL, NULL};
+  if (ok) {
+    body[rq.len - 1] = '\0';
+    const char *p = body, *end = body + rq.len;
+    for (int i = 0; i < 4 && p < end; i++) {
+      field[i] = p;
+      p += strlen(p) + 1;
+    }
+    ok = field[3] != NULL && (!field[2][0] || session_name_ok(field[2]));
+  }
+  if (!ok) {
+    if (got != 0) /* boş bağlantı: çalışıyor mu yoklaması */
+      log_msg("Geçersiz daemon isteği yok sayıldı.");
+    free(body);
+    for (int i = 0; i < 3; i++)
+      if (fds[i] >= 0)
+        close(fds[i]);
+    return;
+  }
 
-  sb_free(&sb); /* Payload artık gerekli değil */
-  curl_slist_free_all(headers);
-  curl_easy_cleanup(curl);
-  curl_global_cleanup();
+  /* Ayar dosyaları değiştiyse uygula */
+  unsigned changed = config_poll();
+  if ((changed & (1u << CFG_LANG)) && CFG.val[CFG_LANG]) {
+    free(CURRENT_LANG);
+    CURRENT_LANG = my_strdup(CFG.val[CFG_LANG]);
+  }
+  /* Model önceliği: CLI > config > CHATGPT_MODEL > DEFAULT_MODEL */
+  const char *model = field[0][0]          ? field[0]
+                      : CFG.val[CFG_MODEL] ? CFG.val[CFG_MODEL]
+                      : field[1][0]        ? field[1]
+                                           : DEFAULT_MODEL;
+
+  int saved_cache = CACHE_MODE, saved_stats = STATS_MODE;
+  CACHE_MODE = rq.cache;
+  STATS_MODE = rq.stats != 0;
+  OUTPUT_MODE = (int)rq.output;
+
+  /* Çıktı doğrudan istemcinin stdout/stderr'ine gider */
+  int saved_out = dup(STDOUT_FILENO), saved_err = dup(STDERR_FILENO);
+  fflush(stdout);
+  fflush(stderr);
+  dup2(fds[1], STDOUT_FILENO);
+  dup2(fds[2], STDERR_FILENO);
+  close(fds[1]);
+  close(fds[2]);
+  OUT.init = 0; /* tty/kare ayarı istemcinin çıktısına göre */
+  HTTP_ABORT_FD = cfd;
+
+  int rc = run_oneshot(api_key, model, field[3],
+                       field[2][0] ? field[2] : NULL, fds[0]);
+  close(fds[0]);
+
+  HTTP_ABORT_FD = -1;
+  out_flush();
+  fflush(stdout);
+  fflush(stderr);
+  dup2(saved_out, STDOUT_FILENO);
+  dup2(saved_err, STDERR_FILENO);
+  close(saved_out);
+  close(saved_err);
+  OUT.init = 0;
+  CACHE_MODE = saved_cache;
+  STATS_MODE = saved_stats;
+  OUTPUT_MODE = OUTPUT_TEXT;
+  free(body);
+
+  unsigned char status = (unsigned char)rc;
+  if (send(cfd, &status, 1, MSG_NOSIGNAL) != 1 && !HTTP_ABORTED)
+    log_msg("İstemciye çıkış kodu gönderilemedi.");
+}
 
-  if (res != CURLE_OK) {
-    fprintf(stderr, "\n%schatgpt-cli: curl hatası:%s %s\n", COLOR_ERROR,
-            COLOR_RESET, curl_easy_strerror(res));
-    free(stream_buf.full_response);
-    return NULL;
+static int run_daemon(const char *api_key) {
+  char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+  if (daemon_socket_path(path, sizeof(path), 1) != 0) {
+    fprintf(stderr, "%s[!] Daemon soket yolu kullanılamıyor.%s\n",
+            COLOR_ERROR, COLOR_RESET);
+    return 1;
+  }
+  int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (lfd < 0)
+    return 1;
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  memcpy(addr.sun_path, path, strlen(path) + 1);
+
+  /* Çalışan bir daemon varsa dokunma; yoksa kalan eski soketi sil */
+  if (connect(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    fprintf(stderr, "%s[!] Daemon zaten çalışıyor: %s%s\n", COLOR_ERROR, path,
+            COLOR_RESET);
+    close(lfd);
+    return 1;
+  }
+  close(lfd);
+  unlink(path);
+  lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  mode_t old_mask = umask(0177);
+  int bound = lfd >= 0 && bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+  umask(old_mask);
+  if (!bound || listen(lfd, 16) != 0) {
+    fprintf(stderr, "%s[!] Daemon soketi açılamadı: %s (%s)%s\n", COLOR_ERROR,
+            path, strerror(errno), COLOR_RESET);
+    if (lfd >= 0)
+      close(lfd);
+    return 1;
   }
 
-  /* Streaming bitti. Elimizde stream_buf.full_response içinde "data:
-     JSON\ndata: JSON..." var. History'ye eklemek için bu ham veriden sadece
-     "content"leri birleştirip temiz bir string çıkarmamız lazım.
-     stream_callback zaten ekrana bastı, ama history için temiz metne
-     ihtiyacımız var.
-   */
-
-  /* Reconstruct full text from SSE buffer for History */
-  size_t total_cap = 4096;
-  char *full_text = malloc(total_cap);
-  full_text[0] = '\0';
-  size_t current_len = 0;
-
-  char *p = stream_buf.full_response;
-  char *line_start = p;
-
-  while (*p) {
-    if (*p == '\n') {
-      size_t line_len = p - line_start;
-      if (line_len > 6 && strncmp(line_start, "data: ", 6) == 0) {
-        char *json_part = line_start + 6;
-        size_t json_len = line_len - 6;
-
-        if (json_len >= 6 && strncmp(json_part, "[DONE]", 6) == 0) {
-          // Bitti
-        } else {
-          /* JSON String Extraction safely */
-          char *line_buf = malloc(line_len + 1);
-          if (line_buf) {
-            memcpy(line_buf, line_start, line_len);
-            line_buf[line_len] = '\0';
-
-            char *safe_json = line_buf + 6;
-            const char *d_cont = strstr(safe_json, "\"content\":");
-
-            if (d_cont) {
-              d_cont += 10;
-              // Skip whitespace until quote
-              while (*d_cont == ' ' || *d_cont == ':' || *d_cont == '\t')
-                d_cont++;
-
-              if (*d_cont == '"') {
-                d_cont++; // Skip open quote
-                int escaped = 0;
-                for (const char *c = d_cont; *c; c++) {
-                  if (escaped) {
-                    char ch = *c;
-                    if (ch == 'n')
-                      ch = '\n';
-                    else if (ch == 't')
-                      ch = '\t';
-                    else if (ch == '"')
-                      ch = '"';
-                    else if (ch == '\\')
-                      ch = '\\';
-
-                    if (current_len + 2 >= total_cap) {
-                      total_cap *= 2;
-                      full_text = realloc(full_text, total_cap);
-                      if (!full_text) {
-                        free(stream_buf.full_response);
-                        free(line_buf);
-                        return NULL;
-                      }
-                    }
-                    full_text[current_len++] = ch;
-                    full_text[current_len] = '\0';
-                    escaped = 0;
-                  } else {
-                    if (*c == '\\') {
-                      escaped = 1;
-                    } else if (*c == '"') {
-                      break;
-                    } else {
-                      if (current_len + 2 >= total_cap) {
-                        total_cap *= 2;
-                        full_text = realloc(full_text, total_cap);
-                        if (!full_text) {
-                          free(stream_buf.full_response);
-                          free(line_buf);
-                          return NULL;
-                        }
-                      }
-                      full_text[current_len++] = *c;
-                      full_text[current_len] = '\0';
-                    }
-                  }
-                }
-              }
-            }
-            free(line_buf);
-          }
-        }
-      }
-      line_start = p + 1;
-    }
-    p++;
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = daemon_on_signal; /* SA_RESTART yok: accept kesilsin */
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  hist_configure();
+  config_watch();
+  char msg[160];
+  snprintf(msg, sizeof(msg), "Daemon dinliyor: %s", path);
+  log_msg(msg);
+
+  while (!STOP_REQUESTED) {
+    http_idle_wait(lfd);
+    if (STOP_REQUESTED)
+      break;
+    int cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+    if (cfd < 0)
+      continue;
+    daemon_serve(cfd, api_key);
+    close(cfd);
   }
 
-  free(stream_buf.full_response);
+  log_msg("Daemon kapanıyor.");
+  close(lfd);
+  unlink(path);
+  session_free_all();
+  return 0;
+}
+
+/* Etkileşimli modun arayüz metinleri. Dil ayarı çalışırken değişirse
+   (config_poll) tablo yeniden seçilir. */
+typedef struct {
+  const char *welcome, *model, *lang, *cmds, *me, *bye, *hist_cleared;
+  const char *suggested, *run_hint, *no_cmd, *invalid_num, *run_cmd;
+  const char *confirm, *cancelled, *ret_code;
+} UiText;
+
+static const UiText UI_TR = {
+    .welcome = "ChatGPT CLI (C sürümü)",
+    .model = "Aktif model",
+    .lang = "Aktif dil",
+    .cmds = "Komutlar: /exit, /model, /history, /clear, /read "
+            "<dosya>, /save <dosya>, /copy, /ml, /run N, "
+            "/sessions, /load <ad>, /stats, /blocks, "
+            "/save N <dosya>, /compare <m1,m2> <soru>",
+    .me = "Ben",
+    .bye = "Görüşürüz 👋",
+    .hist_cleared = "Sohbet geçmişi temizlendi.",
+    .suggested = "Önerilen komutlar",
+    .run_hint = "(Çalıştırmak için /run NUMARA yazabilirsin.)",
+    .no_cmd =
+        "Çalıştırılabilir komut yok (son yanıtta '$ ' satırı yok).",
+    .invalid_num = "Geçerli bir komut numarası gir",
+    .run_cmd = "Çalıştırılacak komut",
+    .confirm = "Onaylıyor musun? [y/N]: ",
+    .cancelled = "İptal edildi.",
+    .ret_code = "Komut dönüş kodu",
+};
 
-  /* /copy için cevabı global değişkende sakla */
-  if (LAST_RESPONSE)
-    free(LAST_RESPONSE);
-  LAST_RESPONSE = full_text ? my_strdup(full_text) : NULL;
+static const UiText UI_EN = {
+    .welcome = "ChatGPT CLI (C version)",
+    .model = "Active model",
+    .lang = "Active language",
+    .cmds = "Commands: /exit, /model, /history, /clear, /read <file>, /save "
+            "<file>, /copy, /ml, /run N, /sessions, /load <name>, "
+            "/stats, /blocks, /save N <file>, /compare <m1,m2> <prompt>",
+    .me = "Me",
+    .bye = "Bye 👋",
+    .hist_cleared = "Chat history cleared.",
+    .suggested = "Suggested commands",
+    .run_hint = "(Type /run NUMBER to execute.)",
+    .no_cmd =
+        "No executable commands found (no '$ ' lines in last response).",
+    .invalid_num = "Enter a valid command number",
+    .run_cmd = "Command to run",
+    .confirm = "Do you approve? [y/N]: ",
+    .cancelled = "Cancelled.",
+    .ret_code = "Command return code",
+};
 
-  return full_text;
+static const UiText *ui_text(const char *lang) {
+  return lang && strcmp(lang, "en") == 0 ? &UI_EN : &UI_TR;
+}
+
+/* Etkin model: -m > ayar dosyası > CHATGPT_MODEL > varsayılan. CFG.val[]
+   her yeniden okumada serbest bırakıldığından çağırana kopya döner. */
+static char *model_resolve(const char *cli, const char *env) {
+  if (cli)
+    return my_strdup(cli);
+  if (CFG.val[CFG_MODEL])
+    return my_strdup(CFG.val[CFG_MODEL]);
+  return my_strdup(env && env[0] ? env : DEFAULT_MODEL);
 }
 
 /* ===== main ===== */
 
 int main(int argc, char **argv) {
+  /* Daemon çalışıyorsa tek seferlik soru ona iletilir */
+  int forwarded = daemon_forward(argc, argv);
+  if (forwarded >= 0)
+    return forwarded;
+
+  config_load();
   char *api_key = load_api_key();
   if (!api_key) {
     log_msg("API anahtarı alınamadı, çıkılıyor.");
     return 1;
   }
 
-  const char *model = DEFAULT_MODEL;
   const char *model_env = getenv("CHATGPT_MODEL");
-  char *model_cfg = get_model_from_config();
-
-  if (model_cfg && model_cfg[0]) {
-    model = model_cfg;
-  } else if (model_env && model_env[0]) {
-    model = model_env;
-  }
-
   const char *model_cli = NULL;
   int list_models_flag = 0;
   int set_default_model_flag = 0;
   const char *new_default_model = NULL;
   int first_non_option = argc;
+  const char *session_name = NULL;
+  int no_cache_flag = 0, refresh_flag = 0;
+  const char *batch_path = NULL;
+  int batch_concurrency = BATCH_DEFAULT_CONCURRENCY;
+  int batch_completion_order = 0;
+  int daemon_flag = 0;
+  int usage_flag = 0, usage_by_model = 0;
+  const char *usage_since = NULL;
+
+  const char *cache_env = getenv("CHATGPT_CACHE");
+  if (cache_env && strcmp(cache_env, "1") == 0)
+    CACHE_MODE = CACHE_ON;
+  const char *trace_env = getenv("CHATGPT_TRACE");
+  if (trace_env && trace_env[0])
+    TRACE_PATH = trace_env;
+  compact_configure(getenv("CHATGPT_COMPACT"));
 
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "-m") == 0 || strcmp(argv[i], "--model") == 0) {
@@ -998,10 +8315,74 @@ int main(int argc, char **argv) {
       list_models_flag = 1;
     } else if (strcmp(argv[i], "-q") == 0 || strcmp(argv[i], "--no-log") == 0) {
       QUIET_MODE = 1;
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      STATS_MODE = 1;
+    } else if (strcmp(argv[i], "--output") == 0 ||
+               strncmp(argv[i], "--output=", 9) == 0) {
+      const char *v = argv[i][8] == '=' ? argv[i] + 9
+                      : i + 1 < argc    ? argv[++i]
+                                        : "";
+      OUTPUT_MODE = output_mode_parse(v);
+      if (OUTPUT_MODE < 0) {
+        fprintf(stderr, "Hata: --output 'text' ya da 'ndjson' ister.\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--compact") == 0) {
+      if (!COMPACT.threshold)
+        COMPACT.threshold = COMPACT_DEFAULT_TOKENS;
+    } else if (strcmp(argv[i], "--cache") == 0) {
+      CACHE_MODE = CACHE_ON;
+    } else if (strcmp(argv[i], "--no-cache") == 0) {
+      no_cache_flag = 1;
+    } else if (strcmp(argv[i], "--refresh") == 0) {
+      refresh_flag = 1;
+    } else if (strcmp(argv[i], "--batch") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Hata: --batch bir JSONL dosyası ister.\n");
+        return 1;
+      }
+      batch_path = argv[i + 1];
+      i++;
+    } else if (strcmp(argv[i], "--concurrency") == 0) {
+      if (i + 1 >= argc || atoi(argv[i + 1]) <= 0) {
+        fprintf(stderr, "Hata: --concurrency pozitif bir sayı ister.\n");
+        return 1;
+      }
+      batch_concurrency = atoi(argv[i + 1]);
+      i++;
+    } else if (strcmp(argv[i], "--trace") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Hata: --trace bir dosya yolu ister.\n");
+        return 1;
+      }
+      TRACE_PATH = argv[i + 1];
+      i++;
+    } else if (strcmp(argv[i], "--completion-order") == 0) {
+      batch_completion_order = 1;
+    } else if (strcmp(argv[i], "--daemon") == 0) {
+      daemon_flag = 1;
+    } else if (strcmp(argv[i], "--usage") == 0) {
+      usage_flag = 1;
+    } else if (strcmp(argv[i], "--by-model") == 0) {
+      usage_by_model = 1;
+    } else if (strcmp(argv[i], "--since") == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "Hata: --since bir tarih ya da süre ister.\n");
+        return 1;
+      }
+      usage_since = argv[i + 1];
+      i++;
+    } else if (strcmp(argv[i], "--session") == 0) {
+      if (i + 1 >= argc || !session_name_ok(argv[i + 1])) {
+        fprintf(stderr, "Hata: --session geçerli bir oturum adı ister "
+                        "([A-Za-z0-9._-]).\n");
+        return 1;
+      }
+      session_name = argv[i + 1];
+      i++;
     } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
       print_usage(argv[0]);
       free(api_key);
-      free(model_cfg);
       return 0;
     } else {
       first_non_option = i;
@@ -1009,30 +8390,96 @@ int main(int argc, char **argv) {
     }
   }
 
-  if (model_cli) {
-    model = model_cli;
+  char *model = model_resolve(model_cli, model_env);
+  if (!model) {
+    free(api_key);
+    return 1;
+  }
+
+  /* Sıradan bağımsız: --no-cache her şeyi, --refresh de --cache'i ezer */
+  if (no_cache_flag)
+    CACHE_MODE = CACHE_OFF;
+  else if (refresh_flag)
+    CACHE_MODE = CACHE_REFRESH;
+
+  if (strchr(model, ',') &&
+      (first_non_option >= argc || batch_path || daemon_flag)) {
+    fprintf(stderr, "Hata: birden çok model sadece tek seferlik soruyla ya "
+                    "da /compare ile kullanılabilir.\n");
+    free(api_key);
+    free(model);
+    return 1;
+  }
+
+  if (OUTPUT_MODE == OUTPUT_NDJSON &&
+      (first_non_option >= argc || batch_path || daemon_flag ||
+       strchr(model, ','))) {
+    fprintf(stderr, "Hata: --output=ndjson sadece tek seferlik soruyla "
+                    "kullanılabilir.\n");
+    free(api_key);
+    free(model);
+    return 1;
   }
 
   if (set_default_model_flag) {
-    if (write_model_to_config(new_default_model) == 0) {
+    if (config_write(CFG_MODEL, new_default_model) == 0) {
       printf("Varsayılan model '%s' olarak ayarlandı.\n", new_default_model);
     } else {
       printf("Varsayılan model kaydedilemedi.\n");
     }
     free(api_key);
-    free(model_cfg);
+    free(model);
     return 0;
   }
 
   if (list_models_flag) {
     print_models();
     free(api_key);
-    free(model_cfg);
+    free(model);
     return 0;
   }
 
+  if (usage_flag) {
+    int rc = run_usage(usage_since, usage_by_model);
+    free(api_key);
+    free(model);
+    return rc;
+  }
+
+  if (http_init() != 0) {
+    http_cleanup();
+    free(api_key);
+    free(model);
+    return 1;
+  }
+
   /* Dil ayarını yükle (hem tek seferlik hem etkileşimli mod için) */
-  CURRENT_LANG = get_lang_from_config();
+  CURRENT_LANG = my_strdup(CFG.val[CFG_LANG]);
+
+  /* Toplu iş modu */
+  if (batch_path) {
+    int rc = run_batch(api_key, model, batch_path, batch_concurrency,
+                       batch_completion_order);
+    rate_close();
+    http_cleanup();
+    config_free();
+    free(CURRENT_LANG);
+    free(api_key);
+    free(model);
+    return rc;
+  }
+
+  /* Daemon modu */
+  if (daemon_flag) {
+    int rc = run_daemon(api_key);
+    rate_close();
+    http_cleanup();
+    config_free();
+    free(CURRENT_LANG);
+    free(api_key);
+    free(model);
+    return rc;
+  }
   /* Eğer config yoksa, tek seferlik modda varsayılan (NULL -> TR) kalır.
      Etkileşimli modda aşağıda sorulacak. */
 
@@ -1042,42 +8489,48 @@ int main(int argc, char **argv) {
     if (!prompt) {
       log_msg("Argümanlar birleştirilirken bellek hatası.");
       free(api_key);
-      free(model_cfg);
+      free(model);
       return 1;
     }
 
-    /* Estetik ve Sade Görünüm (Minimalist) */
-    /* Logları geçici olarak susturuyoruz */
-    int old_quiet = QUIET_MODE;
-    QUIET_MODE = 1;
-
-    printf("\n%s➤ Soru:%s %s\n", COLOR_USER, COLOR_RESET, prompt);
-
-    /* Bekleme efekti yerine basitçe işlem yapıldığını belirtelim ama log
-     * basmayalım */
-    /* call_openai içindeki loglar QUIET_MODE=1 olduğu için basılmayacak */
-
-    char *answer = call_openai(api_key, model, prompt);
-
-    if (answer) {
-      printf("\n%s➤ ChatGPT (%s):%s\n", COLOR_ASSIST, model, COLOR_RESET);
-      printf("%s%s%s\n\n", COLOR_RESET, answer, COLOR_RESET);
-      free(answer);
+    hist_configure();
+    int rc;
+    if (strchr(model, ',')) {
+      session_use(session_name);
+      rc = run_compare(api_key, model, prompt);
     } else {
-      printf("\n%s[!] Cevap alınamadı veya hata oluştu.%s\n", COLOR_ERROR,
-             COLOR_RESET);
+      rc = run_oneshot(api_key, model, prompt, session_name, STDIN_FILENO);
     }
+    session_free_all();
 
-    QUIET_MODE = old_quiet;
-
+    rate_close();
+    http_cleanup();
     free(prompt);
     free(api_key);
-    free(model_cfg);
-    return 0;
+    free(model);
+    return rc;
   }
 
   /* Etkileşimli mod */
   log_msg("Etkileşimli mod başlatıldı.");
+  cancel_install();
+  hist_configure();
+  config_watch();
+
+  /* Oturum günlüğü (CHATGPT_JOURNAL=0 ile kapatılır) */
+  const char *journal_env = getenv("CHATGPT_JOURNAL");
+  if (!journal_env || strcmp(journal_env, "0") != 0) {
+    char default_name[32];
+    if (!session_name) {
+      default_session_name(default_name, sizeof(default_name));
+      session_name = default_name;
+    }
+    int loaded = journal_load(session_name);
+    if (loaded > 0) {
+      printf("%sOturum '%s' devam ediyor (%d tur yüklendi).%s\n", COLOR_INFO,
+             session_name, loaded, COLOR_RESET);
+    }
+  }
 
   /* Dil Seçimi (Eğer yüklenmediyse sor) */
   if (!CURRENT_LANG) {
@@ -1095,7 +8548,7 @@ int main(int argc, char **argv) {
       if (fgets(lbuf, sizeof(lbuf), stdin)) {
         trim(lbuf);
         if (lbuf[0] == 'y' || lbuf[0] == 'Y') {
-          write_lang_to_config(CURRENT_LANG);
+          config_write(CFG_LANG, CURRENT_LANG);
           printf("Dil ayarı kaydedildi: %s\n", CURRENT_LANG);
         }
       }
@@ -1105,62 +8558,23 @@ int main(int argc, char **argv) {
   }
 
   /* UI Metinleri */
-  const char *ui_welcome = "ChatGPT CLI (C sürümü)";
-  const char *ui_model = "Aktif model";
-  const char *ui_lang = "Aktif dil";
-  const char *ui_cmds = "Komutlar: /exit, /model, /history, /clear, /read "
-                        "<dosya>, /save <dosya>, /copy, /ml, /run N";
-  const char *ui_me = "Ben";
-  const char *ui_bye = "Görüşürüz 👋";
-  const char *ui_hist_cleared = "Sohbet geçmişi temizlendi.";
-  const char *ui_suggested = "Önerilen komutlar";
-  const char *ui_run_hint = "(Çalıştırmak için /run NUMARA yazabilirsin.)";
-  const char *ui_no_cmd =
-      "Çalıştırılabilir komut yok (son yanıtta '$ ' satırı yok).";
-  const char *ui_invalid_num = "Geçerli bir komut numarası gir";
-  const char *ui_run_cmd = "Çalıştırılacak komut";
-  const char *ui_confirm = "Onaylıyor musun? [y/N]: ";
-  const char *ui_cancelled = "İptal edildi.";
-  const char *ui_ret_code = "Komut dönüş kodu";
-
-  if (CURRENT_LANG && strcmp(CURRENT_LANG, "en") == 0) {
-    ui_welcome = "ChatGPT CLI (C version)";
-    ui_model = "Active model";
-    ui_lang = "Active language";
-    ui_cmds = "Commands: /exit, /model, /history, /clear, /read <file>, /save "
-              "<file>, /copy, /ml, /run N";
-    ui_me = "Me";
-    ui_bye = "Bye 👋";
-    ui_hist_cleared = "Chat history cleared.";
-    ui_suggested = "Suggested commands";
-    ui_run_hint = "(Type /run NUMBER to execute.)";
-    ui_no_cmd =
-        "No executable commands found (no '$ ' lines in last response).";
-    ui_invalid_num = "Enter a valid command number";
-    ui_run_cmd = "Command to run";
-    ui_confirm = "Do you approve? [y/N]: ";
-    ui_cancelled = "Cancelled.";
-    ui_ret_code = "Command return code";
-  }
-
-  printf("%s%s%s\n", COLOR_INFO, ui_welcome, COLOR_RESET);
-  printf("%s: %s\n", ui_model, model);
-  printf("%s: %s\n", ui_lang, CURRENT_LANG);
-  printf("%s\n", ui_cmds);
-
-  char *buf = malloc(4096);
-  if (!buf) {
-    log_msg("Ana döngü için bellek ayrılamadı.");
-    free(api_key);
-    free(model_cfg);
-    return 1;
-  }
+  const UiText *ui = ui_text(CURRENT_LANG);
+
+  printf("%s%s%s\n", COLOR_INFO, ui->welcome, COLOR_RESET);
+  printf("%s: %s\n", ui->model, model);
+  printf("%s: %s\n", ui->lang, CURRENT_LANG);
+  printf("%s\n", ui->cmds);
+
+  /* Satır uzunluğu sınırsız (getline) */
+  char *buf = NULL;
+  size_t buf_cap = 0;
 
   while (1) {
-    printf("\n%s%s:%s ", COLOR_USER, ui_me, COLOR_RESET);
+    printf("\n%s%s:%s ", COLOR_USER, ui->me, COLOR_RESET);
     fflush(stdout);
 
-    if (!fgets(buf, 4096, stdin)) {
+    prompt_wait();
+    if (getline(&buf, &buf_cap, stdin) < 0) {
       printf("\nÇıkılıyor.\n");
       break;
     }
@@ -1169,13 +8583,33 @@ int main(int argc, char **argv) {
     if (!buf[0])
       continue;
 
+    /* Yazma sırasında biten arka plan özeti varsa geçmişe uygula */
+    compact_poll();
+
+    /* Ayar dosyaları (bekleme sırasında) değiştiyse yeniden başlatmadan
+       uygula */
+    unsigned changed = config_poll();
+    if ((changed & (1u << CFG_LANG)) && CFG.val[CFG_LANG]) {
+      free(CURRENT_LANG);
+      CURRENT_LANG = my_strdup(CFG.val[CFG_LANG]);
+      ui = ui_text(CURRENT_LANG);
+    }
+    if ((changed & (1u << CFG_MODEL)) && !model_cli) {
+      char *m = model_resolve(NULL, model_env);
+      if (m) {
+        free(model);
+        model = m;
+      }
+      printf("%s%s: %s%s\n", COLOR_INFO, ui->model, model, COLOR_RESET);
+    }
+
     if (!strcmp(buf, "/exit") || !strcmp(buf, "/quit")) {
-      printf("%s\n", ui_bye);
+      printf("%s\n", ui->bye);
       break;
     }
 
     if (!strcmp(buf, "/model")) {
-      printf("%s: %s\n", ui_model, model);
+      printf("%s: %s\n", ui->model, model);
       continue;
     }
 
@@ -1185,12 +8619,61 @@ int main(int argc, char **argv) {
     }
 
     if (!strcmp(buf, "/clear")) {
-      for (int i = 0; i < TURN_COUNT; i++) {
-        free(TURNS[i].user);
-        free(TURNS[i].assistant);
+      clear_history();
+      journal_mark_clear();
+      printf("%s%s%s\n", COLOR_INFO, ui->hist_cleared, COLOR_RESET);
+      continue;
+    }
+
+    if (!strcmp(buf, "/stats")) {
+      print_latency_stats();
+      continue;
+    }
+
+    if (!strncmp(buf, "/compare", 8) && (!buf[8] || buf[8] == ' ')) {
+      char *list = buf + 8;
+      while (*list == ' ')
+        list++;
+      char *question = strchr(list, ' ');
+      if (question) {
+        *question++ = '\0';
+        while (*question == ' ')
+          question++;
+      }
+      if (!question || !*question || !strchr(list, ',')) {
+        printf("%sKullanım: /compare model1,model2[,...] soru%s\n",
+               COLOR_ERROR, COLOR_RESET);
+        continue;
+      }
+      run_compare(api_key, list, question);
+      /* Kazanan varsayılan yapıldıysa config_write ayarı yeniden okudu;
+         etkin model kopyası da yenilenir. */
+      char *m = model_resolve(model_cli, model_env);
+      if (m) {
+        free(model);
+        model = m;
+      }
+      compact_maybe_start(api_key, model);
+      continue;
+    }
+
+    if (!strcmp(buf, "/sessions")) {
+      print_sessions();
+      continue;
+    }
+
+    if (!strncmp(buf, "/load ", 6)) {
+      char *name = buf + 6;
+      while (*name == ' ')
+        name++;
+      if (!session_name_ok(name)) {
+        printf("%s[!] Geçersiz oturum adı: %s%s\n", COLOR_ERROR, name,
+               COLOR_RESET);
+        continue;
       }
-      TURN_COUNT = 0;
-      printf("%s%s%s\n", COLOR_INFO, ui_hist_cleared, COLOR_RESET);
+      int loaded = journal_load(name);
+      printf("%sOturum '%s' yüklendi (%d tur).%s\n", COLOR_INFO, name, loaded,
+             COLOR_RESET);
       continue;
     }
 
@@ -1202,18 +8685,20 @@ int main(int argc, char **argv) {
       log_msg("Modelden cevap bekleniyor (çok satırlı)...");
       printf("\n%sChatGPT:%s", COLOR_ASSIST, COLOR_RESET);
       fflush(stdout);
-      char *answer = call_openai(api_key, model, multi);
+      compact_poll();
+      char *answer = call_openai(api_key, model, multi, NULL, NULL);
       if (answer) {
         printf("\n"); /* Son bir newline */
-        extract_commands_from_answer(answer);
+        md_commands(answer);
         if (LAST_CMD_COUNT > 0) {
-          printf("%s%s:%s\n", COLOR_CMD, ui_suggested, COLOR_RESET);
+          printf("%s%s:%s\n", COLOR_CMD, ui->suggested, COLOR_RESET);
           for (int i = 0; i < LAST_CMD_COUNT; i++) {
             printf("  [%d] $ %s\n", i + 1, LAST_CMDS[i]);
           }
-          printf("%s\n", ui_run_hint);
+          printf("%s\n", ui->run_hint);
         }
         add_turn(multi, answer);
+        compact_maybe_start(api_key, model);
         free(answer);
       }
       free(multi);
@@ -1222,18 +8707,18 @@ int main(int argc, char **argv) {
 
     if (!strncmp(buf, "/run", 4)) {
       if (LAST_CMD_COUNT == 0) {
-        printf("%s%s%s\n", COLOR_INFO, ui_no_cmd, COLOR_RESET);
+        printf("%s%s%s\n", COLOR_INFO, ui->no_cmd, COLOR_RESET);
         continue;
       }
       int idx = 0;
       if (sscanf(buf + 4, "%d", &idx) != 1 || idx < 1 || idx > LAST_CMD_COUNT) {
-        printf("%s%s (1-%d).%s\n", COLOR_ERROR, ui_invalid_num, LAST_CMD_COUNT,
+        printf("%s%s (1-%d).%s\n", COLOR_ERROR, ui->invalid_num, LAST_CMD_COUNT,
                COLOR_RESET);
         continue;
       }
       const char *cmd = LAST_CMDS[idx - 1];
-      printf("%s%s:%s %s\n", COLOR_CMD, ui_run_cmd, COLOR_RESET, cmd);
-      printf("%s", ui_confirm);
+      printf("%s%s:%s %s\n", COLOR_CMD, ui->run_cmd, COLOR_RESET, cmd);
+      printf("%s", ui->confirm);
       char ans[16];
       if (!fgets(ans, sizeof(ans), stdin)) {
         continue;
@@ -1241,9 +8726,9 @@ int main(int argc, char **argv) {
       if (ans[0] == 'y' || ans[0] == 'Y') {
         log_msg("Shell komutu system() ile çalıştırılıyor...");
         int rc = system(cmd);
-        printf("%s%s:%s %d\n", COLOR_INFO, ui_ret_code, COLOR_RESET, rc);
+        printf("%s%s:%s %d\n", COLOR_INFO, ui->ret_code, COLOR_RESET, rc);
       } else {
-        printf("%s\n", ui_cancelled);
+        printf("%s\n", ui->cancelled);
       }
       continue;
     }
@@ -1253,31 +8738,54 @@ int main(int argc, char **argv) {
       while (*fpath == ' ')
         fpath++;
 
-      char *fcontent = read_file(fpath);
-      if (!fcontent) {
-        printf("%s[!] Dosya okunamadı: %s%s\n", COLOR_ERROR, fpath,
+      /* /read dosya --grep desen1|desen2: büyük dosyada örneklenecek satırlar */
+      char *grep = strstr(fpath, " --grep ");
+      if (grep) {
+        *grep = '\0';
+        grep += 8;
+        while (*grep == ' ')
+          grep++;
+      }
+
+      /* Dizin ve glob desenleri birden çok dosyaya açılır; tek dosya
+         olduğu gibi (ikili olsa da) eklenir */
+      PathList pl = {0};
+      int single = attach_expand(fpath, &pl);
+      size_t skipped = 0;
+      Attach *att = single < 0 ? NULL : attach_load(&pl, !single, &skipped);
+      if (!att) {
+        printf("%s[!] %s: %s%s\n", COLOR_ERROR,
+               single == 0 ? "Eşleşen dosya yok" : "Dosya okunamadı", fpath,
                COLOR_RESET);
       } else {
-        if (PENDING_FILE_CONTENT)
-          free(PENDING_FILE_CONTENT);
-
-        /* Kullanıcıya bilgi ver ve otomatik olarak içeriği prompt'a
-         * ekleyeceğimizi söyle */
-        size_t c_len = strlen(fcontent);
-        printf(
-            "%s Dosya yüklendi (%lu byte). Sonraki mesajınıza eklenecek.%s\n",
-            COLOR_INFO, c_len, COLOR_RESET);
-
-        /* Format: \n\n--- FILE: path ---\n content... */
-        size_t total_len = c_len + strlen(fpath) + 100;
-        PENDING_FILE_CONTENT = malloc(total_len);
-        snprintf(PENDING_FILE_CONTENT, total_len,
-                 "\n\n--- FILE: %s ---\n%s\n----------------\nUser "
-                 "instruction: I have attached a file above. Please "
-                 "acknowledge it and wait for my question.",
-                 fpath, fcontent);
-        free(fcontent);
+        size_t n = 0, total = 0;
+        for (Attach *a = att; a; a = a->next) {
+          if (grep && grep[0])
+            a->grep = my_strdup(grep);
+          n++;
+          total += a->size;
+        }
+        attach_push(&PENDING_ATTACH, att);
+
+        /* İçerik kopyalanmaz; gönderimde eşlemeden okunur */
+        if (single)
+          printf("%s Dosya yüklendi (%zu byte). Sonraki mesajınıza "
+                 "eklenecek.%s\n",
+                 COLOR_INFO, total, COLOR_RESET);
+        else
+          printf("%s %zu dosya yüklendi (%zu byte; %zu .gitignore, %zu "
+                 "ikili/okunamayan atlandı%s). Sonraki mesajınıza "
+                 "eklenecek.%s\n",
+                 COLOR_INFO, n, total, pl.ignored, skipped,
+                 pl.truncated ? "; dosya sınırına ulaşıldı" : "",
+                 COLOR_RESET);
       }
+      path_list_free(&pl);
+      continue;
+    }
+
+    if (!strcmp(buf, "/blocks")) {
+      print_blocks(LAST_RESPONSE);
       continue;
     }
 
@@ -1291,6 +8799,34 @@ int main(int argc, char **argv) {
       while (*fpath == ' ')
         fpath++;
 
+      /* /save N dosya: sadece N. kod bloğu */
+      int block_no = 0, consumed = 0;
+      if (sscanf(fpath, "%d %n", &block_no, &consumed) == 1 && consumed > 0 &&
+          fpath[consumed - 1] == ' ' && fpath[consumed] != '\0') {
+        const MdSpan *blk = md_block(block_no);
+        if (!blk || blk->end > strlen(LAST_RESPONSE)) {
+          printf("%s[!] Böyle bir kod bloğu yok: %d%s\n", COLOR_ERROR,
+                 block_no, COLOR_RESET);
+          continue;
+        }
+        fpath += consumed;
+        size_t blen = blk->end - blk->start;
+        char *code = malloc(blen + 1);
+        if (!code)
+          continue;
+        memcpy(code, LAST_RESPONSE + blk->start, blen);
+        code[blen] = '\0';
+        int wrc = write_file(fpath, code);
+        free(code);
+        if (wrc == 0)
+          printf("%s[+] %d. kod bloğu kaydedildi: %s%s\n", COLOR_INFO,
+                 block_no, fpath, COLOR_RESET);
+        else
+          printf("%s[!] Dosya yazılamadı: %s%s\n", COLOR_ERROR, fpath,
+                 COLOR_RESET);
+        continue;
+      }
+
       if (write_file(fpath, LAST_RESPONSE) == 0) {
         printf("%s[+] Cevap dosyaya kaydedildi: %s%s\n", COLOR_INFO, fpath,
                COLOR_RESET);
@@ -1325,21 +8861,6 @@ int main(int argc, char **argv) {
 
     log_msg("Modelden cevap bekleniyor...");
 
-    char *final_prompt = buf;
-    char *to_free = NULL;
-
-    if (PENDING_FILE_CONTENT) {
-      size_t flen = strlen(PENDING_FILE_CONTENT);
-      size_t plen = strlen(buf);
-      to_free = malloc(flen + plen + 2);
-      strcpy(to_free, PENDING_FILE_CONTENT);
-      strcat(to_free, "\n");
-      strcat(to_free, buf);
-      final_prompt = to_free;
-
-      free(PENDING_FILE_CONTENT);
-      PENDING_FILE_CONTENT = NULL; /* Tüketildi */
-    }
     /* Streaming modunda log_msg("Modelden cevap bekleniyor..."); demistik ama
        callback zaten yazmaya başladıgı için kullanıcı cevap geldigini anlar.
        Sadece ekrana baslarken 'ChatGPT:' header'ı lazim.
@@ -1349,37 +8870,60 @@ int main(int argc, char **argv) {
     printf("\n%sChatGPT:%s", COLOR_ASSIST, COLOR_RESET);
     fflush(stdout);
 
-    char *answer = call_openai(api_key, model, final_prompt);
-    if (to_free)
-      free(to_free);
+    char *answer = call_openai(api_key, model, buf, PENDING_ATTACH, NULL);
 
     if (answer) {
       /* Streaming zaten ekrana bastı, tekrar basma! */
       printf("\n"); /* Son bir newline */
 
-      extract_commands_from_answer(answer);
+      md_commands(answer);
       if (LAST_CMD_COUNT > 0) {
-        printf("%s%s:%s\n", COLOR_CMD, ui_suggested, COLOR_RESET);
+        printf("%s%s:%s\n", COLOR_CMD, ui->suggested, COLOR_RESET);
         for (int i = 0; i < LAST_CMD_COUNT; i++) {
           printf("  [%d] $ %s\n", i + 1, LAST_CMDS[i]);
         }
-        printf("%s\n", ui_run_hint);
+        printf("%s\n", ui->run_hint);
+      }
+      if (PENDING_ATTACH) {
+        /* Gönderilen ekler turla birlikte bağlamda kalır; aynı içerik
+           sonraki mesajlarda tekrar gönderilmez */
+        StrBuf user;
+        sb_init(&user);
+        attach_render(PENDING_ATTACH, &user);
+        sb_append(&user, buf);
+        uint64_t before = HIST.next_id;
+        add_turn(user.data ? user.data : buf, answer);
+        if (HIST.next_id != before && HIST.count > 0)
+          attach_commit(PENDING_ATTACH, hist_at(HIST.count - 1)->id);
+        sb_free(&user);
+      } else {
+        add_turn(buf, answer);
       }
-      add_turn(buf, answer);
+      compact_maybe_start(api_key, model);
       free(answer);
     } else {
       log_msg("Cevap alınamadı (boş veya hata).");
     }
+    /* Ek bu mesajla tüketildi */
+    attach_free(PENDING_ATTACH);
+    PENDING_ATTACH = NULL;
   }
 
+  compact_stop();
+  rate_close();
+  http_cleanup();
   free(api_key);
-  free(model_cfg);
+  free(model);
   free(buf);
   clear_last_cmds();
-  for (int i = 0; i < TURN_COUNT; i++) {
-    free(TURNS[i].user);
-    free(TURNS[i].assistant);
-  }
+  journal_close();
+  free_history();
+  bpe_unload();
+  lat_free();
+  config_free();
+  md_free();
+  attach_free(PENDING_ATTACH);
+  ctx_free();
 
   return 0;
 }